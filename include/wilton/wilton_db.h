@@ -36,6 +36,9 @@ typedef struct wilton_DBConnection wilton_DBConnection;
 struct wilton_DBTransaction;
 typedef struct wilton_DBTransaction wilton_DBTransaction;
 
+struct wilton_DBCursor;
+typedef struct wilton_DBCursor wilton_DBCursor;
+
 char* wilton_DBConnection_open(
         wilton_DBConnection** conn_out,
         const char* conn_url,
@@ -57,6 +60,14 @@ char* wilton_DBConnection_execute(
         const char* params_json,
         int params_json_len);
 
+char* wilton_DBConnection_execute_batch(
+        wilton_DBConnection* conn,
+        const char* sql_text,
+        int sql_text_len,
+        const char* params_list_json,
+        int params_list_json_len,
+        long long* executed_count_out);
+
 char* wilton_DBConnection_close(
         wilton_DBConnection* conn);
 
@@ -70,6 +81,23 @@ char* wilton_DBTransaction_commit(
 char* wilton_DBTransaction_rollback(
         wilton_DBTransaction* tran);
 
+char* wilton_DBCursor_open(
+        wilton_DBConnection* conn,
+        const char* sql_text,
+        int sql_text_len,
+        const char* params_json,
+        int params_json_len,
+        wilton_DBCursor** cursor_out);
+
+char* wilton_DBCursor_fetch(
+        wilton_DBCursor* cursor,
+        int max_rows,
+        char** result_set_out,
+        int* result_set_len_out);
+
+char* wilton_DBCursor_close(
+        wilton_DBCursor* cursor);
+
 char* wilton_DBConnection_initialize_backends();
 
 #ifdef __cplusplus
@@ -40,6 +40,19 @@ char* wilton_PGConnection_execute_sql(wilton_PGConnection* conn,
         char** result_set_out,
         int* result_set_len_out);
 
+char* wilton_PGConnection_execute_sql_with_timeout(wilton_PGConnection* conn,
+        const char* sql_text,
+        int sql_text_len,
+        const char* params_json,
+        int params_json_len,
+        int cache_flag,
+        int timeout_millis,
+        char** result_set_out,
+        int* result_set_len_out);
+
+char* wilton_PGConnection_cancel(
+        wilton_PGConnection* conn);
+
 char* wilton_PGConnection_close(
         wilton_PGConnection* conn);
 
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "columnar_file_writer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+
+namespace wilton {
+namespace db {
+namespace pgsql {
+
+namespace { // anonymous
+
+const char* header_magic = "WDBCOLS1";
+const char* footer_magic = "WDBCOLE1";
+
+columnar_file_writer::storage storage_for_type(Oid type_id) {
+    switch (type_id) {
+    case 20: // int8
+    case 21: // int2
+    case 23: // int4
+        return columnar_file_writer::storage::int64;
+    case 700: // float4
+    case 701: // float8
+        return columnar_file_writer::storage::float64;
+    case 16: // bool
+        return columnar_file_writer::storage::boolean;
+    default:
+        return columnar_file_writer::storage::bytes;
+    }
+}
+
+void append_le(std::string& out, uint64_t val, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out.push_back(static_cast<char>((val >> (i * 8)) & 0xff));
+    }
+}
+
+size_t padding_for(uint64_t len) {
+    return static_cast<size_t>((8 - (len % 8)) % 8);
+}
+
+} // namespace
+
+columnar_file_writer::columnar_file_writer(const std::string& path, uint32_t block_rows) :
+path(path),
+stream(path, std::ios::binary | std::ios::trunc),
+block_rows_limit(block_rows) {
+    if (!stream.is_open()) throw support::exception(TRACEMSG(
+            "Cannot open result file, path: [" + path + "]"));
+    if (0 == block_rows) throw support::exception(TRACEMSG(
+            "Invalid block rows count specified: [0]"));
+}
+
+columnar_file_writer::~columnar_file_writer() STATICLIB_NOEXCEPT {
+    if (!finished) {
+        stream.close();
+        std::remove(path.c_str());
+    }
+}
+
+void columnar_file_writer::append_rows(PGresult* res) {
+    if (!header_written) {
+        write_header(res);
+    }
+    int tuples_count = PQntuples(res);
+    for (int i = 0; i < tuples_count; ++i) {
+        size_t bit = block_rows % 8;
+        for (size_t j = 0; j < columns.size(); ++j) {
+            auto& col = columns[j];
+            int idx = static_cast<int>(j);
+            if (0 == bit) {
+                col.nulls.push_back('\0');
+            }
+            bool null = 0 != PQgetisnull(res, i, idx);
+            if (null) {
+                col.nulls.back() = static_cast<char>(col.nulls.back() | (1 << bit));
+            }
+            const char* val = PQgetvalue(res, i, idx);
+            size_t len = static_cast<size_t>(PQgetlength(res, i, idx));
+            switch (col.kind) {
+            case storage::int64: {
+                int64_t num = null ? 0 : static_cast<int64_t>(std::strtoll(val, nullptr, 10));
+                append_le(col.values, static_cast<uint64_t>(num), 8);
+                break;
+            }
+            case storage::float64: {
+                // strtod also handles NaN and Infinity
+                double num = null ? 0 : std::strtod(val, nullptr);
+                uint64_t bits = 0;
+                std::memcpy(std::addressof(bits), std::addressof(num), sizeof(bits));
+                append_le(col.values, bits, 8);
+                break;
+            }
+            case storage::boolean:
+                col.values.push_back(!null && 't' == val[0] ? '\1' : '\0');
+                break;
+            case storage::bytes:
+                if (col.offsets.empty()) {
+                    col.offsets.push_back(0);
+                }
+                if (!null && 17 == col.type_id) { // bytea
+                    size_t bin_len = 0;
+                    unsigned char* bin = PQunescapeBytea(reinterpret_cast<const unsigned char*>(val),
+                            std::addressof(bin_len));
+                    if (nullptr == bin) throw support::exception(TRACEMSG("Cannot decode bytea value"));
+                    col.values.append(reinterpret_cast<const char*>(bin), bin_len);
+                    PQfreemem(bin);
+                } else if (!null) {
+                    col.values.append(val, len);
+                }
+                col.offsets.push_back(static_cast<uint64_t>(col.values.length()));
+                break;
+            }
+        }
+        block_rows += 1;
+        rows_count += 1;
+        if (block_rows >= block_rows_limit) {
+            flush_block();
+        }
+    }
+}
+
+uint64_t columnar_file_writer::finish(PGresult* res) {
+    if (!header_written) {
+        write_header(res);
+    }
+    if (block_rows > 0) {
+        flush_block();
+    }
+    uint64_t footer_offset = written;
+    for (uint64_t offset : block_offsets) {
+        write_u64(offset);
+    }
+    write_u64(static_cast<uint64_t>(block_offsets.size()));
+    write_u64(rows_count);
+    write_u64(footer_offset);
+    write_bytes(footer_magic, 8);
+    stream.close();
+    if (stream.fail()) throw support::exception(TRACEMSG(
+            "Cannot write result file, path: [" + path + "]"));
+    finished = true;
+    return written;
+}
+
+void columnar_file_writer::write_header(PGresult* res) {
+    int fields_count = PQnfields(res);
+    auto header = std::string(header_magic, 8);
+    append_le(header, static_cast<uint64_t>(fields_count), 4);
+    append_le(header, 0, 4);
+    for (int j = 0; j < fields_count; ++j) {
+        auto col = column();
+        col.name = PQfname(res, j);
+        col.type_id = PQftype(res, j);
+        col.kind = storage_for_type(col.type_id);
+        append_le(header, col.type_id, 4);
+        header.push_back(static_cast<char>(col.kind));
+        append_le(header, 0, 3);
+        append_le(header, static_cast<uint64_t>(col.name.length()), 4);
+        header.append(col.name);
+        columns.emplace_back(std::move(col));
+    }
+    write_bytes(header.data(), header.length());
+    write_padding();
+    header_written = true;
+}
+
+void columnar_file_writer::flush_block() {
+    block_offsets.push_back(written);
+    // chunks follow the block header, each one is padded to 8 bytes
+    uint64_t offset = 8 + 16 * static_cast<uint64_t>(columns.size());
+    write_u64(block_rows);
+    for (auto& col : columns) {
+        uint64_t nulls_len = col.nulls.length() + padding_for(col.nulls.length());
+        uint64_t len = nulls_len;
+        if (storage::bytes == col.kind) {
+            len += 8 * col.offsets.size() + col.values.length();
+        } else {
+            len += col.values.length();
+        }
+        write_u64(offset);
+        write_u64(len);
+        offset += len + padding_for(len);
+    }
+    for (auto& col : columns) {
+        write_bytes(col.nulls.data(), col.nulls.length());
+        write_padding();
+        if (storage::bytes == col.kind) {
+            for (uint64_t off : col.offsets) {
+                write_u64(off);
+            }
+        }
+        write_bytes(col.values.data(), col.values.length());
+        write_padding();
+        // buffers capacity is reused for the next block
+        col.nulls.clear();
+        col.values.clear();
+        col.offsets.clear();
+    }
+    block_rows = 0;
+}
+
+void columnar_file_writer::write_bytes(const char* data, size_t len) {
+    stream.write(data, static_cast<std::streamsize>(len));
+    if (!stream.good()) throw support::exception(TRACEMSG(
+            "Cannot write result file, path: [" + path + "]," +
+            " offset: [" + sl::support::to_string(written) + "]"));
+    written += len;
+}
+
+void columnar_file_writer::write_u64(uint64_t val) {
+    auto buf = std::string();
+    append_le(buf, val, 8);
+    write_bytes(buf.data(), buf.length());
+}
+
+void columnar_file_writer::write_padding() {
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    write_bytes(zeros, padding_for(written));
+}
+
+} // namespace
+}
+}
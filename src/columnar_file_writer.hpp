@@ -0,0 +1,129 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   columnar_file_writer.hpp
+ * Author: alex
+ *
+ * Streams PostgreSQL result rows into a typed columnar file,
+ * that can be memory-mapped by the readers without parsing.
+ */
+
+#ifndef WILTON_DB_COLUMNAR_FILE_WRITER_HPP
+#define WILTON_DB_COLUMNAR_FILE_WRITER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <libpq-fe.h>
+
+#include "staticlib/config.hpp"
+
+namespace wilton {
+namespace db {
+namespace pgsql {
+
+/**
+ * File layout, all integers are little-endian, all sections start at 8-byte aligned offsets:
+ *
+ * header:  "WDBCOLS1", uint32 columns count, uint32 zero,
+ *          for each column: uint32 type OID, uint8 storage, 3 zero bytes, uint32 name length, name bytes
+ * blocks:  uint64 rows count, for each column: uint64 chunk offset (from the block start), uint64 chunk length,
+ *          then column chunks: NULL bitmap (bit set for NULL, ceil(rows / 8) bytes) followed by values:
+ *          'int64' and 'float64' - 8 bytes for each row, 'boolean' - 1 byte for each row,
+ *          'bytes' - (rows + 1) uint64 offsets into the data that follows them
+ * footer:  uint64 offsets of all blocks, uint64 blocks count, uint64 rows count,
+ *          uint64 offset of the footer, "WDBCOLE1"
+ *
+ * Integer types are widened to int64, float types to float64, 'bytea' values are written
+ * as binary data, all other types as their text representation.
+ */
+class columnar_file_writer {
+public:
+    enum class storage : uint8_t {
+        int64 = 1,
+        float64 = 2,
+        boolean = 3,
+        bytes = 4
+    };
+
+private:
+    struct column {
+        std::string name;
+        Oid type_id;
+        storage kind;
+        std::string nulls;
+        std::string values;
+        std::vector<uint64_t> offsets;
+    };
+
+    std::string path;
+    std::ofstream stream;
+    uint32_t block_rows_limit;
+    std::vector<column> columns;
+    bool header_written = false;
+    bool finished = false;
+    uint32_t block_rows = 0;
+    uint64_t rows_count = 0;
+    uint64_t written = 0;
+    std::vector<uint64_t> block_offsets;
+
+public:
+    columnar_file_writer(const std::string& path, uint32_t block_rows);
+
+    /**
+     * Removes the file if 'finish' was not called
+     */
+    ~columnar_file_writer() STATICLIB_NOEXCEPT;
+
+    columnar_file_writer(const columnar_file_writer&) = delete;
+
+    columnar_file_writer& operator=(const columnar_file_writer&) = delete;
+
+    /**
+     * Columns are taken from the first result
+     */
+    void append_rows(PGresult* res);
+
+    /**
+     * Writes last block and footer, 'res' is used for the header when there were no rows,
+     * returns file size
+     */
+    uint64_t finish(PGresult* res);
+
+    uint64_t get_rows_count() const {
+        return rows_count;
+    }
+
+private:
+    void write_header(PGresult* res);
+
+    void flush_block();
+
+    void write_bytes(const char* data, size_t len);
+
+    void write_u64(uint64_t val);
+
+    void write_padding();
+};
+
+} // namespace
+}
+}
+
+#endif /* WILTON_DB_COLUMNAR_FILE_WRITER_HPP */
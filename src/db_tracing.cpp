@@ -0,0 +1,165 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "db_tracing.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "staticlib/json.hpp"
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+// small sequential ids are easier to read in trace viewers
+uint64_t thread_index(std::map<std::thread::id, uint64_t>& ids) {
+    auto tid = std::this_thread::get_id();
+    auto it = ids.find(tid);
+    if (ids.end() != it) {
+        return it->second;
+    }
+    uint64_t idx = static_cast<uint64_t>(ids.size() + 1);
+    ids.insert(std::make_pair(tid, idx));
+    return idx;
+}
+
+std::map<std::thread::id, uint64_t>& thread_ids() {
+    static std::map<std::thread::id, uint64_t> ids;
+    return ids;
+}
+
+} // namespace
+
+void trace_recorder::start(size_t max_events) {
+    if (0 == max_events) throw support::exception(TRACEMSG(
+            "Invalid max events specified: [0]"));
+    std::lock_guard<std::mutex> guard{mutex};
+    events.clear();
+    events.reserve(std::min(max_events, static_cast<size_t>(1 << 16)));
+    this->max_events = max_events;
+    dropped = 0;
+    origin = clock_type::now();
+    thread_ids().clear();
+    enabled.store(true);
+}
+
+uint64_t trace_recorder::stop(const std::string& path) {
+    enabled.store(false);
+    auto list = std::vector<event>();
+    uint64_t dropped_count = 0;
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        list.swap(events);
+        dropped_count = dropped;
+    }
+    auto json_events = std::vector<sl::json::value>();
+    json_events.reserve(list.size());
+    for (auto& ev : list) {
+        json_events.emplace_back(sl::json::value({
+            { "name", ev.name },
+            { "cat", "wilton_db" },
+            { "ph", "X" },
+            { "ts", ev.start_micros },
+            { "dur", ev.duration_micros },
+            { "pid", 1 },
+            { "tid", static_cast<int64_t>(ev.thread_id) },
+            { "args", {
+                    { "cpuMicros", ev.cpu_micros }
+                }
+            }
+        }));
+    }
+    auto json = sl::json::value({
+        { "traceEvents", std::move(json_events) },
+        { "displayTimeUnit", "ms" },
+        { "otherData", {
+                { "droppedEvents", static_cast<int64_t>(dropped_count) }
+            }
+        }
+    });
+    std::ofstream stream{path, std::ios::binary};
+    if (!stream.is_open()) throw support::exception(TRACEMSG(
+            "Cannot open trace file, path: [" + path + "]"));
+    stream << json.dumps();
+    stream.close();
+    if (stream.fail()) throw support::exception(TRACEMSG(
+            "Cannot write trace file, path: [" + path + "]"));
+    return static_cast<uint64_t>(list.size());
+}
+
+void trace_recorder::record(const char* name, clock_type::time_point start, clock_type::time_point end,
+        int64_t cpu_micros) {
+    namespace ch = std::chrono;
+    std::lock_guard<std::mutex> guard{mutex};
+    if (!is_enabled()) {
+        // stopped while the span was open
+        return;
+    }
+    if (events.size() >= max_events) {
+        dropped += 1;
+        return;
+    }
+    auto ev = event();
+    ev.name = name;
+    ev.start_micros = ch::duration_cast<ch::microseconds>(start - origin).count();
+    ev.duration_micros = ch::duration_cast<ch::microseconds>(end - start).count();
+    ev.cpu_micros = cpu_micros;
+    ev.thread_id = thread_index(thread_ids());
+    events.push_back(ev);
+}
+
+trace_recorder& trace_recorder::instance() {
+    static trace_recorder recorder;
+    return recorder;
+}
+
+int64_t thread_cpu_micros() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    // 100ns intervals
+    uint64_t k = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    uint64_t u = (static_cast<uint64_t>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return static_cast<int64_t>((k + u) / 10);
+#else
+    struct timespec ts;
+    if (0 != clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+        return 0;
+    }
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + static_cast<int64_t>(ts.tv_nsec) / 1000;
+#endif
+}
+
+} // namespace
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   db_tracing.hpp
+ * Author: alex
+ *
+ * Optional timestamped spans for the phases of DB calls,
+ * exported in Chrome trace format.
+ */
+
+#ifndef WILTON_DB_DB_TRACING_HPP
+#define WILTON_DB_DB_TRACING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "staticlib/config.hpp"
+
+namespace wilton {
+namespace db {
+
+/**
+ * Collects spans from all threads while enabled, events after 'max_events'
+ * are dropped; recording is a single atomic load when disabled
+ */
+class trace_recorder {
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+private:
+    struct event {
+        const char* name;
+        int64_t start_micros;
+        int64_t duration_micros;
+        int64_t cpu_micros;
+        uint64_t thread_id;
+    };
+
+    std::atomic<bool> enabled;
+    std::mutex mutex;
+    std::vector<event> events;
+    size_t max_events = 0;
+    uint64_t dropped = 0;
+    clock_type::time_point origin;
+
+public:
+    trace_recorder() :
+    enabled(false) { }
+
+    trace_recorder(const trace_recorder&) = delete;
+
+    trace_recorder& operator=(const trace_recorder&) = delete;
+
+    bool is_enabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Clears collected events and starts recording
+     */
+    void start(size_t max_events);
+
+    /**
+     * Stops recording and writes collected events as Chrome trace JSON
+     * (chrome://tracing, Perfetto), returns the number of written events
+     */
+    uint64_t stop(const std::string& path);
+
+    void record(const char* name, clock_type::time_point start, clock_type::time_point end,
+            int64_t cpu_micros);
+
+    static trace_recorder& instance();
+};
+
+/**
+ * CPU time of the calling thread, microseconds
+ */
+int64_t thread_cpu_micros();
+
+/**
+ * Records wall and thread CPU time of the enclosing scope,
+ * name must be a string literal
+ */
+class trace_span {
+    const char* name;
+    bool active;
+    trace_recorder::clock_type::time_point start;
+    int64_t cpu_start = 0;
+
+public:
+    explicit trace_span(const char* name) :
+    name(name),
+    active(trace_recorder::instance().is_enabled()) {
+        if (active) {
+            start = trace_recorder::clock_type::now();
+            cpu_start = thread_cpu_micros();
+        }
+    }
+
+    ~trace_span() STATICLIB_NOEXCEPT {
+        if (active) {
+            auto cpu = thread_cpu_micros() - cpu_start;
+            trace_recorder::instance().record(name, start, trace_recorder::clock_type::now(), cpu);
+        }
+    }
+
+    trace_span(const trace_span&) = delete;
+
+    trace_span& operator=(const trace_span&) = delete;
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_DB_TRACING_HPP */
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "deadline_watchdog.hpp"
+
+namespace wilton {
+namespace db {
+
+deadline_watchdog::~deadline_watchdog() STATICLIB_NOEXCEPT {
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        stopped = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+deadline_watchdog::token_type deadline_watchdog::arm(uint32_t timeout_millis, std::function<void()> on_expire) {
+    auto deadline = clock_type::now() + std::chrono::milliseconds(timeout_millis);
+    std::lock_guard<std::mutex> guard{mutex};
+    if (!started) {
+        worker = std::thread([this] {
+            this->run();
+        });
+        started = true;
+    }
+    counter += 1;
+    auto token = std::make_pair(deadline, counter);
+    deadlines.insert(std::make_pair(token, std::move(on_expire)));
+    cv.notify_all();
+    return token;
+}
+
+void deadline_watchdog::disarm(const token_type& token) {
+    std::unique_lock<std::mutex> lock{mutex};
+    deadlines.erase(token);
+    while (token.second == firing) {
+        cv.wait(lock);
+    }
+}
+
+deadline_watchdog& deadline_watchdog::instance() {
+    static deadline_watchdog watchdog;
+    return watchdog;
+}
+
+void deadline_watchdog::run() {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (!stopped) {
+        if (deadlines.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        auto first = deadlines.begin();
+        if (clock_type::now() < first->first.first) {
+            cv.wait_until(lock, first->first.first);
+            continue;
+        }
+        auto on_expire = std::move(first->second);
+        firing = first->first.second;
+        deadlines.erase(first);
+        lock.unlock();
+        try {
+            on_expire();
+        } catch (...) {
+            // nothing we can do from here
+        }
+        lock.lock();
+        firing = 0;
+        cv.notify_all();
+    }
+}
+
+} // namespace
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WILTON_DB_DEADLINE_WATCHDOG_HPP
+#define WILTON_DB_DEADLINE_WATCHDOG_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "staticlib/config.hpp"
+
+namespace wilton {
+namespace db {
+
+/**
+ * Single background thread that runs callbacks for expired deadlines,
+ * shared by all connections of the module.
+ */
+class deadline_watchdog {
+public:
+    typedef std::chrono::steady_clock clock_type;
+    typedef std::pair<clock_type::time_point, uint64_t> token_type;
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<token_type, std::function<void()>> deadlines;
+    std::thread worker;
+    uint64_t counter = 0;
+    uint64_t firing = 0;
+    bool started = false;
+    bool stopped = false;
+
+public:
+    deadline_watchdog() { }
+
+    ~deadline_watchdog() STATICLIB_NOEXCEPT;
+
+    deadline_watchdog(const deadline_watchdog&) = delete;
+
+    deadline_watchdog& operator=(const deadline_watchdog&) = delete;
+
+    /**
+     * Schedules callback to be called from the watchdog thread
+     * after the specified timeout
+     */
+    token_type arm(uint32_t timeout_millis, std::function<void()> on_expire);
+
+    /**
+     * Removes the deadline; if its callback is running at the moment,
+     * waits for it to finish, callback is never called after this returns
+     */
+    void disarm(const token_type& token);
+
+    static deadline_watchdog& instance();
+
+private:
+    void run();
+};
+
+/**
+ * Deadline, that is armed for the lifetime of the guard,
+ * zero timeout means no deadline
+ */
+class deadline_guard {
+    bool armed;
+    deadline_watchdog::token_type token;
+
+public:
+    deadline_guard(uint32_t timeout_millis, std::function<void()> on_expire) :
+    armed(timeout_millis > 0) {
+        if (armed) {
+            token = deadline_watchdog::instance().arm(timeout_millis, std::move(on_expire));
+        }
+    }
+
+    ~deadline_guard() STATICLIB_NOEXCEPT {
+        if (armed) {
+            deadline_watchdog::instance().disarm(token);
+        }
+    }
+
+    deadline_guard(const deadline_guard&) = delete;
+
+    deadline_guard& operator=(const deadline_guard&) = delete;
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_DEADLINE_WATCHDOG_HPP */
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decode_pool.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+
+#include "db_tracing.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+struct partitions_state {
+    size_t remaining;
+    std::exception_ptr error;
+
+    explicit partitions_state(size_t remaining) :
+    remaining(remaining) { }
+};
+
+} // namespace
+
+decode_pool::decode_pool(size_t threads_count) :
+threads_count(threads_count) { }
+
+decode_pool::~decode_pool() STATICLIB_NOEXCEPT {
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        stopped = true;
+    }
+    cv.notify_all();
+    for (auto& th : workers) {
+        if (th.joinable()) {
+            th.join();
+        }
+    }
+}
+
+void decode_pool::run_partitions(size_t count, const std::function<void(size_t)>& fun) {
+    auto state = std::make_shared<partitions_state>(count);
+    std::unique_lock<std::mutex> lock{mutex};
+    if (!started) {
+        for (size_t i = 0; i < threads_count; i++) {
+            workers.emplace_back([this] {
+                this->run();
+            });
+        }
+        started = true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // 'fun' outlives the tasks, this call returns only after all of them are finished
+        tasks.emplace_back([this, state, &fun, i] {
+            std::exception_ptr err;
+            try {
+                trace_span span{"decode_partition"};
+                fun(i);
+            } catch (...) {
+                err = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard{mutex};
+            if (err && !state->error) {
+                state->error = err;
+            }
+            state->remaining -= 1;
+            if (0 == state->remaining) {
+                cv.notify_all();
+            }
+        });
+    }
+    cv.notify_all();
+    // help with queued tasks instead of waiting idle
+    while (state->remaining > 0) {
+        if (tasks.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+decode_pool& decode_pool::instance() {
+    // one core is left for the calling threads
+    static decode_pool pool{std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, 7u)};
+    return pool;
+}
+
+void decode_pool::run() {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (!stopped) {
+        if (tasks.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+} // namespace
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   decode_pool.hpp
+ * Author: alex
+ *
+ * Small pool of threads shared by all connections, used to decode
+ * large results in parallel.
+ */
+
+#ifndef WILTON_DB_DECODE_POOL_HPP
+#define WILTON_DB_DECODE_POOL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "staticlib/config.hpp"
+
+namespace wilton {
+namespace db {
+
+class decode_pool {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    size_t threads_count;
+    bool started = false;
+    bool stopped = false;
+
+public:
+    explicit decode_pool(size_t threads_count);
+
+    ~decode_pool() STATICLIB_NOEXCEPT;
+
+    decode_pool(const decode_pool&) = delete;
+
+    decode_pool& operator=(const decode_pool&) = delete;
+
+    /**
+     * Number of partitions that can run at once, including the calling thread
+     */
+    size_t concurrency() const {
+        return threads_count + 1;
+    }
+
+    /**
+     * Runs 'fun' for every partition index in [0, count), blocks until
+     * all of them are finished, calling thread runs queued partitions too;
+     * first error is rethrown after all partitions are finished
+     */
+    void run_partitions(size_t count, const std::function<void(size_t)>& fun);
+
+    /**
+     * Threads are started on the first use
+     */
+    static decode_pool& instance();
+
+private:
+    void run();
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_DECODE_POOL_HPP */
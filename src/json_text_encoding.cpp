@@ -0,0 +1,217 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "json_text_encoding.hpp"
+
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WILTON_DB_JSON_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+#endif // SSE2
+
+// AVX2 is used only after runtime CPU check, 'target' attribute is required for GCC and Clang,
+// MSVC compiles AVX2 intrinsics without '/arch' flag
+#if defined(WILTON_DB_JSON_SSE2) && (defined(_M_X64) || defined(__x86_64__)) && \
+        (defined(_MSC_VER) || defined(__clang__) || \
+        (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define WILTON_DB_JSON_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define WILTON_DB_TARGET_AVX2
+#else
+#define WILTON_DB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif // _MSC_VER
+#endif // AVX2
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+const char* hex_digits = "0123456789abcdef";
+
+bool needs_escape(char ch) {
+    unsigned char uch = static_cast<unsigned char>(ch);
+    return '"' == ch || '\\' == ch || uch < 0x20;
+}
+
+#ifdef WILTON_DB_JSON_SSE2
+int first_bit(int mask) {
+#ifdef _MSC_VER
+    unsigned long idx = 0;
+    _BitScanForward(&idx, static_cast<unsigned long>(mask));
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctz(static_cast<unsigned int>(mask));
+#endif // _MSC_VER
+}
+#endif // WILTON_DB_JSON_SSE2
+
+#ifdef WILTON_DB_JSON_AVX2
+bool detect_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // OSXSAVE and AVX, YMM state must be enabled by OS
+    const int osxsave_avx = (1 << 27) | (1 << 28);
+    if (osxsave_avx != (info[2] & osxsave_avx) || 6 != (_xgetbv(0) & 6)) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return 0 != (info[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return 0 != __builtin_cpu_supports("avx2");
+#endif // _MSC_VER
+}
+
+const bool avx2_supported = detect_avx2();
+
+// checks whole 32-byte blocks only, returns position of the first byte
+// to escape, or the start of the unchecked tail
+WILTON_DB_TARGET_AVX2
+size_t find_json_escape_avx2(const char* data, size_t len) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control_max = _mm256_set1_epi8(0x1f);
+    size_t pos = 0;
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control_max), control_max);
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash));
+        int mask = _mm256_movemask_epi8(_mm256_or_si256(control, special));
+        if (0 != mask) {
+            return pos + static_cast<size_t>(first_bit(mask));
+        }
+    }
+    return pos;
+}
+#endif // WILTON_DB_JSON_AVX2
+
+} // namespace
+
+size_t find_json_escape(const char* data, size_t len) {
+    size_t pos = 0;
+#ifdef WILTON_DB_JSON_AVX2
+    // SSE2 and scalar loops below continue from the returned position
+    if (avx2_supported) {
+        pos = find_json_escape_avx2(data, len);
+    }
+#endif // WILTON_DB_JSON_AVX2
+#ifdef WILTON_DB_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1f);
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        // unsigned 'chunk <= 0x1f', bytes over 0x7f are not control characters
+        __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        int mask = _mm_movemask_epi8(_mm_or_si128(control, special));
+        if (0 != mask) {
+            return pos + static_cast<size_t>(first_bit(mask));
+        }
+    }
+#endif // WILTON_DB_JSON_SSE2
+    for (; pos < len; pos++) {
+        if (needs_escape(data[pos])) {
+            return pos;
+        }
+    }
+    return len;
+}
+
+void write_json_string(const char* data, size_t len, std::string& out) {
+    out.push_back('"');
+    size_t pos = 0;
+    while (pos < len) {
+        size_t safe = find_json_escape(data + pos, len - pos);
+        out.append(data + pos, safe);
+        pos += safe;
+        if (pos == len) {
+            break;
+        }
+        char ch = data[pos];
+        switch (ch) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default: {
+            unsigned char uch = static_cast<unsigned char>(ch);
+            out.append("\\u00");
+            out.push_back(hex_digits[uch >> 4]);
+            out.push_back(hex_digits[uch & 0x0f]);
+        }
+        }
+        pos += 1;
+    }
+    out.push_back('"');
+}
+
+bool is_json_number(const char* data, size_t len) {
+    size_t pos = 0;
+    if (pos < len && '-' == data[pos]) {
+        pos += 1;
+    }
+    // digits are required before and after the dot
+    size_t int_start = pos;
+    while (pos < len && data[pos] >= '0' && data[pos] <= '9') {
+        pos += 1;
+    }
+    size_t int_len = pos - int_start;
+    if (0 == int_len || (int_len > 1 && '0' == data[int_start])) {
+        return false;
+    }
+    if (pos < len && '.' == data[pos]) {
+        pos += 1;
+        size_t frac_start = pos;
+        while (pos < len && data[pos] >= '0' && data[pos] <= '9') {
+            pos += 1;
+        }
+        if (pos == frac_start) {
+            return false;
+        }
+    }
+    if (pos < len && ('e' == data[pos] || 'E' == data[pos])) {
+        pos += 1;
+        if (pos < len && ('+' == data[pos] || '-' == data[pos])) {
+            pos += 1;
+        }
+        size_t exp_start = pos;
+        while (pos < len && data[pos] >= '0' && data[pos] <= '9') {
+            pos += 1;
+        }
+        if (pos == exp_start) {
+            return false;
+        }
+    }
+    return pos == len;
+}
+
+} // namespace
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   json_text_encoding.hpp
+ * Author: alex
+ *
+ * Helpers for writing query results directly as JSON text,
+ * without building the JSON tree first.
+ */
+
+#ifndef WILTON_DB_JSON_TEXT_ENCODING_HPP
+#define WILTON_DB_JSON_TEXT_ENCODING_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace wilton {
+namespace db {
+
+/**
+ * Position of the first byte, that must be escaped in JSON string
+ * ('"', '\' or control character), or 'len' if there are none;
+ * 32 bytes are checked at once with AVX2 if CPU supports it (checked at runtime),
+ * otherwise 16 bytes with SSE2 where it is available
+ */
+size_t find_json_escape(const char* data, size_t len);
+
+/**
+ * Appends quoted and escaped JSON string, UTF-8 bytes are copied as is
+ */
+void write_json_string(const char* data, size_t len, std::string& out);
+
+inline void write_json_string(const std::string& str, std::string& out) {
+    write_json_string(str.data(), str.length(), out);
+}
+
+/**
+ * Checks that PostgreSQL text representation of a number is a valid
+ * JSON number, 'NaN' and 'Infinity' are not
+ */
+bool is_json_number(const char* data, size_t len);
+
+} // namespace
+}
+
+#endif /* WILTON_DB_JSON_TEXT_ENCODING_HPP */
@@ -0,0 +1,338 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "msgpack_encoding.hpp"
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+class msgpack_reader {
+    const unsigned char* data;
+    size_t len;
+    size_t pos = 0;
+
+public:
+    msgpack_reader(sl::io::span<const char> span) :
+    data(reinterpret_cast<const unsigned char*>(span.data())),
+    len(span.size()) { }
+
+    sl::json::value read_value() {
+        uint8_t tag = read_byte();
+        if (tag <= 0x7f) {
+            return sl::json::value(static_cast<int64_t>(tag));
+        } else if (tag >= 0xe0) {
+            return sl::json::value(static_cast<int64_t>(static_cast<int8_t>(tag)));
+        } else if ((tag & 0xe0) == 0xa0) {
+            return read_str(tag & 0x1f);
+        } else if ((tag & 0xf0) == 0x90) {
+            return read_array(tag & 0x0f);
+        } else if ((tag & 0xf0) == 0x80) {
+            return read_map(tag & 0x0f);
+        }
+        switch (tag) {
+        case 0xc0: return sl::json::value();
+        case 0xc2: return sl::json::value(false);
+        case 0xc3: return sl::json::value(true);
+        case 0xc4: return read_bin(read_be(1));
+        case 0xc5: return read_bin(read_be(2));
+        case 0xc6: return read_bin(read_be(4));
+        case 0xca: {
+            uint32_t bits = static_cast<uint32_t>(read_be(4));
+            float fl;
+            std::memcpy(std::addressof(fl), std::addressof(bits), sizeof(fl));
+            return sl::json::value(static_cast<double>(fl));
+        }
+        case 0xcb: {
+            uint64_t bits = read_be(8);
+            double db;
+            std::memcpy(std::addressof(db), std::addressof(bits), sizeof(db));
+            return sl::json::value(db);
+        }
+        case 0xcc: return sl::json::value(static_cast<int64_t>(read_be(1)));
+        case 0xcd: return sl::json::value(static_cast<int64_t>(read_be(2)));
+        case 0xce: return sl::json::value(static_cast<int64_t>(read_be(4)));
+        case 0xcf: {
+            uint64_t val = read_be(8);
+            if (val > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+                return sl::json::value(static_cast<double>(val));
+            }
+            return sl::json::value(static_cast<int64_t>(val));
+        }
+        case 0xd0: return sl::json::value(static_cast<int64_t>(static_cast<int8_t>(read_be(1))));
+        case 0xd1: return sl::json::value(static_cast<int64_t>(static_cast<int16_t>(read_be(2))));
+        case 0xd2: return sl::json::value(static_cast<int64_t>(static_cast<int32_t>(read_be(4))));
+        case 0xd3: return sl::json::value(static_cast<int64_t>(read_be(8)));
+        case 0xd9: return read_str(read_be(1));
+        case 0xda: return read_str(read_be(2));
+        case 0xdb: return read_str(read_be(4));
+        case 0xdc: return read_array(read_be(2));
+        case 0xdd: return read_array(read_be(4));
+        case 0xde: return read_map(read_be(2));
+        case 0xdf: return read_map(read_be(4));
+        default: throw support::exception(TRACEMSG(
+                "Unsupported MessagePack type, tag: [" + sl::support::to_string(static_cast<int>(tag)) + "]," +
+                " position: [" + sl::support::to_string(pos - 1) + "]"));
+        }
+    }
+
+    bool finished() {
+        return pos == len;
+    }
+
+private:
+    void ensure_available(uint64_t count) {
+        if (count > len - pos) throw support::exception(TRACEMSG(
+                "Unexpected end of MessagePack data, position: [" + sl::support::to_string(pos) + "]"));
+    }
+
+    uint8_t read_byte() {
+        ensure_available(1);
+        return data[pos++];
+    }
+
+    uint64_t read_be(size_t bytes_count) {
+        ensure_available(bytes_count);
+        uint64_t res = 0;
+        for (size_t i = 0; i < bytes_count; i++) {
+            res = (res << 8) | data[pos++];
+        }
+        return res;
+    }
+
+    sl::json::value read_str(uint64_t count) {
+        ensure_available(count);
+        auto str = std::string(reinterpret_cast<const char*>(data + pos), static_cast<size_t>(count));
+        pos += static_cast<size_t>(count);
+        return sl::json::value(std::move(str));
+    }
+
+    sl::json::value read_bin(uint64_t count) {
+        ensure_available(count);
+        static const char* hex = "0123456789abcdef";
+        auto str = std::string("\\x");
+        str.reserve(static_cast<size_t>(count) * 2 + 2);
+        for (size_t i = 0; i < count; i++) {
+            uint8_t byte = data[pos++];
+            str.push_back(hex[byte >> 4]);
+            str.push_back(hex[byte & 0x0f]);
+        }
+        return sl::json::value(std::move(str));
+    }
+
+    sl::json::value read_array(uint64_t count) {
+        std::vector<sl::json::value> vec;
+        for (uint64_t i = 0; i < count; i++) {
+            vec.emplace_back(read_value());
+        }
+        return sl::json::value(std::move(vec));
+    }
+
+    sl::json::value read_map(uint64_t count) {
+        std::vector<sl::json::field> fields;
+        for (uint64_t i = 0; i < count; i++) {
+            auto key = read_value();
+            if (sl::json::type::string != key.json_type()) throw support::exception(TRACEMSG(
+                    "Unsupported MessagePack map key, only string keys are supported," +
+                    " position: [" + sl::support::to_string(pos) + "]"));
+            auto val = read_value();
+            fields.emplace_back(key.as_string(), std::move(val));
+        }
+        return sl::json::value(std::move(fields));
+    }
+};
+
+} // namespace
+
+result_encoding parse_result_encoding(const std::string& name) {
+    if ("json" == name) {
+        return result_encoding::json;
+    } else if ("msgpack" == name) {
+        return result_encoding::msgpack;
+    }
+    throw support::exception(TRACEMSG("Unsupported result encoding: [" + name + "]," +
+            " supported encodings: [json, msgpack]"));
+}
+
+void msgpack_writer::write_nil() {
+    out.push_back(static_cast<char>(0xc0));
+}
+
+void msgpack_writer::write_bool(bool val) {
+    out.push_back(static_cast<char>(val ? 0xc3 : 0xc2));
+}
+
+void msgpack_writer::write_int(int64_t val) {
+    if (val >= 0) {
+        if (val <= 0x7f) {
+            out.push_back(static_cast<char>(val));
+        } else if (val <= 0xff) {
+            out.push_back(static_cast<char>(0xcc));
+            write_be(static_cast<uint64_t>(val), 1);
+        } else if (val <= 0xffff) {
+            out.push_back(static_cast<char>(0xcd));
+            write_be(static_cast<uint64_t>(val), 2);
+        } else if (val <= 0xffffffffLL) {
+            out.push_back(static_cast<char>(0xce));
+            write_be(static_cast<uint64_t>(val), 4);
+        } else {
+            out.push_back(static_cast<char>(0xcf));
+            write_be(static_cast<uint64_t>(val), 8);
+        }
+    } else {
+        if (val >= -32) {
+            out.push_back(static_cast<char>(val));
+        } else if (val >= std::numeric_limits<int8_t>::min()) {
+            out.push_back(static_cast<char>(0xd0));
+            write_be(static_cast<uint64_t>(val), 1);
+        } else if (val >= std::numeric_limits<int16_t>::min()) {
+            out.push_back(static_cast<char>(0xd1));
+            write_be(static_cast<uint64_t>(val), 2);
+        } else if (val >= std::numeric_limits<int32_t>::min()) {
+            out.push_back(static_cast<char>(0xd2));
+            write_be(static_cast<uint64_t>(val), 4);
+        } else {
+            out.push_back(static_cast<char>(0xd3));
+            write_be(static_cast<uint64_t>(val), 8);
+        }
+    }
+}
+
+void msgpack_writer::write_double(double val) {
+    uint64_t bits;
+    std::memcpy(std::addressof(bits), std::addressof(val), sizeof(bits));
+    out.push_back(static_cast<char>(0xcb));
+    write_be(bits, 8);
+}
+
+void msgpack_writer::write_str(const char* data, size_t len) {
+    if (len < 32) {
+        out.push_back(static_cast<char>(0xa0 | len));
+    } else if (len <= 0xff) {
+        out.push_back(static_cast<char>(0xd9));
+        write_be(len, 1);
+    } else if (len <= 0xffff) {
+        out.push_back(static_cast<char>(0xda));
+        write_be(len, 2);
+    } else {
+        out.push_back(static_cast<char>(0xdb));
+        write_be(len, 4);
+    }
+    out.append(data, len);
+}
+
+void msgpack_writer::write_bin(const char* data, size_t len) {
+    if (len <= 0xff) {
+        out.push_back(static_cast<char>(0xc4));
+        write_be(len, 1);
+    } else if (len <= 0xffff) {
+        out.push_back(static_cast<char>(0xc5));
+        write_be(len, 2);
+    } else {
+        out.push_back(static_cast<char>(0xc6));
+        write_be(len, 4);
+    }
+    out.append(data, len);
+}
+
+void msgpack_writer::write_array_header(uint32_t count) {
+    if (count < 16) {
+        out.push_back(static_cast<char>(0x90 | count));
+    } else if (count <= 0xffff) {
+        out.push_back(static_cast<char>(0xdc));
+        write_be(count, 2);
+    } else {
+        out.push_back(static_cast<char>(0xdd));
+        write_be(count, 4);
+    }
+}
+
+void msgpack_writer::write_map_header(uint32_t count) {
+    if (count < 16) {
+        out.push_back(static_cast<char>(0x80 | count));
+    } else if (count <= 0xffff) {
+        out.push_back(static_cast<char>(0xde));
+        write_be(count, 2);
+    } else {
+        out.push_back(static_cast<char>(0xdf));
+        write_be(count, 4);
+    }
+}
+
+void msgpack_writer::write_json(const sl::json::value& val) {
+    switch (val.json_type()) {
+    case sl::json::type::nullt:
+        write_nil();
+        break;
+    case sl::json::type::boolean:
+        write_bool(val.as_bool());
+        break;
+    case sl::json::type::integer:
+        write_int(val.as_int64());
+        break;
+    case sl::json::type::real:
+        write_double(val.as_float());
+        break;
+    case sl::json::type::string:
+        write_str(val.as_string());
+        break;
+    case sl::json::type::array: {
+        auto& vec = val.as_array();
+        write_array_header(static_cast<uint32_t>(vec.size()));
+        for (auto& el : vec) {
+            write_json(el);
+        }
+        break;
+    }
+    case sl::json::type::object: {
+        auto& fields = val.as_object();
+        write_map_header(static_cast<uint32_t>(fields.size()));
+        for (auto& fi : fields) {
+            write_str(fi.name());
+            write_json(fi.val());
+        }
+        break;
+    }
+    default:
+        throw support::exception(TRACEMSG("Unsupported JSON type"));
+    }
+}
+
+void msgpack_writer::write_be(uint64_t val, size_t bytes_count) {
+    for (size_t i = bytes_count; i > 0; i--) {
+        out.push_back(static_cast<char>((val >> ((i - 1) * 8)) & 0xff));
+    }
+}
+
+sl::json::value msgpack_decode(sl::io::span<const char> data) {
+    msgpack_reader reader{data};
+    auto res = reader.read_value();
+    if (!reader.finished()) throw support::exception(TRACEMSG(
+            "Invalid MessagePack data, trailing bytes after the value"));
+    return res;
+}
+
+} // namespace
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   msgpack_encoding.hpp
+ * Author: alex
+ *
+ * Minimal MessagePack writer and reader for query results,
+ * see https://github.com/msgpack/msgpack/blob/master/spec.md
+ */
+
+#ifndef WILTON_DB_MSGPACK_ENCODING_HPP
+#define WILTON_DB_MSGPACK_ENCODING_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "staticlib/io.hpp"
+#include "staticlib/json.hpp"
+
+namespace wilton {
+namespace db {
+
+enum class result_encoding {
+    json,
+    msgpack
+};
+
+/**
+ * Parses 'resultEncoding' option value: "json" or "msgpack"
+ */
+result_encoding parse_result_encoding(const std::string& name);
+
+/**
+ * Appends MessagePack-encoded values to the specified string
+ */
+class msgpack_writer {
+    std::string& out;
+
+public:
+    explicit msgpack_writer(std::string& out) :
+    out(out) { }
+
+    msgpack_writer(const msgpack_writer&) = delete;
+
+    msgpack_writer& operator=(const msgpack_writer&) = delete;
+
+    void write_nil();
+
+    void write_bool(bool val);
+
+    void write_int(int64_t val);
+
+    void write_double(double val);
+
+    void write_str(const char* data, size_t len);
+
+    void write_str(const std::string& str) {
+        write_str(str.data(), str.length());
+    }
+
+    void write_bin(const char* data, size_t len);
+
+    void write_array_header(uint32_t count);
+
+    void write_map_header(uint32_t count);
+
+    void write_json(const sl::json::value& val);
+
+private:
+    void write_be(uint64_t val, size_t bytes_count);
+};
+
+/**
+ * Decodes single MessagePack value into JSON, 'bin' values
+ * are returned as hex strings in PostgreSQL bytea format ("\x0102")
+ */
+sl::json::value msgpack_decode(sl::io::span<const char> data);
+
+} // namespace
+}
+
+#endif /* WILTON_DB_MSGPACK_ENCODING_HPP */
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pgsql_bulk_upsert.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+
+#include "psql_functions.hpp"
+
+namespace wilton {
+namespace db {
+namespace pgsql {
+
+namespace { // anonymous
+
+std::string quote_identifier(const std::string& name) {
+    if (name.empty()) throw support::exception(TRACEMSG("Invalid empty identifier specified"));
+    // named parameters parser does not track double quotes
+    if (std::string::npos != name.find(':')) throw support::exception(TRACEMSG(
+            "Invalid identifier specified: [" + name + "], ':' is not supported"));
+    auto res = std::string("\"");
+    for (char ch : name) {
+        if ('"' == ch) {
+            res.push_back('"');
+        }
+        res.push_back(ch);
+    }
+    res.push_back('"');
+    return res;
+}
+
+// "schema.table" -> "schema"."table"
+std::string quote_table(const std::string& table) {
+    auto dot = table.find('.');
+    if (std::string::npos == dot) {
+        return quote_identifier(table);
+    }
+    return quote_identifier(table.substr(0, dot)) + "." + quote_identifier(table.substr(dot + 1));
+}
+
+std::string check_type_name(const std::string& column, const std::string& type) {
+    bool valid = !type.empty() && std::all_of(type.begin(), type.end(), [](char ch) {
+        return std::isalnum(static_cast<unsigned char>(ch)) || ' ' == ch || '_' == ch ||
+                '(' == ch || ')' == ch || ',' == ch || '.' == ch;
+    });
+    if (!valid) throw support::exception(TRACEMSG(
+            "Invalid type specified for column: [" + column + "], type: [" + type + "]"));
+    return type;
+}
+
+std::string element_type_name(Oid array_type) {
+    switch (array_type) {
+    case 1007: return "int4"; // int4[]
+    case 1016: return "int8"; // int8[]
+    case 1022: return "float8"; // float8[]
+    case 1000: return "bool"; // bool[]
+    case 3807: return "jsonb"; // jsonb[]
+    default: return "text";
+    }
+}
+
+std::vector<std::string> string_list(const sl::json::field& fi) {
+    auto res = std::vector<std::string>();
+    for (const sl::json::value& val : fi.as_array_or_throw(fi.name())) {
+        res.push_back(val.as_string_nonempty_or_throw(fi.name()));
+    }
+    return res;
+}
+
+void transpose_rows(std::vector<sl::json::value>& rows, std::vector<std::string>& names,
+        std::vector<std::vector<sl::json::value>>& columns) {
+    if (names.empty() && !rows.empty()) {
+        for (const sl::json::field& fi : rows.front().as_object_or_throw("rows")) {
+            names.push_back(fi.name());
+        }
+    }
+    columns.resize(names.size());
+    for (auto& col : columns) {
+        col.reserve(rows.size());
+    }
+    for (sl::json::value& row : rows) {
+        row.as_object_or_throw("rows");
+        auto& fields = row.as_object();
+        size_t matched = 0;
+        for (size_t i = 0; i < names.size(); i++) {
+            // fields are usually in the same order as names
+            auto it = (i < fields.size() && names[i] == fields[i].name()) ? fields.begin() + i :
+                    std::find_if(fields.begin(), fields.end(), [&names, i](const sl::json::field& fi) {
+                        return names[i] == fi.name();
+                    });
+            if (fields.end() != it) {
+                columns[i].emplace_back(std::move(it->val()));
+                matched += 1;
+            } else {
+                columns[i].emplace_back(sl::json::value());
+            }
+        }
+        if (matched != fields.size()) throw support::exception(TRACEMSG(
+                "Row contains fields not present in column names," +
+                " row fields count: [" + sl::support::to_string(fields.size()) + "]," +
+                " columns count: [" + sl::support::to_string(names.size()) + "]"));
+    }
+}
+
+} // namespace
+
+bulk_upsert_statement build_bulk_upsert(sl::json::value& input) {
+    auto table = std::string();
+    auto names = std::vector<std::string>();
+    auto column_names = std::vector<std::string>();
+    auto columns = std::vector<std::vector<sl::json::value>>();
+    auto rows = std::vector<sl::json::value>();
+    bool columns_specified = false;
+    bool rows_specified = false;
+    bool names_specified = false;
+    auto conflict = std::vector<std::string>();
+    auto update = std::vector<std::string>();
+    bool update_specified = false;
+    const sl::json::value* types = nullptr;
+    input.as_object_or_throw("bulk upsert");
+    for (sl::json::field& fi : input.as_object()) {
+        auto& name = fi.name();
+        if ("table" == name) {
+            table = fi.as_string_nonempty_or_throw(name);
+        } else if ("columns" == name) {
+            fi.as_object_or_throw(name);
+            for (sl::json::field& col : fi.val().as_object()) {
+                col.as_array_or_throw(col.name());
+                column_names.push_back(col.name());
+                columns.emplace_back(std::move(col.val().as_array()));
+            }
+            columns_specified = true;
+        } else if ("rows" == name) {
+            fi.as_array_or_throw(name);
+            rows = std::move(fi.val().as_array());
+            rows_specified = true;
+        } else if ("columnNames" == name) {
+            names_specified = true;
+            names = string_list(fi);
+        } else if ("conflict" == name) {
+            conflict = string_list(fi);
+        } else if ("update" == name) {
+            update = string_list(fi);
+            update_specified = true;
+        } else if ("types" == name) {
+            fi.as_object_or_throw(name);
+            types = std::addressof(fi.val());
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (table.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'table' not specified"));
+    if (columns_specified == rows_specified) throw support::exception(TRACEMSG(
+            "One of parameters 'columns' or 'rows' must be specified"));
+    if (names_specified && columns_specified) throw support::exception(TRACEMSG(
+            "Parameter 'columnNames' can only be specified with 'rows'"));
+    if (columns_specified) {
+        names = std::move(column_names);
+    } else {
+        transpose_rows(rows, names, columns);
+    }
+    if (names.empty()) throw support::exception(TRACEMSG(
+            "No columns specified"));
+    size_t rows_count = columns.front().size();
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (rows_count != columns[i].size()) throw support::exception(TRACEMSG(
+                "Column arrays must have the same length, column: [" + names[i] + "]," +
+                " length: [" + sl::support::to_string(columns[i].size()) + "]," +
+                " expected: [" + sl::support::to_string(rows_count) + "]"));
+    }
+
+    // statement
+    auto res = bulk_upsert_statement();
+    auto cols_list = std::string();
+    auto unnest_list = std::string();
+    auto params = std::vector<sl::json::value>();
+    for (size_t i = 0; i < names.size(); i++) {
+        auto col = sl::json::value(std::move(columns[i]));
+        auto type = std::string();
+        if (nullptr != types) {
+            auto& tval = (*types)[names[i]];
+            if (sl::json::type::nullt != tval.json_type()) {
+                type = check_type_name(names[i], tval.as_string_nonempty_or_throw(names[i]));
+            }
+        }
+        if (type.empty()) {
+            type = element_type_name(get_json_array_type(col));
+        }
+        if (i > 0) {
+            cols_list += ", ";
+            unnest_list += ", ";
+        }
+        cols_list += quote_identifier(names[i]);
+        unnest_list += "$" + sl::support::to_string(i + 1) + "::" + type + "[]";
+        params.emplace_back(std::move(col));
+    }
+    res.sql = "INSERT INTO " + quote_table(table) + " (" + cols_list + ")" +
+            " SELECT * FROM unnest(" + unnest_list + ") AS wilton_rows(" + cols_list + ")";
+    if (!conflict.empty()) {
+        auto conflict_list = std::string();
+        for (auto& name : conflict) {
+            conflict_list += (conflict_list.empty() ? "" : ", ") + quote_identifier(name);
+        }
+        if (!update_specified) {
+            for (auto& name : names) {
+                if (conflict.end() == std::find(conflict.begin(), conflict.end(), name)) {
+                    update.push_back(name);
+                }
+            }
+        }
+        res.sql += " ON CONFLICT (" + conflict_list + ")";
+        if (update.empty()) {
+            res.sql += " DO NOTHING";
+        } else {
+            auto set_list = std::string();
+            for (auto& name : update) {
+                auto quoted = quote_identifier(name);
+                set_list += (set_list.empty() ? "" : ", ") + quoted + " = EXCLUDED." + quoted;
+            }
+            res.sql += " DO UPDATE SET " + set_list;
+        }
+    } else if (update_specified) {
+        throw support::exception(TRACEMSG(
+                "Parameter 'update' requires 'conflict' to be specified"));
+    }
+    res.params = sl::json::value(std::move(params));
+    res.rows_count = rows_count;
+    return res;
+}
+
+} // namespace
+}
+}
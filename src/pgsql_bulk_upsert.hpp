@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   pgsql_bulk_upsert.hpp
+ * Author: alex
+ *
+ * Multi-row INSERT ... ON CONFLICT built from column arrays bound
+ * as single array parameters and expanded with unnest().
+ */
+
+#ifndef WILTON_DB_PGSQL_BULK_UPSERT_HPP
+#define WILTON_DB_PGSQL_BULK_UPSERT_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "staticlib/json.hpp"
+
+namespace wilton {
+namespace db {
+namespace pgsql {
+
+struct bulk_upsert_statement {
+    std::string sql;
+    // positional parameters, one array for each column
+    sl::json::value params;
+    size_t rows_count = 0;
+};
+
+/**
+ * Builds the statement from the input like:
+ *
+ * {
+ *     "table": "schema.table",
+ *     "columns": {"id": [1, 2], "name": ["foo", "bar"]}, // or
+ *     "rows": [{"id": 1, "name": "foo"}, {"id": 2, "name": "bar"}],
+ *     "conflict": ["id"],  // optional, ON CONFLICT target
+ *     "update": ["name"],  // optional, all non-conflict columns by default, [] for DO NOTHING
+ *     "types": {"name": "varchar(64)"}  // optional, element types for the columns
+ * }
+ *
+ * Column arrays are moved out of the input.
+ */
+bulk_upsert_statement build_bulk_upsert(sl::json::value& input);
+
+} // namespace
+}
+}
+
+#endif /* WILTON_DB_PGSQL_BULK_UPSERT_HPP */
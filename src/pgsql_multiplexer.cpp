@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pgsql_multiplexer.hpp"
+
+#include <algorithm>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+#include "wilton/support/logging.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+const std::string logger = std::string("wilton.PGMultiplexer");
+
+} // namespace
+
+pgsql_multiplexer::pgsql_multiplexer(const std::string& conn_params, uint32_t backends_count,
+        uint32_t max_pipeline) :
+max_pipeline(max_pipeline) {
+    if (0 == backends_count) throw support::exception(TRACEMSG(
+            "Invalid backends count specified: [0]"));
+    if (0 == max_pipeline) throw support::exception(TRACEMSG(
+            "Invalid max pipeline size specified: [0]"));
+    // all connections are opened before dispatchers are started,
+    // so the vector is not changed while they are running
+    backends.reserve(backends_count);
+    for (uint32_t i = 0; i < backends_count; i++) {
+        auto conn = pgsql::psql_handler(conn_params);
+        if (!conn.connect()) throw support::exception(TRACEMSG(conn.get_last_error()));
+        backends.emplace_back(std::move(conn));
+    }
+    for (auto& conn : backends) {
+        auto conn_ptr = std::addressof(conn);
+        dispatchers.emplace_back([this, conn_ptr] {
+            run(*conn_ptr);
+        });
+    }
+    wilton::support::log_debug(logger, "Multiplexer opened, backends: [" + sl::support::to_string(backends_count) + "]," +
+            " max pipeline: [" + sl::support::to_string(max_pipeline) + "]");
+}
+
+pgsql_multiplexer::~pgsql_multiplexer() STATICLIB_NOEXCEPT {
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto& th : dispatchers) {
+        if (th.joinable()) {
+            th.join();
+        }
+    }
+}
+
+sl::json::value pgsql_multiplexer::execute(const std::string& sql, const sl::json::value& params) {
+    auto req = std::make_shared<request>(std::addressof(sql), std::addressof(params), nullptr);
+    return submit(std::move(req));
+}
+
+sl::json::value pgsql_multiplexer::run_in_transaction(const std::vector<pgsql::transaction_statement>& statements,
+        const pgsql::transaction_retry_options& retry) {
+    auto req = std::make_shared<request>(nullptr, nullptr, std::addressof(statements));
+    req->retry = std::addressof(retry);
+    return submit(std::move(req));
+}
+
+sl::json::value pgsql_multiplexer::get_stats() {
+    std::lock_guard<std::mutex> guard{mutex};
+    return sl::json::value({
+        { "backends", static_cast<int64_t>(backends.size()) },
+        { "busyBackends", static_cast<int64_t>(busy_backends) },
+        { "statements", static_cast<int64_t>(statements_count) },
+        { "pipelines", static_cast<int64_t>(pipelines_count) },
+        { "transactions", static_cast<int64_t>(transactions_count) },
+        { "maxPipelineDepth", static_cast<int64_t>(max_depth) },
+        { "queued", static_cast<int64_t>(queue.size()) }
+    });
+}
+
+sl::json::value pgsql_multiplexer::submit(std::shared_ptr<request> req) {
+    std::unique_lock<std::mutex> guard{mutex};
+    if (stopping) throw support::exception(TRACEMSG("Multiplexer is closed"));
+    queue.push_back(req);
+    queue_cv.notify_one();
+    done_cv.wait(guard, [&req] {
+        return req->done;
+    });
+    if (!req->error.empty()) {
+        throw support::exception(TRACEMSG(req->error));
+    }
+    return std::move(req->result);
+}
+
+void pgsql_multiplexer::run(pgsql::psql_handler& conn) {
+    for (;;) {
+        auto batch = std::vector<std::shared_ptr<request>>();
+        {
+            std::unique_lock<std::mutex> guard{mutex};
+            queue_cv.wait(guard, [this] {
+                return stopping || !queue.empty();
+            });
+            if (queue.empty()) {
+                // stopping
+                return;
+            }
+            // transaction is taken alone, statements - until the next transaction
+            if (nullptr != queue.front()->statements) {
+                batch.push_back(queue.front());
+                queue.pop_front();
+            } else {
+                while (!queue.empty() && batch.size() < max_pipeline && nullptr == queue.front()->statements) {
+                    batch.push_back(queue.front());
+                    queue.pop_front();
+                }
+            }
+            busy_backends += 1;
+            // other dispatchers can take the rest
+            if (!queue.empty()) {
+                queue_cv.notify_one();
+            }
+        }
+        dispatch(conn, batch);
+        {
+            std::lock_guard<std::mutex> guard{mutex};
+            for (auto& req : batch) {
+                req->done = true;
+            }
+            busy_backends -= 1;
+        }
+        done_cv.notify_all();
+    }
+}
+
+void pgsql_multiplexer::dispatch(pgsql::psql_handler& conn, std::vector<std::shared_ptr<request>>& batch) {
+    if (nullptr != batch.front()->statements) {
+        auto& req = batch.front();
+        try {
+            req->result = conn.run_in_transaction(*req->statements, *req->retry);
+        } catch (const std::exception& e) {
+            req->error = e.what();
+        }
+        std::lock_guard<std::mutex> guard{mutex};
+        transactions_count += 1;
+        return;
+    }
+    auto statements = std::vector<pgsql::pipeline_statement>();
+    statements.reserve(batch.size());
+    for (auto& req : batch) {
+        statements.emplace_back(*req->sql, *req->params);
+    }
+    try {
+        auto results = conn.execute_pipeline(statements);
+        for (size_t i = 0; i < batch.size(); i++) {
+            batch[i]->result = std::move(results[i].result);
+            batch[i]->error = std::move(results[i].error);
+        }
+    } catch (const std::exception& e) {
+        for (auto& req : batch) {
+            req->error = e.what();
+        }
+    }
+    std::lock_guard<std::mutex> guard{mutex};
+    pipelines_count += 1;
+    statements_count += batch.size();
+    max_depth = std::max(max_depth, static_cast<uint64_t>(batch.size()));
+}
+
+} // namespace
+}
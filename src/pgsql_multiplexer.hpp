@@ -0,0 +1,120 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   pgsql_multiplexer.hpp
+ * Author: alex
+ *
+ * Statements from many callers run over a few pipelined connections.
+ */
+
+#ifndef WILTON_DB_PGSQL_MULTIPLEXER_HPP
+#define WILTON_DB_PGSQL_MULTIPLEXER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "staticlib/config.hpp"
+#include "staticlib/json.hpp"
+
+#include "psql_functions.hpp"
+
+namespace wilton {
+namespace db {
+
+/**
+ * Statements submitted from different threads are queued and taken by the
+ * dispatcher threads, one for each backend connection. Dispatcher sends up to
+ * 'max_pipeline' queued statements at once in libpq pipeline mode and passes
+ * every result (or error) back to its caller. Transactions are taken from
+ * the same queue and pin the backend until all their statements are committed.
+ */
+class pgsql_multiplexer {
+    struct request {
+        const std::string* sql;
+        const sl::json::value* params;
+        // not null for transactions
+        const std::vector<pgsql::transaction_statement>* statements;
+        const pgsql::transaction_retry_options* retry = nullptr;
+        bool done = false;
+        sl::json::value result;
+        std::string error;
+
+        request(const std::string* sql, const sl::json::value* params,
+                const std::vector<pgsql::transaction_statement>* statements) :
+        sql(sql),
+        params(params),
+        statements(statements) { }
+    };
+
+    uint32_t max_pipeline;
+
+    std::mutex mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable done_cv;
+    std::deque<std::shared_ptr<request>> queue;
+    bool stopping = false;
+
+    uint64_t statements_count = 0;
+    uint64_t pipelines_count = 0;
+    uint64_t transactions_count = 0;
+    uint64_t max_depth = 0;
+    uint32_t busy_backends = 0;
+
+    std::vector<pgsql::psql_handler> backends;
+    std::vector<std::thread> dispatchers;
+
+public:
+    pgsql_multiplexer(const std::string& conn_params, uint32_t backends_count, uint32_t max_pipeline);
+
+    ~pgsql_multiplexer() STATICLIB_NOEXCEPT;
+
+    pgsql_multiplexer(const pgsql_multiplexer&) = delete;
+
+    pgsql_multiplexer& operator=(const pgsql_multiplexer&) = delete;
+
+    /**
+     * Blocks until the statement is run, throws the error of this statement
+     */
+    sl::json::value execute(const std::string& sql, const sl::json::value& params);
+
+    /**
+     * Runs statements in a transaction on a single backend,
+     * returns the same result as 'run_in_transaction'
+     */
+    sl::json::value run_in_transaction(const std::vector<pgsql::transaction_statement>& statements,
+            const pgsql::transaction_retry_options& retry);
+
+    sl::json::value get_stats();
+
+private:
+    sl::json::value submit(std::shared_ptr<request> req);
+
+    void run(pgsql::psql_handler& conn);
+
+    void dispatch(pgsql::psql_handler& conn, std::vector<std::shared_ptr<request>>& batch);
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_PGSQL_MULTIPLEXER_HPP */
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pgsql_write_coalescer.hpp"
+
+#include <chrono>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+#include "wilton/support/logging.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+const std::string logger = std::string("wilton.PGCoalescer");
+
+pgsql::psql_handler open_connection(const std::string& conn_params) {
+    auto conn = pgsql::psql_handler(conn_params);
+    if (!conn.connect()) throw support::exception(TRACEMSG(conn.get_last_error()));
+    return conn;
+}
+
+} // namespace
+
+pgsql_write_coalescer::pgsql_write_coalescer(const std::string& conn_params,
+        uint32_t window_millis, uint32_t max_batch) :
+conn(open_connection(conn_params)),
+window_millis(window_millis),
+max_batch(max_batch) {
+    if (0 == max_batch) throw support::exception(TRACEMSG(
+            "Invalid max batch size specified: [0]"));
+    worker = std::thread([this] {
+        run();
+    });
+}
+
+pgsql_write_coalescer::~pgsql_write_coalescer() STATICLIB_NOEXCEPT {
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+sl::json::value pgsql_write_coalescer::submit(const std::string& sql, const sl::json::value& params) {
+    auto req = std::make_shared<request>(sql, params);
+    std::unique_lock<std::mutex> guard{mutex};
+    if (stopping) throw support::exception(TRACEMSG("Write coalescer is closed"));
+    queue.push_back(req);
+    if (1 == queue.size() || queue.size() >= max_batch) {
+        queue_cv.notify_one();
+    }
+    done_cv.wait(guard, [&req] {
+        return req->done;
+    });
+    if (!req->error.empty()) {
+        throw support::exception(TRACEMSG(req->error));
+    }
+    return std::move(req->result);
+}
+
+sl::json::value pgsql_write_coalescer::get_stats() {
+    std::lock_guard<std::mutex> guard{mutex};
+    return sl::json::value({
+        { "batches", static_cast<int64_t>(batches_count) },
+        { "statements", static_cast<int64_t>(statements_count) },
+        { "fallbacks", static_cast<int64_t>(fallbacks_count) },
+        { "queued", static_cast<int64_t>(queue.size()) }
+    });
+}
+
+void pgsql_write_coalescer::run() {
+    for (;;) {
+        auto batch = std::vector<std::shared_ptr<request>>();
+        {
+            std::unique_lock<std::mutex> guard{mutex};
+            queue_cv.wait(guard, [this] {
+                return stopping || !queue.empty();
+            });
+            if (queue.empty()) {
+                // stopping
+                return;
+            }
+            // collect writes that arrive during the window
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(window_millis);
+            queue_cv.wait_until(guard, deadline, [this] {
+                return stopping || queue.size() >= max_batch;
+            });
+            while (!queue.empty() && batch.size() < max_batch) {
+                batch.push_back(queue.front());
+                queue.pop_front();
+            }
+        }
+        execute_batch(batch);
+        {
+            std::lock_guard<std::mutex> guard{mutex};
+            for (auto& req : batch) {
+                req->done = true;
+            }
+            batches_count += 1;
+            statements_count += batch.size();
+        }
+        done_cv.notify_all();
+    }
+}
+
+void pgsql_write_coalescer::execute_batch(std::vector<std::shared_ptr<request>>& batch) {
+    if (1 == batch.size()) {
+        execute_isolated(batch);
+        return;
+    }
+    try {
+        conn.begin();
+        for (auto& req : batch) {
+            req->result = conn.execute_with_parameters(req->sql, req->params, true);
+        }
+    } catch (const std::exception& e) {
+        wilton::support::log_debug(logger, "Batch failed, size: [" + sl::support::to_string(batch.size()) + "]," +
+                " running statements separately, error: [" + e.what() + "]");
+        try {
+            conn.rollback();
+        } catch (const std::exception&) {
+            // connection is reset on next statement if broken
+        }
+        {
+            std::lock_guard<std::mutex> guard{mutex};
+            fallbacks_count += 1;
+        }
+        execute_isolated(batch);
+        return;
+    }
+    try {
+        conn.commit();
+    } catch (const std::exception& e) {
+        // batch may be committed already if the connection was lost,
+        // so statements are not run again
+        wilton::support::log_debug(logger, "Batch commit failed, size: [" + sl::support::to_string(batch.size()) + "]," +
+                " error: [" + e.what() + "]");
+        try {
+            conn.rollback();
+        } catch (const std::exception&) {
+            // connection is reset on next statement if broken
+        }
+        for (auto& req : batch) {
+            req->result = sl::json::value();
+            req->error = std::string("Batch commit failed, statement may or may not be committed: ") + e.what();
+        }
+    }
+}
+
+void pgsql_write_coalescer::execute_isolated(std::vector<std::shared_ptr<request>>& batch) {
+    for (auto& req : batch) {
+        try {
+            // single statement is committed implicitly
+            req->result = conn.execute_with_parameters(req->sql, req->params, true);
+            req->error.clear();
+        } catch (const std::exception& e) {
+            req->result = sl::json::value();
+            req->error = e.what();
+        }
+    }
+}
+
+} // namespace
+}
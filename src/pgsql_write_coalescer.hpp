@@ -0,0 +1,108 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   pgsql_write_coalescer.hpp
+ * Author: alex
+ *
+ * Group commit for small writes submitted by many threads.
+ */
+
+#ifndef WILTON_DB_PGSQL_WRITE_COALESCER_HPP
+#define WILTON_DB_PGSQL_WRITE_COALESCER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "staticlib/config.hpp"
+#include "staticlib/json.hpp"
+
+#include "psql_functions.hpp"
+
+namespace wilton {
+namespace db {
+
+/**
+ * Statements submitted from different threads are collected for 'window_millis'
+ * (or until 'max_batch' statements are queued) and are executed by the single
+ * background thread on its own connection in one transaction. If any statement
+ * of the batch fails, transaction is rolled back and every statement is run again
+ * separately, so each caller gets the result or the error of its own statement.
+ */
+class pgsql_write_coalescer {
+    struct request {
+        std::string sql;
+        const sl::json::value& params;
+        bool done = false;
+        sl::json::value result;
+        std::string error;
+
+        request(const std::string& sql, const sl::json::value& params) :
+        sql(sql),
+        params(params) { }
+    };
+
+    pgsql::psql_handler conn;
+    uint32_t window_millis;
+    uint32_t max_batch;
+
+    std::mutex mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable done_cv;
+    std::deque<std::shared_ptr<request>> queue;
+    bool stopping = false;
+
+    uint64_t batches_count = 0;
+    uint64_t statements_count = 0;
+    uint64_t fallbacks_count = 0;
+
+    std::thread worker;
+
+public:
+    pgsql_write_coalescer(const std::string& conn_params, uint32_t window_millis, uint32_t max_batch);
+
+    ~pgsql_write_coalescer() STATICLIB_NOEXCEPT;
+
+    pgsql_write_coalescer(const pgsql_write_coalescer&) = delete;
+
+    pgsql_write_coalescer& operator=(const pgsql_write_coalescer&) = delete;
+
+    /**
+     * Blocks until the batch with this statement is committed,
+     * throws the error of this statement
+     */
+    sl::json::value submit(const std::string& sql, const sl::json::value& params);
+
+    sl::json::value get_stats();
+
+private:
+    void run();
+
+    void execute_batch(std::vector<std::shared_ptr<request>>& batch);
+
+    void execute_isolated(std::vector<std::shared_ptr<request>>& batch);
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_PGSQL_WRITE_COALESCER_HPP */
@@ -14,9 +14,29 @@
  */
 
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>    // std::sort
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <random>
 #include <stack>
 #include <set>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#define WILTON_DB_POLL WSAPoll
+#else // !_WIN32
+#include <cerrno>
+#include <poll.h>
+#define WILTON_DB_POLL poll
+#endif // _WIN32
 
 #include "wilton/support/exception.hpp"
 #include "staticlib/support/to_string.hpp"
@@ -24,7 +44,14 @@
 #include "staticlib/pimpl/forward_macros.hpp"
 #include "staticlib/utils.hpp"
 
+#include <libpq/libpq-fs.h>
+
 #include "psql_functions.hpp"
+#include "columnar_file_writer.hpp"
+#include "db_tracing.hpp"
+#include "deadline_watchdog.hpp"
+#include "decode_pool.hpp"
+#include "json_text_encoding.hpp"
 
 // PostgreSQL types
 #define PSQL_NULLOID  0
@@ -34,6 +61,7 @@
 #define PSQL_JSONOID  114
 #define PSQL_JSONBOID  3802
 #define PSQL_BOOLOID  16
+#define PSQL_BYTEAOID  17
 #define PSQL_TEXTOID  25
 #define PSQL_VARCHAROID  1043
 #define PSQL_FLOAT4OID  700
@@ -48,7 +76,12 @@
 #define PSQL_BOOLARARRAYOID 1000
 #define PSQL_FLOAT4ARRAYOID 1021
 #define PSQL_FLOAT8ARRAYOID 1022
+#define PSQL_JSONBARRAYOID 3807
 
+// client-side watchdog fires after server-side statement_timeout
+#define PSQL_WATCHDOG_GRACE_MILLIS 250
+// smaller results are decoded on the calling thread
+#define PSQL_PARALLEL_DECODE_MIN_ROWS 16384
 
 namespace wilton{
 namespace db{
@@ -71,31 +104,234 @@ namespace pgsql{
 
 namespace { // anonymous
 
-Oid get_json_array_type(const sl::json::value& json_value) {
-    auto& array = json_value.as_array();
-    Oid type = PSQL_INT4ARRAYOID;
-    if (array.size()) {
-        switch (array.begin()->json_type()) {
-        case sl::json::type::string:{
-            type = PSQL_TEXTARRAYOID;
+void scan_array_element_types(const sl::json::value& json_value, std::set<sl::json::type>& types, bool& int8) {
+    for (const sl::json::value& el : json_value.as_array()) {
+        switch (el.json_type()) {
+        case sl::json::type::nullt:
             break;
-        }
-        case sl::json::type::real:{
-            type = PSQL_FLOAT8ARRAYOID;
+        case sl::json::type::array:
+            // multidimensional
+            scan_array_element_types(el, types, int8);
             break;
+        case sl::json::type::integer: {
+            int64_t val = el.as_int64();
+            if (val > std::numeric_limits<int32_t>::max() || val < std::numeric_limits<int32_t>::min()) {
+                int8 = true;
+            }
+            types.insert(el.json_type());
+            break;
+        }
+        default:
+            types.insert(el.json_type());
+        }
+    }
+}
+
+void write_array_literal_element(const sl::json::value& el, std::string& out) {
+    switch (el.json_type()) {
+    case sl::json::type::nullt:
+        out.append("NULL");
+        break;
+    case sl::json::type::array:
+        write_array_literal(el, out);
+        break;
+    case sl::json::type::boolean:
+        out.push_back(el.as_bool() ? 't' : 'f');
+        break;
+    case sl::json::type::integer:
+        out.append(sl::support::to_string(el.as_int64()));
+        break;
+    case sl::json::type::real:
+        out.append(sl::support::to_string(el.as_float()));
+        break;
+    default: {
+        // strings and objects are quoted, only quotes and backslashes are escaped
+        auto str = sl::json::type::string == el.json_type() ? el.as_string() : el.dumps();
+        out.push_back('"');
+        for (char ch : str) {
+            if ('"' == ch || '\\' == ch) {
+                out.push_back('\\');
+            }
+            out.push_back(ch);
         }
+        out.push_back('"');
+    }
+    }
+}
+
+} // namespace
+
+std::string decode_bytea_hex(const std::string& hex) {
+    size_t start = (hex.length() >= 2 && '\\' == hex[0] && 'x' == hex[1]) ? 2 : 0;
+    if (0 != (hex.length() - start) % 2) throw support::exception(TRACEMSG(
+            "Invalid hex value specified, odd length: [" + sl::support::to_string(hex.length()) + "]"));
+    auto digit = [&hex](size_t pos) -> int {
+        char ch = hex[pos];
+        if (ch >= '0' && ch <= '9') return ch - '0';
+        if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+        throw support::exception(TRACEMSG("Invalid hex value specified, position: [" +
+                sl::support::to_string(pos) + "]"));
+    };
+    auto res = std::string();
+    res.reserve((hex.length() - start) / 2);
+    for (size_t i = start; i < hex.length(); i += 2) {
+        res.push_back(static_cast<char>((digit(i) << 4) | digit(i + 1)));
+    }
+    return res;
+}
+
+std::string encode_bytea_hex(const char* data, size_t len) {
+    static const char* digits = "0123456789abcdef";
+    auto res = std::string("\\x");
+    res.reserve(len * 2 + 2);
+    for (size_t i = 0; i < len; i++) {
+        auto byte = static_cast<unsigned char>(data[i]);
+        res.push_back(digits[byte >> 4]);
+        res.push_back(digits[byte & 0x0f]);
+    }
+    return res;
+}
+
+void send_cancel_request(const std::shared_ptr<PGcancel>& handle) {
+    if (nullptr == handle.get()) {
+        throw support::exception(TRACEMSG("Cannot cancel statement, connection is not open"));
+    }
+    std::array<char, 256> errbuf;
+    errbuf[0] = '\0';
+    if (!PQcancel(handle.get(), errbuf.data(), static_cast<int>(errbuf.size()))) {
+        throw support::exception(TRACEMSG("Cannot cancel statement: [" + std::string(errbuf.data()) + "]"));
+    }
+}
+
+Oid get_json_array_type(const sl::json::value& json_value) {
+    auto types = std::set<sl::json::type>();
+    bool int8 = false;
+    scan_array_element_types(json_value, types, int8);
+    if (types.empty()) {
+        // empty or all-null array
+        return PSQL_INT4ARRAYOID;
+    }
+    if (1 == types.size()) {
+        switch (*types.begin()) {
         case sl::json::type::integer:
+            return int8 ? PSQL_INT8ARRAYOID : PSQL_INT4ARRAYOID;
+        case sl::json::type::real:
+            return PSQL_FLOAT8ARRAYOID;
+        case sl::json::type::boolean:
+            return PSQL_BOOLARARRAYOID;
+        case sl::json::type::object:
+            return PSQL_JSONBARRAYOID;
         default:
-            break;
+            return PSQL_TEXTARRAYOID;
         }
     }
-    return type;
+    if (2 == types.size() && types.count(sl::json::type::integer) && types.count(sl::json::type::real)) {
+        return PSQL_FLOAT8ARRAYOID;
+    }
+    // mixed values are passed as text
+    return PSQL_TEXTARRAYOID;
 }
 
-parameters_values get_json_params_values(const sl::json::value& json_value){
-    std::string value{};
+void write_array_literal(const sl::json::value& json_value, std::string& out) {
+    out.push_back('{');
+    bool first = true;
+    for (const sl::json::value& el : json_value.as_array()) {
+        if (!first) {
+            out.push_back(',');
+        }
+        first = false;
+        write_array_literal_element(el, out);
+    }
+    out.push_back('}');
+}
+
+namespace { // anonymous
+
+void setup_params_from_json_array(
+        bind_buffers& binds,
+        const staticlib::json::value& json_value,
+        const std::vector<std::string>& names) {
+    size_t idx = binds.vals_count;
+    parameters_values& pm_value = binds.next_value();
+    if (names.size()) {
+        pm_value.parameter_name = names[idx];
+    } else {
+        pm_value.parameter_name = "$" + sl::support::to_string(idx + 1);
+    }
+    write_json_param_value(json_value, pm_value);
+}
+
+void setup_params_from_json_field(
+        bind_buffers& binds,
+        const  staticlib::json::field& fi) {
+    parameters_values& pm_value = binds.next_value();
+    pm_value.parameter_name = fi.name();
+    write_json_param_value(fi.val(), pm_value);
+}
+
+int parameter_position(const parameters_values& val) {
+    // "$1"
+    return std::atoi(val.parameter_name.c_str() + 1);
+}
+
+std::set<size_t> check_poses(const std::string& str, const std::string& val){
+    std::set<size_t> null_poses;
+    size_t search_pos = 0;
+    while (std::string::npos != search_pos) {
+        search_pos = str.find(val, search_pos);
+        // Check symbols at borders
+        size_t left = search_pos-1;
+        size_t right = search_pos + 4;
+        char ll = str[left];
+        char rl = str[right];
+        if (('[' == ll && ']' == rl) ||
+            ('[' == str[left] && ',' == str[right]) ||
+            (',' == str[left] && ']' == str[right]) ||
+            (',' == str[left] && ',' == str[right])) {
+            null_poses.insert(search_pos); //because insert shifts litera
+            null_poses.insert(right);
+        }
+        if (std::string::npos == search_pos) break;
+        search_pos++;
+    }
+    return null_poses;
+}
+
+std::set<size_t> check_null_poses(const std::string& val){
+    std::set<size_t> null_poses;
+    std::set<size_t> big_null_poses;
+    null_poses = check_poses(val, "null");
+    big_null_poses = check_poses(val, "NULL");
+    null_poses.insert(big_null_poses.begin(),big_null_poses.end());
+    return null_poses;
+}
+
+void replace_all_occurences(std::string& str, const std::string& subst, const std::string& replacer) {
+    size_t search_pos = 0;
+    while (std::string::npos != search_pos){
+        search_pos = str.find(subst, search_pos);
+        if (std::string::npos == search_pos) break;
+        str.replace(search_pos, subst.size(), replacer);
+        search_pos += replacer.size();
+    }
+}
+
+void change_null_register(std::string& val) {
+    replace_all_occurences(val, "NULL", "null");
+}
+
+void prepare_bool_array(std::string& val){
+    replace_all_occurences(val, "t", "true");
+    replace_all_occurences(val, "f", "false");
+}
+
+} // namespace
+
+void write_json_param_value(const sl::json::value& json_value, parameters_values& out) {
+    std::string& value = out.value;
+    value.clear();
     Oid type = PSQL_UNKNOWNOID;
-    int len = 0;
     int format = 0; // text format
 
     switch (json_value.json_type()) {
@@ -103,17 +339,18 @@ parameters_values get_json_params_values(const sl::json::value& json_value){
         break;
     case sl::json::type::array:{
         type = get_json_array_type(json_value);
-        value = json_value.dumps();
-
-        const size_t open_brace_pos = 0;
-        const size_t close_brace_pos = value.size()-1;
-        const size_t replace_symbol_amount = 1;
-
-        value.replace(open_brace_pos, replace_symbol_amount, "{");
-        value.replace(close_brace_pos, replace_symbol_amount, "}");
+        write_array_literal(json_value, value);
         break;
     }
     case sl::json::type::object: {
+        auto& fields = json_value.as_object();
+        if (1 == fields.size() && "$bytea" == fields.front().name()) {
+            // sent in binary format, without escaping
+            type = PSQL_BYTEAOID;
+            value = decode_bytea_hex(fields.front().as_string_or_throw("$bytea"));
+            format = 1;
+            break;
+        }
         type = PSQL_JSONBOID;
         value = json_value.dumps();
         // TODO not need formatting if we use only jsonb
@@ -125,148 +362,173 @@ parameters_values get_json_params_values(const sl::json::value& json_value){
     case sl::json::type::boolean:{
         type = PSQL_BOOLOID;
         if (json_value.as_bool()) {
-            value = "TRUE";
+            value.append("TRUE");
         } else {
-            value = "FALSE";
+            value.append("FALSE");
         }
         break;
     }
     case sl::json::type::string:{
         // TODO need to check for reserved words
         type = PSQL_TEXTOID;
-        value = json_value.as_string();
+        value.append(json_value.as_string());
         break;
     }
     case sl::json::type::integer:{
         type = PSQL_INT8OID;
-        value = sl::support::to_string(json_value.as_int64());
+        value.append(sl::support::to_string(json_value.as_int64()));
         break;
     }
     case sl::json::type::real:{
         type = PSQL_FLOAT8OID;
-        value = sl::support::to_string(json_value.as_float());
+        value.append(sl::support::to_string(json_value.as_float()));
         break;
     }
     default:
         throw wilton::support::exception(TRACEMSG("param parse error"));
     }
-    len = static_cast<int>(value.length());
-    return parameters_values("", value, type, len, format);
-}
-
-void setup_params_from_json_array(
-        std::vector<parameters_values>& vals,
-        const staticlib::json::value& json_value,
-        const std::vector<std::string>& names) {
-
-    std::string name{};
-    if (names.size()) {
-        name = names[vals.size()];
-    } else {
-        name = "$" + sl::support::to_string(vals.size() + 1);
-    }
-
-    parameters_values pm_value = get_json_params_values(json_value);
-    pm_value.parameter_name = name;
-
-    vals.emplace_back(pm_value);
+    out.type = type;
+    out.len = static_cast<int>(value.length());
+    out.format = format;
 }
 
-void setup_params_from_json_field(
-        std::vector<parameters_values>& vals,
-        const  staticlib::json::field& fi) {
-    parameters_values pm_value = get_json_params_values(fi.val());
-    pm_value.parameter_name = fi.name();
-
-    vals.emplace_back(pm_value);
+parameters_values get_json_params_values(const sl::json::value& json_value){
+    auto res = parameters_values("", "", PSQL_UNKNOWNOID, 0, 0);
+    write_json_param_value(json_value, res);
+    return res;
 }
 
 void setup_params_from_json(
-        std::vector<parameters_values>& vals,
+        bind_buffers& binds,
         const staticlib::json::value& parameters,
         const std::vector<std::string>& names) {
     switch (parameters.json_type()) {
     case sl::json::type::object:
         for (const sl::json::field& fi : parameters.as_object()) {
-            setup_params_from_json_field(vals, fi);
+            setup_params_from_json_field(binds, fi);
         }
         break;
     case sl::json::type::array:
         for (const sl::json::value& val : parameters.as_array()) {
-            setup_params_from_json_array(vals, val, names);
+            setup_params_from_json_array(binds, val, names);
         }
         break;
     case sl::json::type::nullt:
         // not supported
         break;
     default:
-        setup_params_from_json_array(vals, parameters, names);
+        setup_params_from_json_array(binds, parameters, names);
         break;
     }
 }
 
-sl::json::value get_result_as_json(PGresult *res){
-    sl::json::value json;
-    std::vector<sl::json::value> json_array;
-    int touples_count = PQntuples(res);
-
-    for (int i = 0; i < touples_count; ++i){
-        row tmp_row(res, i);
-        json_array.emplace_back(tmp_row.dump_to_json());
-    }
-    json.set_array(std::move(json_array));
-    return json;
+void json_rows_decoder::append_rows(PGresult* res, std::vector<sl::json::value>& out) {
+    append_rows(res, 0, PQntuples(res), out);
 }
 
-std::set<size_t> check_poses(const std::string& str, const std::string& val){
-    std::set<size_t> null_poses;
-    size_t search_pos = 0;
-    while (std::string::npos != search_pos) {
-        search_pos = str.find(val, search_pos);
-        // Check symbols at borders
-        size_t left = search_pos-1;
-        size_t right = search_pos + 4;
-        char ll = str[left];
-        char rl = str[right];
-        if (('[' == ll && ']' == rl) ||
-            ('[' == str[left] && ',' == str[right]) ||
-            (',' == str[left] && ']' == str[right]) ||
-            (',' == str[left] && ',' == str[right])) {
-            null_poses.insert(search_pos); //because insert shifts litera
-            null_poses.insert(right);
+void json_rows_decoder::append_rows(PGresult* res, int begin, int end, std::vector<sl::json::value>& out) {
+    if (plan.empty()) {
+        plan = result_plan(res);
+    }
+    auto& columns = plan.get_columns();
+    for (int i = begin; i < end; ++i){
+        std::vector<sl::json::field> fields;
+        fields.reserve(columns.size());
+        for (size_t j = 0; j < columns.size(); ++j) {
+            auto& col = columns[j];
+            int idx = static_cast<int>(j);
+            if (PQgetisnull(res, i, idx)) {
+                fields.emplace_back(col.name, sl::json::value());
+            } else {
+                fields.emplace_back(col.name, col.to_json(col.type_id, PQgetvalue(res, i, idx),
+                        static_cast<size_t>(PQgetlength(res, i, idx)), cell));
+            }
         }
-        if (std::string::npos == search_pos) break;
-        search_pos++;
+        out.emplace_back(std::move(fields));
     }
-    return null_poses;
 }
 
-std::set<size_t> check_null_poses(const std::string& val){
-    std::set<size_t> null_poses;
-    std::set<size_t> big_null_poses;
-    null_poses = check_poses(val, "null");
-    big_null_poses = check_poses(val, "NULL");
-    null_poses.insert(big_null_poses.begin(),big_null_poses.end());
-    return null_poses;
+namespace { // anonymous
+
+// rows ranges for the parallel decoding, empty if result is too small
+std::vector<std::pair<int, int>> decode_partitions(PGresult* res) {
+    auto partitions = std::vector<std::pair<int, int>>();
+    int tuples_count = PQntuples(res);
+    if (tuples_count < PSQL_PARALLEL_DECODE_MIN_ROWS) {
+        return partitions;
+    }
+    auto& pool = decode_pool::instance();
+    size_t count = std::min(pool.concurrency(),
+            static_cast<size_t>(tuples_count / (PSQL_PARALLEL_DECODE_MIN_ROWS / 2)));
+    if (count < 2) {
+        return partitions;
+    }
+    int step = tuples_count / static_cast<int>(count);
+    for (size_t i = 0; i < count; i++) {
+        int begin = static_cast<int>(i) * step;
+        int end = i + 1 < count ? begin + step : tuples_count;
+        partitions.emplace_back(begin, end);
+    }
+    return partitions;
 }
 
-void replace_all_occurences(std::string& str, const std::string& subst, const std::string& replacer) {
-    size_t search_pos = 0;
-    while (std::string::npos != search_pos){
-        search_pos = str.find(subst, search_pos);
-        if (std::string::npos == search_pos) break;
-        str.replace(search_pos, subst.size(), replacer);
-        search_pos += replacer.size();
+} // namespace
+
+sl::json::value get_result_as_json(PGresult *res){
+    std::vector<sl::json::value> json_array;
+    json_array.reserve(static_cast<size_t>(PQntuples(res)));
+    auto partitions = decode_partitions(res);
+    if (partitions.empty()) {
+        json_rows_decoder decoder;
+        decoder.append_rows(res, json_array);
+        return sl::json::value(std::move(json_array));
     }
+    // PGresult is read-only and can be accessed from multiple threads
+    auto fragments = std::vector<std::vector<sl::json::value>>(partitions.size());
+    decode_pool::instance().run_partitions(partitions.size(), [res, &partitions, &fragments](size_t idx) {
+        json_rows_decoder decoder;
+        fragments[idx].reserve(static_cast<size_t>(partitions[idx].second - partitions[idx].first));
+        decoder.append_rows(res, partitions[idx].first, partitions[idx].second, fragments[idx]);
+    });
+    for (auto& fr : fragments) {
+        std::move(fr.begin(), fr.end(), std::back_inserter(json_array));
+    }
+    return sl::json::value(std::move(json_array));
 }
 
-void change_null_register(std::string& val) {
-    replace_all_occurences(val, "NULL", "null");
+uint64_t get_result_data_bytes(PGresult* res) {
+    uint64_t bytes = 0;
+    int tuples_count = PQntuples(res);
+    int fields_count = PQnfields(res);
+    for (int i = 0; i < tuples_count; ++i) {
+        for (int j = 0; j < fields_count; ++j) {
+            bytes += static_cast<uint64_t>(PQgetlength(res, i, j));
+        }
+    }
+    return bytes;
 }
 
-void prepare_bool_array(std::string& val){
-    replace_all_occurences(val, "t", "true");
-    replace_all_occurences(val, "f", "false");
+// approximate memory held by decoded JSON value
+uint64_t get_json_memory_bytes(const sl::json::value& val) {
+    uint64_t bytes = sizeof(sl::json::value);
+    switch (val.json_type()) {
+    case sl::json::type::string:
+        bytes += val.as_string().capacity();
+        break;
+    case sl::json::type::array:
+        for (auto& el : val.as_array()) {
+            bytes += get_json_memory_bytes(el);
+        }
+        break;
+    case sl::json::type::object:
+        for (auto& fi : val.as_object()) {
+            bytes += fi.name().capacity() + get_json_memory_bytes(fi.val());
+        }
+        break;
+    default:
+        break;
+    }
+    return bytes;
 }
 
 void prepare_text_array(std::string& val) {
@@ -379,272 +641,34 @@ sl::json::value prepare_json_array(std::string& val) {
     return sl::json::value(std::move(array));
 }
 
+namespace { // anonymous
 
-} // namespace
-
-//////////// ROW CLASS
-row::~row() {}
-row::row(PGresult *res, int row_pos) {
-    int fields_count = PQnfields(res);
-    for (int i = 0; i < fields_count; ++i) {
-        Oid type = PSQL_NULLOID;
-        if (!PQgetisnull(res, row_pos, i)) {
-            type = PQftype(res,i);
-        }
-        add_column_property(PQfname(res, i), type, PQgetvalue(res, row_pos, i));
+// names are few, linear search is cheaper than a map
+void append_parameter_position(const std::string& name, std::vector<std::string>& last_prepared_names,
+        std::string& query) {
+    auto it = std::find(last_prepared_names.begin(), last_prepared_names.end(), name);
+    if (last_prepared_names.end() == it) {
+        last_prepared_names.push_back(name);
+        it = last_prepared_names.end() - 1;
     }
+    query.push_back('$');
+    query.append(sl::support::to_string(it - last_prepared_names.begin() + 1));
 }
 
-void row::add_column_property(std::string in_name, Oid in_type_id, std::string in_value){
-    properties.emplace_back(in_name, in_type_id, in_value);
+} // namespace
+
+std::string parse_query(const std::string& sql_query, std::vector<std::string>& last_prepared_names){
+    std::string query;
+    parse_query(sql_query, last_prepared_names, query);
+    return query;
 }
 
-staticlib::json::value row::get_value_as_json(size_t value_pos) {
-    std::string val{properties[value_pos].value};
-    sl::json::value js_val;
-    switch(properties[value_pos].type_id){
-    case PSQL_CHARARRAYOID:
-    case PSQL_VARCHARARRAYOID:
-    case PSQL_TEXTARRAYOID: {
-        return prepare_json_array(val);
-        break;
-    }
-    case PSQL_BOOLARARRAYOID: {
-        prepare_bool_array(val); // no break
-    }
-    case PSQL_FLOAT4ARRAYOID:
-    case PSQL_FLOAT8ARRAYOID:
-    case PSQL_INT2ARRAYOID:
-    case PSQL_INT4ARRAYOID:
-    case PSQL_INT8ARRAYOID:{
-        const size_t open_brace_pos = 0;
-        const size_t close_brace_pos = val.size()-1;
-        const size_t replace_symbol_amount = 1;
-        val.replace(open_brace_pos, replace_symbol_amount, "[");
-        val.replace(close_brace_pos, replace_symbol_amount, "]");
-        change_null_register(val);
-        return sl::json::loads(val);
-    }
-    case PSQL_BOOLOID: {
-        if ("t" == val) { // "t" - true sign for boolean type from PGresult
-            js_val.set_bool(true);
-        } else if ("f" == val) {
-            js_val.set_bool(false);
-        }
-        break;
-    }
-    case PSQL_INT2OID:
-    case PSQL_INT4OID:
-    case PSQL_INT8OID:
-    case PSQL_JSONOID:
-    case PSQL_JSONBOID:
-    case PSQL_FLOAT4OID:
-    case PSQL_FLOAT8OID: {
-        return sl::json::loads(val);
-    }
-    case PSQL_NULLOID:{
-        break;
-    }
-    case PSQL_TEXTOID:
-    case PSQL_VARCHAROID:
-    default: {
-        js_val.set_string(val);
-        break;
-    }
-    }
-    return js_val;
-}
-
-sl::json::value row::dump_to_json(){
-    sl::json::value json_res;
-    std::vector<sl::json::field> fields;
-    for (size_t i = 0; i < properties.size(); ++i) {
-        std::string field_name = properties[i].name;
-        fields.emplace_back(field_name.c_str(),
-                            get_value_as_json(i));
-    }
-    json_res.set_object(std::move(fields));
-    return json_res;
-}
-
-
-class psql_handler::impl : public staticlib::pimpl::object::impl {
-protected:
-    PGconn *conn;
-    PGresult *res;
-    std::string connection_parameters;
-    std::string last_error;
-    std::map<std::string, std::vector<std::string>> prepared_names;
-    std::unordered_map<std::string, std::string> queries_cache;
-//    int ping_on;
-    sl::utils::random_string_generator names_generator;
-public:    
-impl(const std::string& conn_params) :
-conn(nullptr),
-res(nullptr),
-connection_parameters(conn_params){ }
-
-~impl() STATICLIB_NOEXCEPT {
-    clear_result();
-    close();
-}
-
-void setup_connection_params(psql_handler&, const std::string& conn_params) {
-    this->connection_parameters = conn_params;
-}
-
-bool connect(psql_handler&) {
-    /* Make a connection to the database */
-    this->conn = PQconnectdb(connection_parameters.c_str());
-
-    /* Check to see that the backend connection was successfully made */
-    if (CONNECTION_OK != PQstatus(conn)) {
-        last_error = "Connection to database failed: " + std::string(PQerrorMessage(conn));
-        close();
-        return false;
-    }
-    return true;
-}
-
-void close(){
-    if (nullptr != conn) {
-        PQfinish(conn);
-        conn = nullptr;
-    }
-}
-
-bool handle_result(PGconn* conn, PGresult* res, const std::string& error_message){
-    std::string msg(error_message);
-
-    ExecStatusType const status = PQresultStatus(res);
-    switch (status) {
-    case PGRES_EMPTY_QUERY:
-    case PGRES_COMMAND_OK:
-        // No data but don't throw neither.
-        return false;
-
-    case PGRES_TUPLES_OK:
-        return true;
-
-    case PGRES_FATAL_ERROR:
-        msg += " Fatal error.";
-        if (CONNECTION_BAD == PQstatus(conn)) {
-            msg += " Connection failed.";
-            // TODO maybe add user callback call
-        }
-        break;
-
-    default:
-        // Some of the other status codes are not really errors but we're
-        // not prepared to handle them right now and shouldn't ever receive
-        // them so throw nevertheless
-        break;
-    }
-
-    const char* const pqError = PQresultErrorMessage(res);
-    if (pqError && *pqError) {
-        msg += " Code: [";
-        msg += PQresultErrorField(res, PG_DIAG_SQLSTATE);
-        msg += "], ";
-        msg += pqError;
-    }
-
-    const char* sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
-    const char* const blank_sql_state = "     ";
-    if (!sqlstate) {
-        sqlstate = blank_sql_state;
-    }
-
-    throw wilton::support::exception(TRACEMSG(msg));
-}
-
-void prepare_params(
-        std::vector<Oid>& types,
-        std::vector<const char*>& values,
-        std::vector<int>& length,
-        std::vector<int>& formats,
-        std::vector<parameters_values>& vals,
-        const std::vector<std::string>& names)
-{
-    // if names presents - sort by names, else sort by $# numbers
-    if (names.size()) {
-        for (auto& name: names) {
-            for (auto& val : vals) {
-                if (!name.compare(val.parameter_name)){
-                    if (PSQL_UNKNOWNOID != val.type) {
-                        values.push_back(val.value.c_str());
-                    } else {
-                        values.push_back(nullptr);
-                    }
-                    types.push_back(val.type);
-                    length.push_back(val.len);
-                    formats.push_back(val.format); // text_format
-                    break;
-                }
-            }
-        }
-    } else {
-        auto compare = [] (const parameters_values& a, const parameters_values& b) -> bool {
-            int a_pos = 0;
-            int b_pos = 0;
-
-            a_pos = std::atoi(a.parameter_name.substr(1).c_str());
-            b_pos = std::atoi(b.parameter_name.substr(1).c_str());
-
-            return (a_pos < b_pos);
-        };
-        std::sort(vals.begin(), vals.end(), compare);
-        for (auto& el : vals) {
-            if (PSQL_UNKNOWNOID != el.type) {
-                values.push_back(el.value.c_str());
-            } else {
-                values.push_back(nullptr);
-            }
-            types.push_back(el.type);
-            length.push_back(el.len);
-            formats.push_back(el.format); // text_format
-        }
-    }
-
-}
-
-sl::json::value execute_hardcode_statement(PGconn* conn, const std::string& query, const std::string& error_message) {
-    res = PQexec(conn, query.c_str());
-    if (is_connection_bad()) {
-        reset_database_connection();
-        res = PQexec(conn, query.c_str());
-    }
-
-    return get_execution_result(error_message); // throw on error
-}
-
-void begin(psql_handler&)
-{
-    execute_hardcode_statement(conn, "BEGIN", "Cannot begin transaction.");
-}
-
-void commit(psql_handler&)
-{
-    execute_hardcode_statement(conn, "COMMIT", "Cannot commit transaction.");
-}
-
-void rollback(psql_handler&)
-{
-    execute_hardcode_statement(conn, "ROLLBACK", "Cannot rollback transaction.");
-}
-
-void deallocate_prepared_statement(const std::string& statement_name) {
-    std::string query = "DEALLOCATE " + statement_name + ";";
-    execute_hardcode_statement(conn, query.c_str(), "Cannot deallocate prepared statement.");
-    prepared_names.erase(statement_name);
-}
-
-std::string parse_query(const std::string& sql_query, std::vector<std::string>& last_prepared_names){
+void parse_query(const std::string& sql_query, std::vector<std::string>& last_prepared_names,
+        std::string& query){
     enum { normal, in_quotes, in_name } state = normal;
-    std::map<std::string, std::string> names;
     std::string name;
-    std::string query;
-    int position = 1;
+    query.clear();
+    query.reserve(sql_query.length() + 16);
     last_prepared_names.clear();
 
     for (std::string::const_iterator it = sql_query.begin(), end = sql_query.end();
@@ -703,15 +727,7 @@ std::string parse_query(const std::string& sql_query, std::vector<std::string>&
             }
             else // end of name
             {
-                if (!names.count(name)) {
-                    std::stringstream ss;
-                    ss << '$' << position++;
-                    names[name] = ss.str();
-                    query += ss.str();
-                    last_prepared_names.push_back(name);
-                } else {
-                    query += names[name];
-                }
+                append_parameter_position(name, last_prepared_names, query);
                 query += *it;
                 state = normal;
                 name.clear();
@@ -736,42 +752,616 @@ std::string parse_query(const std::string& sql_query, std::vector<std::string>&
 
     if (state == in_name)
     {
-        if (!names.count(name)) {
-            std::stringstream ss;
-            ss << '$' << position++;
-            names[name] = ss.str();
-            query += ss.str();
-            last_prepared_names.push_back(name);
+        append_parameter_position(name, last_prepared_names, query);
+    }
+}
+
+void prepare_params(
+        bind_buffers& binds,
+        const std::vector<std::string>& names)
+{
+    auto vals_begin = binds.vals.begin();
+    auto vals_end = binds.vals.begin() + static_cast<std::ptrdiff_t>(binds.vals_count);
+    auto push = [&binds] (const parameters_values& val) {
+        if (PSQL_UNKNOWNOID != val.type) {
+            binds.values.push_back(val.value.c_str());
         } else {
-            query += names[name];
+            binds.values.push_back(nullptr);
+        }
+        binds.types.push_back(val.type);
+        binds.lengths.push_back(val.len);
+        binds.formats.push_back(val.format);
+    };
+    // if names presents - sort by names, else sort by $# numbers
+    if (names.size()) {
+        for (auto& name: names) {
+            for (auto it = vals_begin; it != vals_end; ++it) {
+                if (name == it->parameter_name) {
+                    push(*it);
+                    break;
+                }
+            }
+        }
+    } else {
+        auto compare = [] (const parameters_values& a, const parameters_values& b) -> bool {
+            return parameter_position(a) < parameter_position(b);
+        };
+        std::sort(vals_begin, vals_end, compare);
+        for (auto it = vals_begin; it != vals_end; ++it) {
+            push(*it);
         }
     }
+}
 
-    return query;
+sl::json::value column_value_as_json(Oid type_id, std::string val) {
+    return decode_column_value(type_id, val);
 }
 
-void clear_result(){
-    if (res) {
-        PQclear(res);
-        res = nullptr;
+sl::json::value decode_column_value(Oid type_id, std::string& val) {
+    sl::json::value js_val;
+    switch(type_id){
+    case PSQL_CHARARRAYOID:
+    case PSQL_VARCHARARRAYOID:
+    case PSQL_TEXTARRAYOID: {
+        return prepare_json_array(val);
+        break;
+    }
+    case PSQL_BOOLARARRAYOID: {
+        prepare_bool_array(val); // no break
+    }
+    case PSQL_FLOAT4ARRAYOID:
+    case PSQL_FLOAT8ARRAYOID:
+    case PSQL_INT2ARRAYOID:
+    case PSQL_INT4ARRAYOID:
+    case PSQL_INT8ARRAYOID:{
+        const size_t open_brace_pos = 0;
+        const size_t close_brace_pos = val.size()-1;
+        const size_t replace_symbol_amount = 1;
+        val.replace(open_brace_pos, replace_symbol_amount, "[");
+        val.replace(close_brace_pos, replace_symbol_amount, "]");
+        change_null_register(val);
+        return sl::json::loads(val);
+    }
+    case PSQL_BOOLOID: {
+        if ("t" == val) { // "t" - true sign for boolean type from PGresult
+            js_val.set_bool(true);
+        } else if ("f" == val) {
+            js_val.set_bool(false);
+        }
+        break;
+    }
+    case PSQL_INT2OID:
+    case PSQL_INT4OID:
+    case PSQL_INT8OID:
+    case PSQL_JSONOID:
+    case PSQL_JSONBOID:
+    case PSQL_FLOAT4OID:
+    case PSQL_FLOAT8OID: {
+        return sl::json::loads(val);
+    }
+    case PSQL_NULLOID:{
+        break;
+    }
+    case PSQL_TEXTOID:
+    case PSQL_VARCHAROID:
+    default: {
+        js_val.set_string(val);
+        break;
+    }
     }
+    return js_val;
 }
 
-std::string generate_unique_name(){
-    const int gen_length = 32;
-    std::string name{};
-    do {
-        name = names_generator.generate(gen_length);
-    } while (prepared_names.count(name));
-    return name;
+namespace { // anonymous
+
+sl::json::value json_from_bool(Oid, const char* val, size_t, std::string&) {
+    // "t" - true sign for boolean type from PGresult
+    return sl::json::value('t' == val[0]);
 }
 
-size_t sql_cached(const std::string& sql){
-    return queries_cache.count(sql);
+sl::json::value json_from_text(Oid, const char* val, size_t len, std::string&) {
+    return sl::json::value(std::string(val, len));
 }
 
-void cache_sql(const std::string& sql, const std::string& name){
-    queries_cache[sql] = name;
+sl::json::value json_parsed(Oid, const char* val, size_t len, std::string& cell) {
+    cell.assign(val, len);
+    return sl::json::loads(cell);
+}
+
+sl::json::value json_from_array(Oid type_id, const char* val, size_t len, std::string& cell) {
+    cell.assign(val, len);
+    return decode_column_value(type_id, cell);
+}
+
+void msgpack_from_bool(Oid, const char* val, size_t, msgpack_writer& writer, std::string&) {
+    writer.write_bool('t' == val[0]);
+}
+
+void msgpack_from_int(Oid, const char* val, size_t, msgpack_writer& writer, std::string&) {
+    writer.write_int(std::strtoll(val, nullptr, 10));
+}
+
+void msgpack_from_float(Oid, const char* val, size_t, msgpack_writer& writer, std::string&) {
+    // strtod also handles NaN and Infinity
+    writer.write_double(std::strtod(val, nullptr));
+}
+
+void msgpack_from_bytea(Oid, const char* val, size_t, msgpack_writer& writer, std::string&) {
+    size_t bin_len = 0;
+    unsigned char* bin = PQunescapeBytea(reinterpret_cast<const unsigned char*>(val), std::addressof(bin_len));
+    if (nullptr == bin) throw support::exception(TRACEMSG("Cannot decode bytea value"));
+    writer.write_bin(reinterpret_cast<const char*>(bin), bin_len);
+    PQfreemem(bin);
+}
+
+void msgpack_from_text(Oid, const char* val, size_t len, msgpack_writer& writer, std::string&) {
+    writer.write_str(val, len);
+}
+
+// arrays and json are handled the same way as for JSON results
+void msgpack_from_json(Oid type_id, const char* val, size_t len, msgpack_writer& writer, std::string& cell) {
+    writer.write_json(json_from_array(type_id, val, len, cell));
+}
+
+void text_from_bool(Oid, const char* val, size_t, std::string& out, std::string&) {
+    out.append('t' == val[0] ? "true" : "false");
+}
+
+// server text is already valid JSON
+void text_copied(Oid, const char* val, size_t len, std::string& out, std::string&) {
+    out.append(val, len);
+}
+
+void text_from_float(Oid, const char* val, size_t len, std::string& out, std::string&) {
+    // shortest round-trip digits since PostgreSQL 12, NaN and Infinity are written as strings
+    if (is_json_number(val, len)) {
+        out.append(val, len);
+    } else {
+        write_json_string(val, len, out);
+    }
+}
+
+void text_from_text(Oid, const char* val, size_t len, std::string& out, std::string&) {
+    write_json_string(val, len, out);
+}
+
+void text_from_array_element(Oid type_id, const char* val, size_t len, std::string& out) {
+    if (4 == len && 0 == std::strncmp(val, "NULL", len)) {
+        out.append("null");
+    } else if (PSQL_BOOLARARRAYOID == type_id) {
+        out.append('t' == val[0] ? "true" : "false");
+    } else if (is_json_number(val, len)) {
+        out.append(val, len);
+    } else {
+        // float NaN and Infinity
+        write_json_string(val, len, out);
+    }
+}
+
+// numeric and boolean array elements are not quoted by server,
+// nested braces of multi-dimensional arrays become nested JSON arrays
+void text_from_plain_array(Oid type_id, const char* val, size_t len, std::string& out) {
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        char ch = val[i];
+        if ('{' == ch) {
+            out.push_back('[');
+            start = i + 1;
+        } else if (',' == ch || '}' == ch) {
+            if (i > start) {
+                text_from_array_element(type_id, val + start, i - start, out);
+            }
+            out.push_back(',' == ch ? ',' : ']');
+            start = i + 1;
+        }
+    }
+}
+
+void text_from_array(Oid type_id, const char* val, size_t len, std::string& out, std::string& cell) {
+    if (PSQL_CHARARRAYOID != type_id && PSQL_VARCHARARRAYOID != type_id && PSQL_TEXTARRAYOID != type_id) {
+        text_from_plain_array(type_id, val, len, out);
+        return;
+    }
+    // quoting and escaping of text elements is handled by the JSON decoder,
+    // decoded elements are strings and nulls
+    auto json = json_from_array(type_id, val, len, cell);
+    out.push_back('[');
+    auto& elements = json.as_array();
+    for (size_t i = 0; i < elements.size(); i++) {
+        if (i > 0) {
+            out.push_back(',');
+        }
+        auto& el = elements[i];
+        if (sl::json::type::nullt == el.json_type()) {
+            out.append("null");
+        } else {
+            write_json_string(el.as_string_or_throw("array element"), out);
+        }
+    }
+    out.push_back(']');
+}
+
+void resolve_decoders(result_plan::column& col) {
+    switch (col.type_id) {
+    case PSQL_BOOLOID:
+        col.to_json = json_from_bool;
+        col.to_msgpack = msgpack_from_bool;
+        col.to_text = text_from_bool;
+        break;
+    case PSQL_INT2OID:
+    case PSQL_INT4OID:
+    case PSQL_INT8OID:
+        col.to_json = json_parsed;
+        col.to_msgpack = msgpack_from_int;
+        col.to_text = text_copied;
+        break;
+    case PSQL_FLOAT4OID:
+    case PSQL_FLOAT8OID:
+        col.to_json = json_parsed;
+        col.to_msgpack = msgpack_from_float;
+        col.to_text = text_from_float;
+        break;
+    case PSQL_JSONOID:
+    case PSQL_JSONBOID:
+        col.to_json = json_parsed;
+        col.to_msgpack = msgpack_from_json;
+        col.to_text = text_copied;
+        break;
+    case PSQL_BYTEAOID:
+        col.to_json = json_from_text;
+        col.to_msgpack = msgpack_from_bytea;
+        col.to_text = text_from_text;
+        break;
+    case PSQL_CHARARRAYOID:
+    case PSQL_VARCHARARRAYOID:
+    case PSQL_TEXTARRAYOID:
+    case PSQL_BOOLARARRAYOID:
+    case PSQL_FLOAT4ARRAYOID:
+    case PSQL_FLOAT8ARRAYOID:
+    case PSQL_INT2ARRAYOID:
+    case PSQL_INT4ARRAYOID:
+    case PSQL_INT8ARRAYOID:
+        col.to_json = json_from_array;
+        col.to_msgpack = msgpack_from_json;
+        col.to_text = text_from_array;
+        break;
+    case PSQL_TEXTOID:
+    case PSQL_VARCHAROID:
+    default:
+        col.to_json = json_from_text;
+        col.to_msgpack = msgpack_from_text;
+        col.to_text = text_from_text;
+        break;
+    }
+}
+
+} // namespace
+
+result_plan::result_plan(PGresult* res) {
+    int fields_count = PQnfields(res);
+    columns.resize(static_cast<size_t>(fields_count));
+    for (int j = 0; j < fields_count; ++j) {
+        auto& col = columns[j];
+        col.name = PQfname(res, j);
+        col.text_key = j > 0 ? "," : "";
+        write_json_string(col.name, col.text_key);
+        col.text_key.push_back(':');
+        col.type_id = PQftype(res, j);
+        resolve_decoders(col);
+    }
+}
+
+void write_result_as_msgpack(PGresult* res, std::string& out) {
+    msgpack_writer writer{out};
+    writer.write_array_header(static_cast<uint32_t>(PQntuples(res)));
+    auto plan = result_plan(res);
+    auto partitions = decode_partitions(res);
+    if (partitions.empty()) {
+        std::string cell;
+        write_rows_as_msgpack(res, plan, 0, PQntuples(res), writer, cell);
+        return;
+    }
+    auto fragments = std::vector<std::string>(partitions.size());
+    decode_pool::instance().run_partitions(partitions.size(), [res, &plan, &partitions, &fragments](size_t idx) {
+        msgpack_writer fwriter{fragments[idx]};
+        std::string cell;
+        write_rows_as_msgpack(res, plan, partitions[idx].first, partitions[idx].second, fwriter, cell);
+    });
+    size_t len = out.length();
+    for (auto& fr : fragments) {
+        len += fr.length();
+    }
+    out.reserve(len);
+    for (auto& fr : fragments) {
+        out.append(fr);
+    }
+}
+
+void write_rows_as_msgpack(PGresult* res, const result_plan& plan, int begin, int end,
+        msgpack_writer& writer, std::string& cell) {
+    auto& columns = plan.get_columns();
+    for (int i = begin; i < end; ++i) {
+        writer.write_map_header(static_cast<uint32_t>(columns.size()));
+        for (size_t j = 0; j < columns.size(); ++j) {
+            auto& col = columns[j];
+            int idx = static_cast<int>(j);
+            writer.write_str(col.name);
+            if (PQgetisnull(res, i, idx)) {
+                writer.write_nil();
+            } else {
+                col.to_msgpack(col.type_id, PQgetvalue(res, i, idx),
+                        static_cast<size_t>(PQgetlength(res, i, idx)), writer, cell);
+            }
+        }
+    }
+}
+
+void write_result_as_json_text(PGresult* res, std::string& out) {
+    out.push_back('[');
+    auto plan = result_plan(res);
+    auto partitions = decode_partitions(res);
+    if (partitions.empty()) {
+        std::string cell;
+        write_rows_as_json_text(res, plan, 0, PQntuples(res), out, cell);
+    } else {
+        auto fragments = std::vector<std::string>(partitions.size());
+        decode_pool::instance().run_partitions(partitions.size(), [res, &plan, &partitions, &fragments](size_t idx) {
+            std::string cell;
+            write_rows_as_json_text(res, plan, partitions[idx].first, partitions[idx].second, fragments[idx], cell);
+        });
+        size_t len = out.length() + 1;
+        for (auto& fr : fragments) {
+            len += fr.length();
+        }
+        out.reserve(len);
+        for (auto& fr : fragments) {
+            out.append(fr);
+        }
+    }
+    // trailing comma after the last row
+    if (',' == out.back()) {
+        out.back() = ']';
+    } else {
+        out.push_back(']');
+    }
+}
+
+void write_rows_as_json_text(PGresult* res, const result_plan& plan, int begin, int end,
+        std::string& out, std::string& cell) {
+    auto& columns = plan.get_columns();
+    for (int i = begin; i < end; ++i) {
+        out.push_back('{');
+        for (size_t j = 0; j < columns.size(); ++j) {
+            auto& col = columns[j];
+            int idx = static_cast<int>(j);
+            out.append(col.text_key);
+            if (PQgetisnull(res, i, idx)) {
+                out.append("null");
+            } else {
+                col.to_text(col.type_id, PQgetvalue(res, i, idx),
+                        static_cast<size_t>(PQgetlength(res, i, idx)), out, cell);
+            }
+        }
+        out.append("},");
+    }
+}
+
+class psql_handler::impl : public staticlib::pimpl::object::impl {
+protected:
+    PGconn *conn;
+    PGresult *res;
+    std::string connection_parameters;
+    std::string last_error;
+    std::map<std::string, std::vector<std::string>> prepared_names;
+    std::unordered_map<std::string, std::string> queries_cache;
+//    int ping_on;
+    sl::utils::random_string_generator names_generator;
+    // statement_timeout applied to session outside of transactions
+    uint32_t session_timeout_millis;
+    // statement_timeout in effect in the current transaction
+    uint32_t local_timeout_millis;
+    // guards cancel_handle, it is copied out by other threads,
+    // PQcancel is called without holding the lock
+    std::mutex cancel_mutex;
+    std::shared_ptr<PGcancel> cancel_handle;
+    // SQLSTATE of the last failed statement
+    std::string last_sqlstate;
+    std::mt19937 backoff_rng;
+    uint64_t transaction_retries;
+    uint64_t transaction_retries_exhausted;
+    // named statements prepared eagerly on connect and after reset
+    std::vector<std::pair<std::string, std::string>> catalog;
+    // reused by every statement on this connection
+    bind_buffers binds;
+    // used when limits are not specified for the statement
+    result_limits default_limits;
+    // set only while the statement is executed in single-row mode
+    result_limits active_limits;
+    std::function<uint64_t(PGresult*)>* row_sink;
+    uint64_t last_result_bytes;
+    uint64_t peak_result_bytes;
+    uint64_t result_limit_aborts;
+public:    
+impl(const std::string& conn_params) :
+conn(nullptr),
+res(nullptr),
+connection_parameters(conn_params),
+session_timeout_millis(0),
+local_timeout_millis(0),
+backoff_rng(std::random_device{}()),
+transaction_retries(0),
+transaction_retries_exhausted(0),
+row_sink(nullptr),
+last_result_bytes(0),
+peak_result_bytes(0),
+result_limit_aborts(0) { }
+
+~impl() STATICLIB_NOEXCEPT {
+    clear_result();
+    close();
+}
+
+void setup_connection_params(psql_handler&, const std::string& conn_params) {
+    this->connection_parameters = conn_params;
+}
+
+bool connect(psql_handler&) {
+    /* Make a connection to the database */
+    this->conn = PQconnectdb(connection_parameters.c_str());
+
+    /* Check to see that the backend connection was successfully made */
+    if (CONNECTION_OK != PQstatus(conn)) {
+        last_error = "Connection to database failed: " + std::string(PQerrorMessage(conn));
+        close();
+        return false;
+    }
+    refresh_cancel_handle();
+    return true;
+}
+
+void close(){
+    free_cancel_handle();
+    if (nullptr != conn) {
+        PQfinish(conn);
+        conn = nullptr;
+    }
+}
+
+void refresh_cancel_handle() {
+    // backend PID changes on reconnect, handles copied
+    // by other threads stay valid until they are released
+    auto handle = std::shared_ptr<PGcancel>(PQgetCancel(conn), PQfreeCancel);
+    std::lock_guard<std::mutex> guard{cancel_mutex};
+    cancel_handle = std::move(handle);
+}
+
+void free_cancel_handle() {
+    std::lock_guard<std::mutex> guard{cancel_mutex};
+    cancel_handle.reset();
+}
+
+std::shared_ptr<PGcancel> get_cancel_handle(psql_handler&) {
+    return copy_cancel_handle();
+}
+
+bool is_broken(psql_handler&) {
+    return nullptr == conn || is_connection_bad();
+}
+
+std::shared_ptr<PGcancel> copy_cancel_handle() {
+    std::lock_guard<std::mutex> guard{cancel_mutex};
+    return cancel_handle;
+}
+
+void cancel(psql_handler&) {
+    send_cancel_request(copy_cancel_handle());
+}
+
+bool handle_result(PGconn* conn, PGresult* res, const std::string& error_message){
+    std::string msg(error_message);
+
+    ExecStatusType const status = PQresultStatus(res);
+    switch (status) {
+    case PGRES_EMPTY_QUERY:
+    case PGRES_COMMAND_OK:
+        // No data but don't throw neither.
+        return false;
+
+    case PGRES_TUPLES_OK:
+        return true;
+
+    case PGRES_FATAL_ERROR:
+        msg += " Fatal error.";
+        if (CONNECTION_BAD == PQstatus(conn)) {
+            msg += " Connection failed.";
+            // TODO maybe add user callback call
+        }
+        break;
+
+    default:
+        // Some of the other status codes are not really errors but we're
+        // not prepared to handle them right now and shouldn't ever receive
+        // them so throw nevertheless
+        break;
+    }
+
+    const char* const pqError = PQresultErrorMessage(res);
+    if (pqError && *pqError) {
+        msg += " Code: [";
+        msg += PQresultErrorField(res, PG_DIAG_SQLSTATE);
+        msg += "], ";
+        msg += pqError;
+    }
+
+    const char* sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+    const char* const blank_sql_state = "     ";
+    if (!sqlstate) {
+        sqlstate = blank_sql_state;
+    }
+    last_sqlstate = sqlstate;
+
+    throw wilton::support::exception(TRACEMSG(msg));
+}
+
+sl::json::value execute_hardcode_statement(PGconn* conn, const std::string& query, const std::string& error_message) {
+    res = PQexec(conn, query.c_str());
+    if (is_connection_bad()) {
+        reset_database_connection();
+        res = PQexec(conn, query.c_str());
+    }
+
+    return get_execution_result(error_message); // throw on error
+}
+
+void begin(psql_handler&)
+{
+    begin_transaction();
+}
+
+void begin_transaction() {
+    execute_hardcode_statement(conn, "BEGIN", "Cannot begin transaction.");
+    // new transaction starts with the session setting
+    local_timeout_millis = session_timeout_millis;
+}
+
+void commit(psql_handler&)
+{
+    execute_hardcode_statement(conn, "COMMIT", "Cannot commit transaction.");
+}
+
+void rollback(psql_handler&)
+{
+    execute_hardcode_statement(conn, "ROLLBACK", "Cannot rollback transaction.");
+}
+
+void deallocate_prepared_statement(const std::string& statement_name) {
+    std::string query = "DEALLOCATE " + statement_name + ";";
+    execute_hardcode_statement(conn, query.c_str(), "Cannot deallocate prepared statement.");
+    prepared_names.erase(statement_name);
+}
+
+void clear_result(){
+    if (res) {
+        PQclear(res);
+        res = nullptr;
+    }
+}
+
+std::string generate_unique_name(){
+    const int gen_length = 32;
+    std::string name{};
+    do {
+        name = names_generator.generate(gen_length);
+    } while (prepared_names.count(name));
+    return name;
+}
+
+size_t sql_cached(const std::string& sql){
+    return queries_cache.count(sql);
+}
+
+void cache_sql(const std::string& sql, const std::string& name){
+    queries_cache[sql] = name;
 }
 
 sl::json::value prepare_and_cahce(const std::string& sql_query, std::string& query_name){
@@ -807,80 +1397,163 @@ sl::json::value get_command_status_as_json(PGresult* result){
     return json;
 }
 
-sl::json::value prepare_and_execute_with_parameters(const std::string& sql_query, const staticlib::json::value &parameters){
-    std::string prepared_name{};
-
-    prepare_cached(sql_query, prepared_name);
+std::string command_status_as_json_text(PGresult* result) {
+    auto out = std::string("{\"cmd_status\":");
+    write_json_string(PQcmdStatus(result), std::strlen(PQcmdStatus(result)), out);
+    out.push_back('}');
+    return out;
+}
 
-    int params_count = 0;
-    std::vector<Oid> params_types;
-    std::vector<const char*> params_values;
-    std::vector<int> params_length;
-    std::vector<int> params_formats;
+// executes statement with parameters from 'binds', leaves result in 'res',
+// with 'row_sink' set, rows are passed to it one by one in single-row mode,
+// sink returns the number of bytes it holds for the passed rows
+void exec_bound(const std::string& name_or_query, bool prepared) {
     const int text_format = 0;
+    int params_count = static_cast<int>(binds.types.size());
+    if (nullptr == row_sink) {
+        if (prepared) {
+            res = PQexecPrepared(conn, name_or_query.c_str(), params_count, binds.values.data(),
+                    binds.lengths.data(), binds.formats.data(), text_format);
+        } else {
+            res = PQexecParams(conn, name_or_query.c_str(), params_count, binds.types.data(),
+                    binds.values.data(), binds.lengths.data(), binds.formats.data(), text_format);
+        }
+        if (nullptr != res && PGRES_TUPLES_OK == PQresultStatus(res)) {
+            track_result_bytes(get_result_data_bytes(res));
+        }
+        return;
+    }
+    // cancel would abort the enclosing transaction
+    bool cancellable = PQTRANS_IDLE == PQtransactionStatus(conn);
+    int sent = 0;
+    if (prepared) {
+        sent = PQsendQueryPrepared(conn, name_or_query.c_str(), params_count, binds.values.data(),
+                binds.lengths.data(), binds.formats.data(), text_format);
+    } else {
+        sent = PQsendQueryParams(conn, name_or_query.c_str(), params_count, binds.types.data(),
+                binds.values.data(), binds.lengths.data(), binds.formats.data(), text_format);
+    }
+    if (!sent) {
+        if (is_connection_bad()) {
+            // caller resets connection
+            return;
+        }
+        last_error = PQerrorMessage(conn);
+        throw support::exception(TRACEMSG("Cannot send statement, error: [" + last_error + "]"));
+    }
+    PQsetSingleRowMode(conn);
+    collect_single_rows(cancellable);
+}
 
-    std::vector<parameters_values> vals;
-
-    setup_params_from_json(vals, parameters, prepared_names[prepared_name]);
-    prepare_params(params_types, params_values, params_length, params_formats, vals, prepared_names[prepared_name]);
+// reads all results of the sent statement, when the limit is exceeded or the sink fails,
+// statement run outside of transaction is cancelled, inside of transaction it is completed
+// normally, so the transaction stays usable; remaining rows are read and discarded
+void collect_single_rows(bool cancellable) {
+    uint64_t rows_count = 0;
+    uint64_t bytes = 0;
+    bool exceeded = false;
+    std::string sink_error;
+    PGresult* last = nullptr;
+    for (PGresult* r = PQgetResult(conn); nullptr != r; r = PQgetResult(conn)) {
+        if (PGRES_SINGLE_TUPLE != PQresultStatus(r)) {
+            if (nullptr != last) {
+                PQclear(last);
+            }
+            last = r;
+            continue;
+        }
+        if (!exceeded && sink_error.empty()) {
+            try {
+                rows_count += 1;
+                bytes += (*row_sink)(r);
+                exceeded = (active_limits.max_rows > 0 && rows_count > active_limits.max_rows) ||
+                        (active_limits.max_bytes > 0 && bytes > active_limits.max_bytes);
+            } catch (const std::exception& e) {
+                sink_error = e.what();
+            }
+            // blocks until the server receives the request, so it cannot hit the next statement
+            if (cancellable && (exceeded || !sink_error.empty())) {
+                cancel_quietly();
+            }
+        }
+        PQclear(r);
+    }
+    track_result_bytes(bytes);
+    if (exceeded || !sink_error.empty()) {
+        if (nullptr != last) {
+            PQclear(last);
+        }
+        if (!sink_error.empty()) {
+            throw support::exception(TRACEMSG(sink_error));
+        }
+        result_limit_aborts += 1;
+        throw support::exception(TRACEMSG(std::string("Result limit exceeded,") +
+                (cancellable ? " statement cancelled," : " remaining rows discarded,") +
+                " maxRows: [" + sl::support::to_string(active_limits.max_rows) + "]," +
+                " maxResultBytes: [" + sl::support::to_string(active_limits.max_bytes) + "]"));
+    }
+    res = last;
+}
 
-    params_count = static_cast<int>(params_types.size());
-    res = PQexecPrepared(conn, prepared_name.c_str(),
-                         params_count,
-                         const_cast<const char* const*>(params_values.data()),
-                         const_cast<const int*>(params_length.data()),
-                         const_cast<const int*>(params_formats.data()),
-                         text_format);
-    if (is_connection_bad()) {
-        reset_database_connection();
-        prepare_cached(sql_query, prepared_name);
-        res = PQexecPrepared(conn, prepared_name.c_str(),
-                             params_count,
-                             const_cast<const char* const*>(params_values.data()),
-                             const_cast<const int*>(params_length.data()),
-                             const_cast<const int*>(params_formats.data()),
-                             text_format);
+void cancel_quietly() {
+    auto handle = copy_cancel_handle();
+    if (nullptr != handle.get()) {
+        std::array<char, 256> errbuf;
+        PQcancel(handle.get(), errbuf.data(), static_cast<int>(errbuf.size()));
     }
+}
 
-    return get_execution_result("PQexecPrepared error"); // throw on error
+void track_result_bytes(uint64_t bytes) {
+    last_result_bytes = bytes;
+    peak_result_bytes = std::max(peak_result_bytes, bytes);
 }
 
-sl::json::value execute_sql_with_parameters(
-        const std::string& sql_statement, const staticlib::json::value& parameters) {
-    int params_count = 0;
-    std::vector<Oid> params_types;
-    std::vector<const char*> params_values;
-    std::vector<int> params_length;
-    std::vector<int> params_formats;
-    const int text_format = 0;
+// leaves result in 'res', returns true if it contains tuples
+bool prepare_and_execute_with_parameters(const std::string& sql_query, const staticlib::json::value &parameters){
+    std::string prepared_name{};
 
-    std::vector<parameters_values> vals;
+    {
+        trace_span span{"prepare"};
+        prepare_cached(sql_query, prepared_name);
+    }
 
-    std::vector<std::string> names;
-    std::string query = parse_query(sql_statement, names);
+    {
+        trace_span span{"bind"};
+        auto& names = prepared_names[prepared_name];
+        binds.reset();
+        setup_params_from_json(binds, parameters, names);
+        prepare_params(binds, names);
+    }
 
-    setup_params_from_json(vals, parameters, names);
-    prepare_params(params_types, params_values, params_length, params_formats, vals, names);
+    trace_span span{"execute"};
+    exec_bound(prepared_name, true);
+    if (is_connection_bad()) {
+        reset_database_connection();
+        prepare_cached(sql_query, prepared_name);
+        exec_bound(prepared_name, true);
+    }
 
-    params_count = static_cast<int>(params_types.size());
+    return handle_result(conn, res, "PQexecPrepared error"); // throw on error
+}
 
-    res = PQexecParams(conn, query.c_str(),
-                       params_count, params_types.data(),
-                       const_cast<const char* const*>(params_values.data()),
-                       const_cast<const int*>(params_length.data()),
-                       const_cast<const int*>(params_formats.data()),
-                       text_format);
+// leaves result in 'res', returns true if it contains tuples
+bool execute_sql_with_parameters(
+        const std::string& sql_statement, const staticlib::json::value& parameters) {
+    {
+        trace_span span{"bind"};
+        binds.reset();
+        parse_query(sql_statement, binds.names, binds.query);
+        setup_params_from_json(binds, parameters, binds.names);
+        prepare_params(binds, binds.names);
+    }
 
+    trace_span span{"execute"};
+    exec_bound(binds.query, false);
     if (is_connection_bad()) {
         reset_database_connection();
-        res = PQexecParams(conn, query.c_str(),
-                           params_count, params_types.data(),
-                           const_cast<const char* const*>(params_values.data()),
-                           const_cast<const int*>(params_length.data()),
-                           const_cast<const int*>(params_formats.data()),
-                           text_format);
+        exec_bound(binds.query, false);
     }
-    return get_execution_result("PQexecParams error"); // throw on error
+    return handle_result(conn, res, "PQexecParams error"); // throw on error
 }
 
 bool is_connection_bad() {
@@ -894,14 +1567,741 @@ void clear_cache(){
 
 void reset_database_connection() {
     PQreset(conn);
+    // failed pipeline may leave the connection in nonblocking mode
+    PQsetnonblocking(conn, 0);
     clear_cache();
+    session_timeout_millis = 0;
+    local_timeout_millis = 0;
+    refresh_cancel_handle();
+    if (!catalog.empty() && !is_connection_bad()) {
+        try {
+            prepare_catalog();
+        } catch (const std::exception&) {
+            // statements will be prepared lazily on execution
+            clear_cache();
+        }
+    }
+}
+
+void load_catalog(psql_handler&, const sl::json::value& statements) {
+    auto loaded = std::vector<std::pair<std::string, std::string>>();
+    for (const sl::json::field& fi : statements.as_object_or_throw("catalog")) {
+        loaded.emplace_back(fi.name(), fi.as_string_nonempty_or_throw(fi.name()));
+    }
+    catalog = std::move(loaded);
+    prepare_catalog();
+}
+
+std::string get_catalog_sql(psql_handler&, const std::string& name) {
+    for (auto& pa : catalog) {
+        if (name == pa.first) {
+            return pa.second;
+        }
+    }
+    throw support::exception(TRACEMSG("Statement not found in catalog, name: [" + name + "]"));
+}
+
+void prepare_catalog() {
+    auto pending = std::vector<std::pair<std::string, std::string>>(); // name, sql
+    auto queries = std::vector<std::string>();
+    for (auto& pa : catalog) {
+        if (sql_cached(pa.second)) {
+            continue;
+        }
+        auto query_name = generate_unique_name();
+        queries.push_back(parse_query(pa.second, prepared_names[query_name]));
+        pending.emplace_back(query_name, pa.second);
+    }
+    if (pending.empty()) {
+        return;
+    }
+#ifdef LIBPQ_HAS_PIPELINING
+    // all PQprepare calls are sent in a single round trip
+    if (!PQenterPipelineMode(conn)) throw support::exception(TRACEMSG(
+            "Cannot enter pipeline mode: " + std::string(PQerrorMessage(conn))));
+    bool sent = true;
+    for (size_t i = 0; i < pending.size() && sent; i++) {
+        auto& name = pending[i].first;
+        sent = 1 == PQsendPrepare(conn, name.c_str(), queries[i].c_str(),
+                static_cast<int>(prepared_names[name].size()), NULL);
+    }
+    sent = sent && 1 == PQpipelineSync(conn);
+    auto error = std::string();
+    if (!sent) {
+        error = PQerrorMessage(conn);
+    }
+    // results of every prepare followed by null, then sync result
+    for (size_t i = 0; sent && i < pending.size(); i++) {
+        PGresult* pres = PQgetResult(conn);
+        if (nullptr == pres) {
+            error = PQerrorMessage(conn);
+            break;
+        }
+        if (PGRES_COMMAND_OK == PQresultStatus(pres)) {
+            cache_sql(pending[i].second, pending[i].first);
+        } else if (error.empty()) {
+            error = "Catalog statement prepare error, SQL: [" + pending[i].second + "]: " +
+                    PQresultErrorMessage(pres);
+        }
+        PQclear(pres);
+        PQclear(PQgetResult(conn));
+    }
+    // drain up to and including sync result
+    for (PGresult* pres = PQgetResult(conn); nullptr != pres; pres = PQgetResult(conn)) {
+        bool sync = PGRES_PIPELINE_SYNC == PQresultStatus(pres);
+        PQclear(pres);
+        if (sync) {
+            break;
+        }
+    }
+    if (1 != PQexitPipelineMode(conn)) {
+        error.append(error.empty() ? "" : "\n");
+        error.append("Cannot exit pipeline mode, error: [" + std::string(PQerrorMessage(conn)) + "]");
+        // connection is left in unknown pipeline state
+        PQreset(conn);
+        clear_cache();
+    }
+    if (!error.empty()) {
+        throw support::exception(TRACEMSG(error));
+    }
+#else // !LIBPQ_HAS_PIPELINING
+    for (size_t i = 0; i < pending.size(); i++) {
+        auto& name = pending[i].first;
+        res = PQprepare(conn, name.c_str(), queries[i].c_str(),
+                static_cast<int>(prepared_names[name].size()), NULL);
+        get_execution_result("Catalog statement prepare error, SQL: [" + pending[i].second + "]"); // throw on error
+        cache_sql(pending[i].second, name);
+    }
+#endif // LIBPQ_HAS_PIPELINING
+}
+
+void apply_statement_timeout(uint32_t timeout_millis) {
+    switch (PQtransactionStatus(conn)) {
+    case PQTRANS_IDLE:
+        // session setting is kept between calls, only changes are sent
+        if (timeout_millis != session_timeout_millis) {
+            if (timeout_millis > 0) {
+                execute_hardcode_statement(conn, "SET statement_timeout = " + sl::support::to_string(timeout_millis),
+                        "Cannot set statement timeout.");
+            } else {
+                execute_hardcode_statement(conn, "RESET statement_timeout", "Cannot reset statement timeout.");
+            }
+            session_timeout_millis = timeout_millis;
+        }
+        // transaction started with plain BEGIN statement inherits it
+        local_timeout_millis = session_timeout_millis;
+        break;
+    case PQTRANS_INTRANS: {
+        // SET inside transaction block is reverted on rollback, so LOCAL is used
+        // that does not affect the session setting, statements without
+        // timeout run with the session one, only changes are sent
+        uint32_t effective = timeout_millis > 0 ? timeout_millis : session_timeout_millis;
+        if (effective != local_timeout_millis) {
+            if (effective > 0) {
+                execute_hardcode_statement(conn, "SET LOCAL statement_timeout = " + sl::support::to_string(effective),
+                        "Cannot set statement timeout.");
+            } else {
+                // session setting was not changed, so DEFAULT is the session value
+                execute_hardcode_statement(conn, "SET LOCAL statement_timeout TO DEFAULT", "Cannot reset statement timeout.");
+            }
+            local_timeout_millis = effective;
+        }
+        break;
+    }
+    default:
+        // failed transaction, statement will be rejected anyway
+        break;
+    }
+}
+
+sl::json::value execute_with_parameters(psql_handler& frontend, const std::string& sql_statement, const staticlib::json::value& parameters, int cache_flag) {
+    return execute_with_parameters(frontend, sql_statement, parameters, execution_options(cache_flag, 0));
+}
+
+// leaves result in 'res', returns true if it contains tuples
+// limits specified for the statement override connection ones
+result_limits effective_limits(const execution_options& options) {
+    auto res = default_limits;
+    if (options.limits.max_rows > 0) {
+        res.max_rows = options.limits.max_rows;
+    }
+    if (options.limits.max_bytes > 0) {
+        res.max_bytes = options.limits.max_bytes;
+    }
+    return res;
+}
+
+// with 'sink' specified, rows are passed to it and the result in 'res' is empty
+bool run_with_parameters(const std::string& sql_statement, const staticlib::json::value& parameters,
+        const execution_options& options, std::function<uint64_t(PGresult*)>* sink = nullptr) {
+    apply_statement_timeout(options.timeout_millis);
+    std::atomic<bool> expired{false};
+    auto watchdog_timeout = options.timeout_millis > 0 ? options.timeout_millis + PSQL_WATCHDOG_GRACE_MILLIS : 0;
+    deadline_guard deadline{watchdog_timeout, [this, &expired] {
+        expired.store(true);
+        cancel_quietly();
+    }};
+    active_limits = effective_limits(options);
+    row_sink = sink;
+    try {
+        bool has_tuples = options.cache_flag ?
+                prepare_and_execute_with_parameters(sql_statement, parameters) :
+                execute_sql_with_parameters(sql_statement, parameters);
+        row_sink = nullptr;
+        return has_tuples;
+    } catch (const std::exception& e) {
+        row_sink = nullptr;
+        clear_result();
+        if (expired.load()) {
+            throw support::exception(TRACEMSG(e.what() + "\nStatement cancelled by client watchdog," +
+                    " timeoutMillis: [" + sl::support::to_string(options.timeout_millis) + "]"));
+        }
+        throw;
+    }
 }
 
-sl::json::value execute_with_parameters(psql_handler&, const std::string& sql_statement, const staticlib::json::value& parameters, int cache_flag) {
-    if (cache_flag) {
-        return prepare_and_execute_with_parameters(sql_statement, parameters);
+sl::json::value execute_with_parameters(psql_handler&, const std::string& sql_statement, const staticlib::json::value& parameters,
+        const execution_options& options) {
+    if (effective_limits(options).enabled()) {
+        return execute_limited(sql_statement, parameters, options);
+    }
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options);
+    try {
+        trace_span span{"decode"};
+        auto json = has_tuples ? get_result_as_json(res) : get_command_status_as_json(res);
+        clear_result();
+        return json;
+    } catch (...) {
+        clear_result();
+        throw;
     }
-    return execute_sql_with_parameters(sql_statement, parameters);
+}
+
+sl::json::value execute_limited(const std::string& sql_statement, const staticlib::json::value& parameters,
+        const execution_options& options) {
+    json_rows_decoder decoder;
+    std::vector<sl::json::value> rows;
+    std::function<uint64_t(PGresult*)> sink = [&decoder, &rows](PGresult* r) -> uint64_t {
+        size_t from = rows.size();
+        decoder.append_rows(r, rows);
+        uint64_t bytes = 0;
+        for (size_t i = from; i < rows.size(); i++) {
+            bytes += get_json_memory_bytes(rows[i]);
+        }
+        return bytes;
+    };
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options, std::addressof(sink));
+    try {
+        auto json = has_tuples ? sl::json::value(std::move(rows)) : get_command_status_as_json(res);
+        clear_result();
+        return json;
+    } catch (...) {
+        clear_result();
+        throw;
+    }
+}
+
+std::string execute_limited_as_msgpack(const std::string& sql_statement,
+        const staticlib::json::value& parameters, const execution_options& options) {
+    // rows count is known only at the end
+    auto body = std::string();
+    msgpack_writer body_writer{body};
+    auto cell = std::string();
+    // all single-row results have the same columns
+    auto plan = result_plan();
+    uint32_t rows_count = 0;
+    std::function<uint64_t(PGresult*)> sink = [&body, &body_writer, &cell, &plan, &rows_count](PGresult* r) -> uint64_t {
+        if (plan.empty()) {
+            plan = result_plan(r);
+        }
+        size_t from = body.size();
+        write_rows_as_msgpack(r, plan, 0, PQntuples(r), body_writer, cell);
+        rows_count += static_cast<uint32_t>(PQntuples(r));
+        return static_cast<uint64_t>(body.size() - from);
+    };
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options, std::addressof(sink));
+    try {
+        auto out = std::string();
+        msgpack_writer writer{out};
+        if (has_tuples) {
+            writer.write_array_header(rows_count);
+            out.append(body);
+        } else {
+            writer.write_map_header(1);
+            writer.write_str("cmd_status");
+            writer.write_str(PQcmdStatus(res));
+        }
+        clear_result();
+        return out;
+    } catch (...) {
+        clear_result();
+        throw;
+    }
+}
+
+std::string execute_with_parameters_as_msgpack(psql_handler&, const std::string& sql_statement,
+        const staticlib::json::value& parameters, const execution_options& options) {
+    if (effective_limits(options).enabled()) {
+        return execute_limited_as_msgpack(sql_statement, parameters, options);
+    }
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options);
+    try {
+        trace_span span{"decode"};
+        auto out = std::string();
+        if (has_tuples) {
+            write_result_as_msgpack(res, out);
+        } else {
+            msgpack_writer writer{out};
+            writer.write_map_header(1);
+            writer.write_str("cmd_status");
+            writer.write_str(PQcmdStatus(res));
+        }
+        clear_result();
+        return out;
+    } catch (...) {
+        clear_result();
+        throw;
+    }
+}
+
+std::string execute_limited_as_json_text(const std::string& sql_statement,
+        const staticlib::json::value& parameters, const execution_options& options) {
+    auto out = std::string("[");
+    auto cell = std::string();
+    auto plan = result_plan();
+    std::function<uint64_t(PGresult*)> sink = [&out, &cell, &plan](PGresult* r) -> uint64_t {
+        if (plan.empty()) {
+            plan = result_plan(r);
+        }
+        size_t from = out.size();
+        write_rows_as_json_text(r, plan, 0, PQntuples(r), out, cell);
+        return static_cast<uint64_t>(out.size() - from);
+    };
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options, std::addressof(sink));
+    try {
+        if (has_tuples) {
+            if (',' == out.back()) {
+                out.back() = ']';
+            } else {
+                out.push_back(']');
+            }
+        } else {
+            out = command_status_as_json_text(res);
+        }
+        clear_result();
+        return out;
+    } catch (...) {
+        clear_result();
+        throw;
+    }
+}
+
+std::string execute_with_parameters_as_json_text(psql_handler&, const std::string& sql_statement,
+        const staticlib::json::value& parameters, const execution_options& options) {
+    if (effective_limits(options).enabled()) {
+        return execute_limited_as_json_text(sql_statement, parameters, options);
+    }
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options);
+    try {
+        trace_span span{"decode"};
+        auto out = std::string();
+        if (has_tuples) {
+            write_result_as_json_text(res, out);
+        } else {
+            out = command_status_as_json_text(res);
+        }
+        clear_result();
+        return out;
+    } catch (...) {
+        clear_result();
+        throw;
+    }
+}
+
+sl::json::value execute_to_file(psql_handler&, const std::string& sql_statement,
+        const staticlib::json::value& parameters, const execution_options& options) {
+    // file is removed by the writer if the statement fails
+    columnar_file_writer writer{options.sink.file, options.sink.block_rows};
+    // rows are not held in memory, bytes written to file are counted against the limit
+    std::function<uint64_t(PGresult*)> sink = [&writer](PGresult* r) -> uint64_t {
+        writer.append_rows(r);
+        return get_result_data_bytes(r);
+    };
+    bool has_tuples = run_with_parameters(sql_statement, parameters, options, std::addressof(sink));
+    try {
+        if (!has_tuples) {
+            auto json = get_command_status_as_json(res);
+            clear_result();
+            return json;
+        }
+        uint64_t bytes = writer.finish(res);
+        clear_result();
+        return sl::json::value({
+            { "file", options.sink.file },
+            { "rowsCount", static_cast<int64_t>(writer.get_rows_count()) },
+            { "fileBytes", static_cast<int64_t>(bytes) }
+        });
+    } catch (...) {
+        clear_result();
+        throw;
+    }
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+// waits until the server sends data or, with 'for_write' set, accepts more data
+void wait_socket(bool for_write) {
+    int sock = PQsocket(conn);
+    if (sock < 0) throw support::exception(TRACEMSG("Invalid connection socket"));
+    pollfd pfd;
+    pfd.fd = static_cast<decltype(pfd.fd)>(sock);
+    pfd.events = for_write ? (POLLIN | POLLOUT) : POLLIN;
+    pfd.revents = 0;
+    int rc = WILTON_DB_POLL(std::addressof(pfd), 1, -1);
+#ifndef _WIN32
+    if (rc < 0 && EINTR == errno) {
+        return;
+    }
+#endif // !_WIN32
+    if (rc < 0) throw support::exception(TRACEMSG("Connection socket wait error"));
+}
+
+// reads pipelined results that are already received without blocking,
+// 'pending' - indices of sent statements in order, 'stage' - position in the
+// results of the first pending statement: 0 - result, 1 - end of results, 2 - sync point
+void read_pipeline_results(std::deque<size_t>& pending, int& stage, std::vector<pipeline_result>& results) {
+    if (!PQconsumeInput(conn)) throw support::exception(TRACEMSG(
+            "Cannot read pipeline results, error: [" + std::string(PQerrorMessage(conn)) + "]"));
+    while (!pending.empty() && !PQisBusy(conn)) {
+        PGresult* r = PQgetResult(conn);
+        if (0 == stage) {
+            if (nullptr == r) throw support::exception(TRACEMSG(
+                    "No result for pipelined statement, error: [" + std::string(PQerrorMessage(conn)) + "]"));
+            auto& res_out = results[pending.front()];
+            try {
+                trace_span dspan{"decode"};
+                bool has_tuples = handle_result(conn, r, "PQsendQueryParams error");
+                res_out.result = has_tuples ? get_result_as_json(r) : get_command_status_as_json(r);
+            } catch (const std::exception& e) {
+                res_out.error = e.what();
+            }
+            PQclear(r);
+            stage = 1;
+        } else if (1 == stage) {
+            if (nullptr != r) {
+                PQclear(r);
+            } else {
+                stage = 2;
+            }
+        } else {
+            bool synced = nullptr != r && PGRES_PIPELINE_SYNC == PQresultStatus(r);
+            PQclear(r);
+            if (!synced) throw support::exception(TRACEMSG(
+                    "Pipeline is out of sync, error: [" + std::string(PQerrorMessage(conn)) + "]"));
+            pending.pop_front();
+            stage = 0;
+        }
+    }
+}
+#endif // LIBPQ_HAS_PIPELINING
+
+std::vector<pipeline_result> execute_pipeline(psql_handler& frontend, const std::vector<pipeline_statement>& statements) {
+    auto results = std::vector<pipeline_result>(statements.size());
+#ifdef LIBPQ_HAS_PIPELINING
+    (void) frontend;
+    if (is_connection_bad()) {
+        reset_database_connection();
+    }
+    apply_statement_timeout(0);
+    // statements are sent in nonblocking mode and received results are read
+    // between the sends, so neither side can block on a full socket buffer
+    if (0 != PQsetnonblocking(conn, 1) || 1 != PQenterPipelineMode(conn)) {
+        auto error = std::string(PQerrorMessage(conn));
+        PQsetnonblocking(conn, 0);
+        throw support::exception(TRACEMSG("Cannot enter pipeline mode, error: [" + error + "]"));
+    }
+    auto pending = std::deque<size_t>();
+    int stage = 0;
+    try {
+        trace_span span{"execute"};
+        const int text_format = 0;
+        for (size_t i = 0; i < statements.size(); i++) {
+            try {
+                trace_span bspan{"bind"};
+                binds.reset();
+                parse_query(statements[i].sql, binds.names, binds.query);
+                setup_params_from_json(binds, statements[i].params, binds.names);
+                prepare_params(binds, binds.names);
+            } catch (const std::exception& e) {
+                results[i].error = e.what();
+                continue;
+            }
+            // parameters are copied into the output buffer
+            int params_count = static_cast<int>(binds.types.size());
+            if (!PQsendQueryParams(conn, binds.query.c_str(), params_count, binds.types.data(),
+                    binds.values.data(), binds.lengths.data(), binds.formats.data(), text_format) ||
+                    !PQpipelineSync(conn)) {
+                throw support::exception(TRACEMSG("Cannot send pipelined statement," +
+                        " error: [" + std::string(PQerrorMessage(conn)) + "]"));
+            }
+            pending.push_back(i);
+            // output buffer holds at most one statement
+            for (int flushed = PQflush(conn); 0 != flushed; flushed = PQflush(conn)) {
+                if (flushed < 0) throw support::exception(TRACEMSG("Cannot send pipelined statement," +
+                        " error: [" + std::string(PQerrorMessage(conn)) + "]"));
+                wait_socket(true);
+                read_pipeline_results(pending, stage, results);
+            }
+            read_pipeline_results(pending, stage, results);
+        }
+        while (!pending.empty()) {
+            wait_socket(false);
+            read_pipeline_results(pending, stage, results);
+        }
+        if (1 != PQexitPipelineMode(conn) || 0 != PQsetnonblocking(conn, 0)) throw support::exception(TRACEMSG(
+                "Cannot exit pipeline mode, error: [" + std::string(PQerrorMessage(conn)) + "]"));
+    } catch (const std::exception& e) {
+        // statements that were not sent or not read are reported as failed
+        reset_database_connection();
+        for (size_t i = 0; i < statements.size(); i++) {
+            if (results[i].error.empty() && sl::json::type::nullt == results[i].result.json_type()) {
+                results[i].error = std::string("Pipeline failed: ") + e.what();
+            }
+        }
+    }
+#else // !LIBPQ_HAS_PIPELINING
+    for (size_t i = 0; i < statements.size(); i++) {
+        try {
+            auto options = execution_options(false, 0);
+            results[i].result = execute_with_parameters(frontend, statements[i].sql, statements[i].params, options);
+        } catch (const std::exception& e) {
+            results[i].error = e.what();
+        }
+    }
+#endif // LIBPQ_HAS_PIPELINING
+    return results;
+}
+
+static bool is_retryable_sqlstate(const std::string& sqlstate) {
+    return "40001" == sqlstate || // serialization_failure
+            "40P01" == sqlstate; // deadlock_detected
+}
+
+void rollback_quietly() {
+    if (nullptr == conn || PQTRANS_IDLE == PQtransactionStatus(conn)) {
+        return;
+    }
+    try {
+        execute_hardcode_statement(conn, "ROLLBACK", "Cannot rollback transaction.");
+    } catch (const std::exception&) {
+        clear_result();
+    }
+}
+
+void backoff_sleep(uint32_t attempt, const transaction_retry_options& retry) {
+    // exponential backoff with full jitter
+    uint64_t delay = static_cast<uint64_t>(retry.base_delay_millis) << std::min(attempt, 20u);
+    delay = std::min(delay, static_cast<uint64_t>(retry.max_delay_millis));
+    std::uniform_int_distribution<uint64_t> dist(0, delay);
+    std::this_thread::sleep_for(std::chrono::milliseconds(dist(backoff_rng)));
+}
+
+sl::json::value run_in_transaction(psql_handler& frontend, const std::vector<transaction_statement>& statements,
+        const transaction_retry_options& retry) {
+    if (PQTRANS_IDLE != PQtransactionStatus(conn)) throw support::exception(TRACEMSG(
+            "Cannot run statements in a new transaction, connection is already in transaction"));
+    for (uint32_t attempt = 0; ; attempt++) {
+        last_sqlstate.clear();
+        try {
+            begin_transaction();
+            std::vector<sl::json::value> results;
+            for (auto& st : statements) {
+                auto options = execution_options(st.cache_flag, 0);
+                results.emplace_back(execute_with_parameters(frontend, st.sql, st.params, options));
+            }
+            execute_hardcode_statement(conn, "COMMIT", "Cannot commit transaction.");
+            return sl::json::value({
+                { "results", std::move(results) },
+                { "retries", static_cast<int64_t>(attempt) }
+            });
+        } catch (const std::exception& e) {
+            clear_result();
+            auto sqlstate = last_sqlstate;
+            rollback_quietly();
+            if (!is_retryable_sqlstate(sqlstate)) {
+                throw;
+            }
+            if (attempt >= retry.max_retries) {
+                transaction_retries_exhausted += 1;
+                throw support::exception(TRACEMSG(e.what() + "\nTransaction retries exhausted," +
+                        " attempts: [" + sl::support::to_string(attempt + 1) + "]"));
+            }
+            transaction_retries += 1;
+            backoff_sleep(attempt, retry);
+        }
+    }
+}
+
+// large objects can only be accessed inside a transaction
+template<typename Func>
+auto with_lo_transaction(Func fun) -> decltype(fun()) {
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Cannot access large object, connection is not open"));
+    bool own_transaction = PQTRANS_IDLE == PQtransactionStatus(conn);
+    if (own_transaction) {
+        begin_transaction();
+    }
+    try {
+        auto res = fun();
+        if (own_transaction) {
+            execute_hardcode_statement(conn, "COMMIT", "Cannot commit transaction.");
+        }
+        return res;
+    } catch (...) {
+        if (own_transaction) {
+            rollback_quietly();
+        }
+        throw;
+    }
+}
+
+support::exception lo_error(const std::string& message, Oid oid) {
+    last_error = PQerrorMessage(conn);
+    return support::exception(TRACEMSG(message + " oid: [" + sl::support::to_string(oid) + "]," +
+            " error: [" + last_error + "]"));
+}
+
+int lo_open_at(Oid oid, int mode, int64_t offset) {
+    int fd = lo_open(conn, oid, mode);
+    if (fd < 0) throw lo_error("Cannot open large object,", oid);
+    if (offset > 0 && lo_lseek64(conn, fd, offset, SEEK_SET) < 0) {
+        auto err = lo_error("Cannot seek large object, offset: [" + sl::support::to_string(offset) + "],", oid);
+        lo_close(conn, fd);
+        throw err;
+    }
+    return fd;
+}
+
+uint32_t lo_import_file(psql_handler&, const std::string& path) {
+    return with_lo_transaction([this, &path] {
+        Oid oid = lo_import(conn, path.c_str());
+        if (InvalidOid == oid) throw lo_error("Cannot import large object, path: [" + path + "],", oid);
+        return static_cast<uint32_t>(oid);
+    });
+}
+
+void lo_export_file(psql_handler&, uint32_t oid, const std::string& path) {
+    with_lo_transaction([this, oid, &path] {
+        if (lo_export(conn, oid, path.c_str()) < 0) throw lo_error(
+                "Cannot export large object, path: [" + path + "],", oid);
+        return true;
+    });
+}
+
+uint32_t lo_create_object(psql_handler&) {
+    return with_lo_transaction([this] {
+        Oid oid = lo_creat(conn, INV_READ | INV_WRITE);
+        if (InvalidOid == oid) throw lo_error("Cannot create large object,", oid);
+        return static_cast<uint32_t>(oid);
+    });
+}
+
+void lo_unlink_object(psql_handler&, uint32_t oid) {
+    with_lo_transaction([this, oid] {
+        if (lo_unlink(conn, oid) < 0) throw lo_error("Cannot unlink large object,", oid);
+        return true;
+    });
+}
+
+std::string lo_read_chunk(psql_handler&, uint32_t oid, int64_t offset, uint32_t length) {
+    return with_lo_transaction([this, oid, offset, length] {
+        if (length > lo_max_read_length) throw support::exception(TRACEMSG(
+                "Invalid large object read length: [" + sl::support::to_string(length) + "]," +
+                " max length: [" + sl::support::to_string(lo_max_read_length) + "]"));
+        int fd = lo_open_at(oid, INV_READ, offset);
+        // buffer grows with the data read, reads past the end of the object do not allocate
+        auto res = std::string();
+        while (res.length() < length) {
+            size_t read = res.length();
+            size_t chunk = std::min(static_cast<size_t>(length) - read, static_cast<size_t>(1 << 20));
+            res.resize(read + chunk);
+            int count = lo_read(conn, fd, std::addressof(res.front()) + read, chunk);
+            if (count < 0) {
+                auto err = lo_error("Cannot read large object,", oid);
+                lo_close(conn, fd);
+                throw err;
+            }
+            res.resize(read + static_cast<size_t>(count));
+            if (0 == count) break;
+        }
+        lo_close(conn, fd);
+        return res;
+    });
+}
+
+void lo_write_chunk(psql_handler&, uint32_t oid, int64_t offset, const std::string& data) {
+    with_lo_transaction([this, oid, offset, &data] {
+        int fd = lo_open_at(oid, INV_WRITE, offset);
+        size_t written = 0;
+        while (written < data.length()) {
+            size_t chunk = std::min(data.length() - written, static_cast<size_t>(1 << 20));
+            int count = lo_write(conn, fd, data.data() + written, chunk);
+            if (count <= 0) {
+                auto err = lo_error("Cannot write large object,", oid);
+                lo_close(conn, fd);
+                throw err;
+            }
+            written += static_cast<size_t>(count);
+        }
+        lo_close(conn, fd);
+        return true;
+    });
+}
+
+void set_result_limits(psql_handler&, const result_limits& limits) {
+    default_limits = limits;
+}
+
+// approximate, only the string data is counted
+uint64_t get_statements_bytes() {
+    uint64_t bytes = 0;
+    for (auto& en : queries_cache) {
+        bytes += en.first.capacity() + en.second.capacity();
+    }
+    for (auto& en : prepared_names) {
+        bytes += en.first.capacity();
+        for (auto& name : en.second) {
+            bytes += name.capacity();
+        }
+    }
+    for (auto& en : catalog) {
+        bytes += en.first.capacity() + en.second.capacity();
+    }
+    return bytes;
+}
+
+uint64_t get_bind_buffers_bytes() {
+    uint64_t bytes = binds.query.capacity();
+    for (auto& val : binds.vals) {
+        bytes += sizeof(val) + val.value.capacity() + val.parameter_name.capacity();
+    }
+    bytes += binds.types.capacity() * sizeof(Oid) + binds.values.capacity() * sizeof(const char*) +
+            (binds.lengths.capacity() + binds.formats.capacity()) * sizeof(int);
+    return bytes;
+}
+
+sl::json::value get_stats(psql_handler&) {
+    return sl::json::value({
+        { "transactionRetries", static_cast<int64_t>(transaction_retries) },
+        { "transactionRetriesExhausted", static_cast<int64_t>(transaction_retries_exhausted) },
+        { "preparedStatements", static_cast<int64_t>(queries_cache.size()) },
+        { "statementsBytes", static_cast<int64_t>(get_statements_bytes()) },
+        { "bindBuffersBytes", static_cast<int64_t>(get_bind_buffers_bytes()) },
+        { "lastResultBytes", static_cast<int64_t>(last_result_bytes) },
+        { "peakResultBytes", static_cast<int64_t>(peak_result_bytes) },
+        { "resultLimitAborts", static_cast<int64_t>(result_limit_aborts) },
+        { "maxRows", static_cast<int64_t>(default_limits.max_rows) },
+        { "maxResultBytes", static_cast<int64_t>(default_limits.max_bytes) }
+    });
 }
 
 std::string get_last_error(psql_handler&) {
@@ -929,6 +2329,25 @@ PIMPL_FORWARD_METHOD(psql_handler, void, begin, (), (), support::exception);
 PIMPL_FORWARD_METHOD(psql_handler, void, commit, (), (), support::exception);
 PIMPL_FORWARD_METHOD(psql_handler, void, rollback, (), (), support::exception);
 PIMPL_FORWARD_METHOD(psql_handler, sl::json::value, execute_with_parameters, (const std::string&)(const staticlib::json::value&)(int), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, sl::json::value, execute_with_parameters, (const std::string&)(const staticlib::json::value&)(const execution_options&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, std::string, execute_with_parameters_as_msgpack, (const std::string&)(const staticlib::json::value&)(const execution_options&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, std::string, execute_with_parameters_as_json_text, (const std::string&)(const staticlib::json::value&)(const execution_options&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, sl::json::value, execute_to_file, (const std::string&)(const staticlib::json::value&)(const execution_options&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, std::vector<pipeline_result>, execute_pipeline, (const std::vector<pipeline_statement>&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, void, cancel, (), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, std::shared_ptr<PGcancel>, get_cancel_handle, (), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, bool, is_broken, (), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, sl::json::value, run_in_transaction, (const std::vector<transaction_statement>&)(const transaction_retry_options&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, void, set_result_limits, (const result_limits&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, sl::json::value, get_stats, (), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, void, load_catalog, (const sl::json::value&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, std::string, get_catalog_sql, (const std::string&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, uint32_t, lo_import_file, (const std::string&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, void, lo_export_file, (uint32_t)(const std::string&), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, uint32_t, lo_create_object, (), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, void, lo_unlink_object, (uint32_t), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, std::string, lo_read_chunk, (uint32_t)(int64_t)(uint32_t), (), support::exception);
+PIMPL_FORWARD_METHOD(psql_handler, void, lo_write_chunk, (uint32_t)(int64_t)(const std::string&), (), support::exception);
 PIMPL_FORWARD_METHOD(psql_handler, std::string, get_last_error, (), (), support::exception);
 
 } // pgsql
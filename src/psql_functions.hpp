@@ -16,6 +16,8 @@
 #ifndef PSQL_FUNCTIONS_HPP
 #define PSQL_FUNCTIONS_HPP
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -28,6 +30,8 @@
 #include <staticlib/json.hpp>
 #include <staticlib/utils/random_string_generator.hpp>
 
+#include "msgpack_encoding.hpp"
+
 namespace wilton{
 namespace db{
 namespace pgsql{
@@ -47,30 +51,264 @@ struct parameters_values {
     format(format) { }
 };
 
-struct column_property {
-    std::string name;
-    Oid type_id;
-    std::string value;
+/**
+ * Binding state for a single statement, kept by the connection and reset
+ * before each call, so strings and vectors keep their capacity between calls
+ */
+struct bind_buffers {
+    // elements after 'vals_count' are not used, their strings are reused
+    std::vector<parameters_values> vals;
+    size_t vals_count = 0;
+    std::vector<Oid> types;
+    std::vector<const char*> values;
+    std::vector<int> lengths;
+    std::vector<int> formats;
+    // parse_query output for not cached statements
+    std::vector<std::string> names;
+    std::string query;
+
+    void reset() {
+        vals_count = 0;
+        types.clear();
+        values.clear();
+        lengths.clear();
+        formats.clear();
+        names.clear();
+        query.clear();
+    }
+
+    parameters_values& next_value() {
+        if (vals.size() == vals_count) {
+            vals.emplace_back("", "", 0, 0, 0);
+        }
+        vals_count += 1;
+        return vals[vals_count - 1];
+    }
+};
+
+/**
+ * Query is cancelled as soon as its result grows over the limit, 0 - no limit
+ */
+struct result_limits {
+    uint64_t max_rows = 0;
+    uint64_t max_bytes = 0;
+
+    bool enabled() const {
+        return max_rows > 0 || max_bytes > 0;
+    }
+};
+
+// rows are streamed to the columnar file instead of being returned
+struct result_sink {
+    std::string file;
+    uint32_t block_rows = 65536;
+
+    bool enabled() const {
+        return !file.empty();
+    }
+};
+
+struct execution_options {
+    int cache_flag;
+    uint32_t timeout_millis; // 0 - no timeout
+    result_encoding encoding;
+    // connection limits are used when not specified
+    result_limits limits;
+    result_sink sink;
 
-    column_property(std::string in_name, Oid in_type_id, std::string in_value) :
-    name(in_name),
-    type_id(in_type_id),
-    value(in_value) { }
+    execution_options(int cache_flag, uint32_t timeout_millis,
+            result_encoding encoding = result_encoding::json) :
+    cache_flag(cache_flag),
+    timeout_millis(timeout_millis),
+    encoding(encoding) { }
 };
 
-class row {
-    // properties
-    std::vector<column_property> properties;
-    void add_column_property(std::string in_name, Oid in_type_id, std::string in_value);
-    sl::json::value get_value_as_json(size_t value_pos);
+struct transaction_statement {
+    std::string sql;
+    sl::json::value params;
+    int cache_flag;
+
+    transaction_statement(std::string sql, sl::json::value params, int cache_flag) :
+    sql(std::move(sql)),
+    params(std::move(params)),
+    cache_flag(cache_flag) { }
+};
+
+// statements from different callers sent in one pipeline
+struct pipeline_statement {
+    const std::string& sql;
+    const sl::json::value& params;
+
+    pipeline_statement(const std::string& sql, const sl::json::value& params) :
+    sql(sql),
+    params(params) { }
+};
+
+struct pipeline_result {
+    sl::json::value result;
+    // empty on success
+    std::string error;
+};
+
+struct transaction_retry_options {
+    uint32_t max_retries;
+    uint32_t base_delay_millis;
+    uint32_t max_delay_millis;
+
+    transaction_retry_options(uint32_t max_retries, uint32_t base_delay_millis, uint32_t max_delay_millis) :
+    max_retries(max_retries),
+    base_delay_millis(base_delay_millis),
+    max_delay_millis(max_delay_millis) { }
+};
+
+// single large object read cannot be longer than 8 MiB
+const uint32_t lo_max_read_length = 8 * 1024 * 1024;
+
+/**
+ * Sends cancel request for the statement running on the connection the handle
+ * was taken from, can be called from any thread without holding other locks
+ */
+void send_cancel_request(const std::shared_ptr<PGcancel>& handle);
+
+// parameters binding and results decoding, used by psql_handler
+
+/**
+ * Array parameter type from all its elements: int4[] (or int8[] if any value
+ * does not fit), float8[], bool[], text[] or jsonb[], null elements are skipped,
+ * arrays of mixed types are passed as text[]
+ */
+Oid get_json_array_type(const sl::json::value& json_value);
+
+/**
+ * Decodes bytea hex format, "\\x" prefix is optional
+ */
+std::string decode_bytea_hex(const std::string& hex);
+
+/**
+ * Encodes binary data into bytea hex format ("\\x0102")
+ */
+std::string encode_bytea_hex(const char* data, size_t len);
+
+/**
+ * Appends array in PostgreSQL text format ('{1,NULL,"foo"}') to 'out'
+ */
+void write_array_literal(const sl::json::value& json_value, std::string& out);
+
+/**
+ * Writes type, value, length and format of the parameter into 'out',
+ * existing value string is reused
+ */
+void write_json_param_value(const sl::json::value& json_value, parameters_values& out);
+
+parameters_values get_json_params_values(const sl::json::value& json_value);
+
+void setup_params_from_json(
+        bind_buffers& binds,
+        const staticlib::json::value& parameters,
+        const std::vector<std::string>& names);
+
+void prepare_params(
+        bind_buffers& binds,
+        const std::vector<std::string>& names);
 
+/**
+ * Replaces named parameters with positional ones, writes result into 'query'
+ */
+void parse_query(const std::string& sql_query, std::vector<std::string>& last_prepared_names,
+        std::string& query);
+
+std::string parse_query(const std::string& sql_query, std::vector<std::string>& last_prepared_names);
+
+/**
+ * Column names and value decoders resolved once for the result,
+ * rows are decoded with a loop over the columns without switching on the type
+ * of every cell, NULL cells are handled by the loop and are never passed to decoders
+ */
+class result_plan {
 public:
-    ~row();
+    typedef sl::json::value(*json_decoder)(Oid type_id, const char* val, size_t len, std::string& cell);
+    typedef void(*msgpack_encoder)(Oid type_id, const char* val, size_t len, msgpack_writer& writer, std::string& cell);
+    typedef void(*text_encoder)(Oid type_id, const char* val, size_t len, std::string& out, std::string& cell);
 
-    row(PGresult *res, int row_pos);
-    sl::json::value dump_to_json();
+    struct column {
+        std::string name;
+        // escaped "name": with a comma before all columns but the first one
+        std::string text_key;
+        Oid type_id;
+        json_decoder to_json;
+        msgpack_encoder to_msgpack;
+        text_encoder to_text;
+    };
+
+private:
+    std::vector<column> columns;
+
+public:
+    result_plan() { }
+
+    explicit result_plan(PGresult* res);
+
+    bool empty() const {
+        return columns.empty();
+    }
+
+    const std::vector<column>& get_columns() const {
+        return columns;
+    }
 };
 
+/**
+ * Decodes rows into JSON objects, can be called for every result
+ * in single-row mode, the plan is built from the first one
+ */
+class json_rows_decoder {
+    result_plan plan;
+    std::string cell;
+
+public:
+    void append_rows(PGresult* res, std::vector<sl::json::value>& out);
+
+    void append_rows(PGresult* res, int begin, int end, std::vector<sl::json::value>& out);
+};
+
+sl::json::value get_result_as_json(PGresult *res);
+
+/**
+ * Sum of the lengths of all values in the result
+ */
+uint64_t get_result_data_bytes(PGresult* res);
+
+/**
+ * Array values are rewritten in place
+ */
+sl::json::value decode_column_value(Oid type_id, std::string& val);
+
+sl::json::value column_value_as_json(Oid type_id, std::string val);
+
+void write_result_as_msgpack(PGresult* res, std::string& out);
+
+/**
+ * Writes rows as MessagePack maps, without the array header
+ */
+void write_rows_as_msgpack(PGresult* res, const result_plan& plan, int begin, int end,
+        msgpack_writer& writer, std::string& cell);
+
+/**
+ * Writes the result as compact JSON text, same values as 'get_result_as_json'
+ * but without building the JSON tree, numbers are copied as returned by the server
+ */
+void write_result_as_json_text(PGresult* res, std::string& out);
+
+/**
+ * Writes rows as JSON objects, each object is followed by a comma
+ */
+void write_rows_as_json_text(PGresult* res, const result_plan& plan, int begin, int end,
+        std::string& out, std::string& cell);
+
+void prepare_text_array(std::string& val);
+
+sl::json::value prepare_json_array(std::string& val);
+
 class psql_handler : public sl::pimpl::object  {
 protected:
     /**
@@ -95,6 +333,80 @@ public:
 
     staticlib::json::value execute_with_parameters(const std::string& sql_statement, const staticlib::json::value& parameters, int cache_flag);
 
+    staticlib::json::value execute_with_parameters(const std::string& sql_statement, const staticlib::json::value& parameters,
+            const execution_options& options);
+
+    std::string execute_with_parameters_as_msgpack(const std::string& sql_statement, const staticlib::json::value& parameters,
+            const execution_options& options);
+
+    std::string execute_with_parameters_as_json_text(const std::string& sql_statement, const staticlib::json::value& parameters,
+            const execution_options& options);
+
+    /**
+     * Returns file path, rows count and file size, or command status
+     */
+    staticlib::json::value execute_to_file(const std::string& sql_statement, const staticlib::json::value& parameters,
+            const execution_options& options);
+
+    /**
+     * Sends all statements at once with libpq pipeline mode, each one is synced separately, so
+     * it runs in its own implicit transaction and its failure does not affect others;
+     * statements are run one by one with libpq older than 14
+     */
+    std::vector<pipeline_result> execute_pipeline(const std::vector<pipeline_statement>& statements);
+
+    void cancel();
+
+    /**
+     * Cancel request data for the current backend, stays valid after
+     * the connection is reset or closed, null if connection is not open
+     */
+    std::shared_ptr<PGcancel> get_cancel_handle();
+
+    /**
+     * Connection is not open or is lost, it is reset on the next statement
+     */
+    bool is_broken();
+
+    /**
+     * Runs statements in a single transaction, whole transaction is retried
+     * on serialization failures and deadlocks
+     */
+    staticlib::json::value run_in_transaction(const std::vector<transaction_statement>& statements,
+            const transaction_retry_options& retry);
+
+    /**
+     * Default limits for the statements on this connection, statements with
+     * limits are executed in single-row mode
+     */
+    void set_result_limits(const result_limits& limits);
+
+    staticlib::json::value get_stats();
+
+    /**
+     * Prepares named statements from {name: sql} object, statements are
+     * prepared again after connection reset
+     */
+    void load_catalog(const staticlib::json::value& statements);
+
+    std::string get_catalog_sql(const std::string& name);
+
+    /**
+     * Large objects, file paths are local to the client, data is transferred
+     * in binary, operations run in own transaction if connection is idle
+     */
+    uint32_t lo_import_file(const std::string& path);
+
+    void lo_export_file(uint32_t oid, const std::string& path);
+
+    uint32_t lo_create_object();
+
+    void lo_unlink_object(uint32_t oid);
+
+    std::string lo_read_chunk(uint32_t oid, int64_t offset, uint32_t length);
+
+    void lo_write_chunk(uint32_t oid, int64_t offset, const std::string& data);
+
     std::string get_last_error();
 };
 
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sqlite_options.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+const std::string sqlite_prefix = "sqlite://";
+
+std::string to_upper(const std::string& str) {
+    auto res = std::string(str);
+    std::transform(res.begin(), res.end(), res.begin(), [](char ch) {
+        return static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    });
+    return res;
+}
+
+std::string check_integer(const std::string& name, const std::string& value) {
+    size_t start = (value.length() > 0 && '-' == value[0]) ? 1 : 0;
+    bool valid = value.length() > start && value.length() <= 20 &&
+            std::all_of(value.begin() + start, value.end(), [](char ch) {
+                return ch >= '0' && ch <= '9';
+            });
+    if (!valid) throw support::exception(TRACEMSG(
+            "Invalid integer value specified for SQLite option: [" + name + "], value: [" + value + "]"));
+    return value;
+}
+
+std::string check_enum(const std::string& name, const std::string& value,
+        const std::vector<std::string>& allowed) {
+    auto upper = to_upper(value);
+    if (allowed.end() == std::find(allowed.begin(), allowed.end(), upper)) {
+        auto list = std::string();
+        for (auto& en : allowed) {
+            list += list.empty() ? en : ", " + en;
+        }
+        throw support::exception(TRACEMSG(
+                "Invalid value specified for SQLite option: [" + name + "], value: [" + value + "]," +
+                " supported values: [" + list + "]"));
+    }
+    return upper;
+}
+
+bool check_bool(const std::string& name, const std::string& value) {
+    if ("true" == value || "1" == value) {
+        return true;
+    } else if ("false" == value || "0" == value) {
+        return false;
+    }
+    throw support::exception(TRACEMSG(
+            "Invalid boolean value specified for SQLite option: [" + name + "], value: [" + value + "]"));
+}
+
+std::string json_option_value(const sl::json::field& fi) {
+    switch (fi.json_type()) {
+    case sl::json::type::string:
+        return fi.val().as_string();
+    case sl::json::type::integer:
+        return sl::support::to_string(fi.val().as_int64());
+    case sl::json::type::boolean:
+        return fi.val().as_bool() ? "true" : "false";
+    default:
+        throw support::exception(TRACEMSG(
+                "Invalid value type specified for SQLite option: [" + fi.name() + "]"));
+    }
+}
+
+} // namespace
+
+void sqlite_options::set(const std::string& name, const std::string& value) {
+    if ("busy_timeout" == name || "busyTimeout" == name) {
+        busy_timeout = check_integer(name, value);
+    } else if ("journal_mode" == name || "journalMode" == name) {
+        journal_mode = check_enum(name, value, {"DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF"});
+    } else if ("synchronous" == name) {
+        synchronous = check_enum(name, value, {"OFF", "NORMAL", "FULL", "EXTRA", "0", "1", "2", "3"});
+    } else if ("cache_size" == name || "cacheSize" == name) {
+        cache_size = check_integer(name, value);
+    } else if ("mmap_size" == name || "mmapSize" == name) {
+        mmap_size = check_integer(name, value);
+    } else if ("temp_store" == name || "tempStore" == name) {
+        temp_store = check_enum(name, value, {"DEFAULT", "FILE", "MEMORY", "0", "1", "2"});
+    } else if ("read_only" == name || "readOnly" == name) {
+        read_only = check_bool(name, value);
+    } else {
+        throw support::exception(TRACEMSG("Unknown SQLite option: [" + name + "]"));
+    }
+}
+
+std::vector<std::string> sqlite_options::pragmas() const {
+    auto res = std::vector<std::string>();
+    if (!busy_timeout.empty()) {
+        res.emplace_back("PRAGMA busy_timeout = " + busy_timeout);
+    }
+    if (!journal_mode.empty()) {
+        res.emplace_back("PRAGMA journal_mode = " + journal_mode);
+    }
+    if (!synchronous.empty()) {
+        res.emplace_back("PRAGMA synchronous = " + synchronous);
+    }
+    if (!cache_size.empty()) {
+        res.emplace_back("PRAGMA cache_size = " + cache_size);
+    }
+    if (!mmap_size.empty()) {
+        res.emplace_back("PRAGMA mmap_size = " + mmap_size);
+    }
+    if (!temp_store.empty()) {
+        res.emplace_back("PRAGMA temp_store = " + temp_store);
+    }
+    // last one, journal mode switch above writes to the database
+    if (read_only) {
+        res.emplace_back("PRAGMA query_only = 1");
+    }
+    return res;
+}
+
+orm_url parse_orm_url(const std::string& url) {
+    auto res = orm_url();
+    auto qmark = url.find('?');
+    if (0 != url.compare(0, sqlite_prefix.length(), sqlite_prefix) || std::string::npos == qmark) {
+        res.url = url;
+        return res;
+    }
+    res.url = url.substr(0, qmark);
+    auto query = url.substr(qmark + 1);
+    size_t pos = 0;
+    while (pos < query.length()) {
+        auto amp = query.find('&', pos);
+        if (std::string::npos == amp) {
+            amp = query.length();
+        }
+        auto pair = query.substr(pos, amp - pos);
+        pos = amp + 1;
+        if (pair.empty()) {
+            continue;
+        }
+        auto eq = pair.find('=');
+        if (std::string::npos == eq) throw support::exception(TRACEMSG(
+                "Invalid SQLite option specified, expected 'name=value', got: [" + pair + "]"));
+        res.sqlite.set(pair.substr(0, eq), pair.substr(eq + 1));
+    }
+    return res;
+}
+
+orm_url parse_orm_url_json(const sl::json::value& json) {
+    auto url = std::string();
+    const sl::json::value* sqlite = nullptr;
+    for (const sl::json::field& fi : json.as_object_or_throw("db_connection_open")) {
+        auto& name = fi.name();
+        if ("url" == name) {
+            url = fi.as_string_nonempty_or_throw(name);
+        } else if ("sqlite" == name) {
+            sqlite = std::addressof(fi.val());
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (url.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'url' not specified"));
+    auto res = parse_orm_url(url);
+    if (nullptr != sqlite) {
+        if (0 != res.url.compare(0, sqlite_prefix.length(), sqlite_prefix)) throw support::exception(TRACEMSG(
+                "Parameter 'sqlite' can only be specified for 'sqlite://' URLs, url: [" + url + "]"));
+        for (const sl::json::field& fi : sqlite->as_object_or_throw("sqlite")) {
+            res.sqlite.set(fi.name(), json_option_value(fi));
+        }
+    }
+    return res;
+}
+
+} // namespace
+}
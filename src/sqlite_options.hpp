@@ -0,0 +1,80 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   sqlite_options.hpp
+ * Author: alex
+ *
+ * SQLite tuning options, applied as PRAGMA statements when connection is opened.
+ */
+
+#ifndef WILTON_DB_SQLITE_OPTIONS_HPP
+#define WILTON_DB_SQLITE_OPTIONS_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "staticlib/json.hpp"
+
+namespace wilton {
+namespace db {
+
+struct sqlite_options {
+    // empty values are not applied
+    std::string busy_timeout;
+    std::string journal_mode;
+    std::string synchronous;
+    std::string cache_size;
+    std::string mmap_size;
+    std::string temp_store;
+    bool read_only = false;
+
+    /**
+     * Sets option by its URL query name ("journal_mode") or JSON name ("journalMode"),
+     * values are validated, because PRAGMA values cannot be bound as parameters
+     */
+    void set(const std::string& name, const std::string& value);
+
+    /**
+     * PRAGMA statements in the order they need to be applied,
+     * busy_timeout goes first so journal mode switch can wait for locks
+     */
+    std::vector<std::string> pragmas() const;
+};
+
+struct orm_url {
+    // URL without query part, passed to sl::orm
+    std::string url;
+    sqlite_options sqlite;
+};
+
+/**
+ * Splits "sqlite://path/to/file.db?journal_mode=WAL&synchronous=NORMAL"
+ * into URL and options, query part is only recognized for "sqlite://" URLs
+ */
+orm_url parse_orm_url(const std::string& url);
+
+/**
+ * Parses {"url": "...", "sqlite": {"journalMode": "WAL", ..}} open options,
+ * options specified in JSON override ones from the URL query
+ */
+orm_url parse_orm_url_json(const sl::json::value& json);
+
+} // namespace
+}
+
+#endif /* WILTON_DB_SQLITE_OPTIONS_HPP */
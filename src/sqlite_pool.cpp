@@ -0,0 +1,162 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sqlite_pool.hpp"
+
+#include <cctype>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+#include "wilton/support/logging.hpp"
+#include "wilton/support/misc.hpp"
+
+#include "wilton_db_internal.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+const std::string logger = std::string("wilton.DBPool");
+
+} // namespace
+
+bool is_read_statement(const std::string& sql) {
+    size_t pos = 0;
+    size_t len = sql.length();
+    // skip whitespace, comments and opening parens
+    while (pos < len) {
+        char ch = sql[pos];
+        if (std::isspace(static_cast<unsigned char>(ch)) || '(' == ch) {
+            pos += 1;
+        } else if ('-' == ch && pos + 1 < len && '-' == sql[pos + 1]) {
+            auto eol = sql.find('\n', pos);
+            pos = std::string::npos != eol ? eol + 1 : len;
+        } else if ('/' == ch && pos + 1 < len && '*' == sql[pos + 1]) {
+            auto end = sql.find("*/", pos + 2);
+            pos = std::string::npos != end ? end + 2 : len;
+        } else {
+            break;
+        }
+    }
+    auto keyword = std::string();
+    while (pos < len && std::isalpha(static_cast<unsigned char>(sql[pos]))) {
+        keyword.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(sql[pos]))));
+        pos += 1;
+    }
+    return "SELECT" == keyword || "VALUES" == keyword || "WITH" == keyword;
+}
+
+sqlite_pool::sqlite_pool(const orm_url& url, uint32_t readers_count) {
+    if (0 != url.url.compare(0, 9, "sqlite://")) throw support::exception(TRACEMSG(
+            "SQLite pool can only be opened for 'sqlite://' URLs, url: [" + url.url + "]"));
+    if (0 == readers_count) throw support::exception(TRACEMSG(
+            "Invalid readers count specified: [0]"));
+    // every connection would open its own empty database
+    if (std::string::npos != url.url.find(":memory:")) throw support::exception(TRACEMSG(
+            "SQLite pool cannot be opened for in-memory database, url: [" + url.url + "]"));
+    auto writer_url = url;
+    if (writer_url.sqlite.journal_mode.empty()) {
+        writer_url.sqlite.journal_mode = "WAL";
+    }
+    // journal mode is persistent in WAL mode, and readers cannot change it
+    auto reader_url = url;
+    reader_url.sqlite.journal_mode.clear();
+    reader_url.sqlite.read_only = true;
+    try {
+        writer = orm_open(writer_url);
+        for (uint32_t i = 0; i < readers_count; i++) {
+            all_readers.push_back(orm_open(reader_url));
+        }
+    } catch (...) {
+        close_all();
+        throw;
+    }
+    idle_readers = all_readers;
+    wilton::support::log_debug(logger, "SQLite pool opened, URL: [" + url.url + "]," +
+            " readers: [" + sl::support::to_string(readers_count) + "]");
+}
+
+sqlite_pool::~sqlite_pool() STATICLIB_NOEXCEPT {
+    close_all();
+}
+
+support::buffer sqlite_pool::query(const std::string& sql, const sl::json::value& params,
+        result_encoding encoding) {
+    if (is_read_statement(sql)) {
+        auto conn = acquire_reader();
+        try {
+            auto res = orm_query(conn, sql, params, encoding);
+            release_reader(conn);
+            return res;
+        } catch (...) {
+            release_reader(conn);
+            throw;
+        }
+    }
+    std::lock_guard<std::mutex> guard{writer_mutex};
+    return orm_query(writer, sql, params, encoding);
+}
+
+void sqlite_pool::execute(const std::string& sql, const sl::json::value& params) {
+    std::lock_guard<std::mutex> guard{writer_mutex};
+    orm_execute(writer, sql, params);
+}
+
+uint64_t sqlite_pool::execute_batch(const std::string& sql, const std::vector<sl::json::value>& params_list) {
+    std::lock_guard<std::mutex> guard{writer_mutex};
+    return orm_execute_batch(writer, sql, params_list);
+}
+
+wilton_DBConnection* sqlite_pool::acquire_reader() {
+    std::unique_lock<std::mutex> guard{readers_mutex};
+    readers_cv.wait(guard, [this] {
+        return !idle_readers.empty();
+    });
+    auto conn = idle_readers.back();
+    idle_readers.pop_back();
+    return conn;
+}
+
+void sqlite_pool::release_reader(wilton_DBConnection* conn) {
+    {
+        std::lock_guard<std::mutex> guard{readers_mutex};
+        idle_readers.push_back(conn);
+    }
+    readers_cv.notify_one();
+}
+
+void sqlite_pool::close_all() STATICLIB_NOEXCEPT {
+    for (auto conn : all_readers) {
+        auto err = wilton_DBConnection_close(conn);
+        if (nullptr != err) {
+            wilton_free(err);
+        }
+    }
+    all_readers.clear();
+    idle_readers.clear();
+    if (nullptr != writer) {
+        auto err = wilton_DBConnection_close(writer);
+        if (nullptr != err) {
+            wilton_free(err);
+        }
+        writer = nullptr;
+    }
+}
+
+} // namespace
+}
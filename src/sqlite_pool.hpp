@@ -0,0 +1,94 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   sqlite_pool.hpp
+ * Author: alex
+ *
+ * SQLite WAL pool: N read-only connections and one serialized writer.
+ */
+
+#ifndef WILTON_DB_SQLITE_POOL_HPP
+#define WILTON_DB_SQLITE_POOL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "staticlib/config.hpp"
+#include "staticlib/json.hpp"
+
+#include "wilton/wilton_db.h"
+#include "wilton/support/buffer.hpp"
+
+#include "msgpack_encoding.hpp"
+#include "sqlite_options.hpp"
+
+namespace wilton {
+namespace db {
+
+/**
+ * Returns true for statements that can run on a read-only connection:
+ * SELECT, VALUES and WITH queries (leading comments are skipped)
+ */
+bool is_read_statement(const std::string& sql);
+
+/**
+ * Thread-safe, read statements are run on the idle reader connection
+ * (waiting for one if all are busy), all other statements are run
+ * on the writer connection one at a time.
+ */
+class sqlite_pool {
+    std::mutex readers_mutex;
+    std::condition_variable readers_cv;
+    std::vector<wilton_DBConnection*> idle_readers;
+    std::vector<wilton_DBConnection*> all_readers;
+    std::mutex writer_mutex;
+    wilton_DBConnection* writer = nullptr;
+
+public:
+    /**
+     * Opens writer connection (switching database to WAL mode, unless other
+     * journal mode is specified) and 'readers_count' read-only connections
+     */
+    sqlite_pool(const orm_url& url, uint32_t readers_count);
+
+    ~sqlite_pool() STATICLIB_NOEXCEPT;
+
+    sqlite_pool(const sqlite_pool&) = delete;
+
+    sqlite_pool& operator=(const sqlite_pool&) = delete;
+
+    support::buffer query(const std::string& sql, const sl::json::value& params, result_encoding encoding);
+
+    void execute(const std::string& sql, const sl::json::value& params);
+
+    uint64_t execute_batch(const std::string& sql, const std::vector<sl::json::value>& params_list);
+
+private:
+    wilton_DBConnection* acquire_reader();
+
+    void release_reader(wilton_DBConnection* conn);
+
+    void close_all() STATICLIB_NOEXCEPT;
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_SQLITE_POOL_HPP */
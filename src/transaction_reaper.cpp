@@ -0,0 +1,206 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "transaction_reaper.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "staticlib/support.hpp"
+
+#include "wilton/support/logging.hpp"
+
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+const std::string logger = std::string("wilton.DBReaper");
+
+} // namespace
+
+transaction_reaper::transaction_reaper(rollback_fun rollback) :
+rollback(std::move(rollback)),
+any_expired(false) { }
+
+transaction_reaper::~transaction_reaper() STATICLIB_NOEXCEPT {
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void transaction_reaper::set_max_age(uint32_t max_age) {
+    {
+        std::lock_guard<std::mutex> guard{mutex};
+        max_age_millis = max_age;
+        if (0 != max_age && !worker.joinable()) {
+            worker = std::thread([this] {
+                run();
+            });
+        }
+    }
+    cv.notify_all();
+}
+
+void transaction_reaper::track(bool pgsql, int64_t handle, int64_t conn_handle) {
+    auto key = key_type(pgsql, handle);
+    std::lock_guard<std::mutex> guard{mutex};
+    auto& tr = active[key];
+    tr.started = std::chrono::steady_clock::now();
+    tr.conn_handle = conn_handle;
+    expired.erase(key);
+    any_expired.store(!expired.empty());
+}
+
+void transaction_reaper::untrack(bool pgsql, int64_t handle) {
+    auto key = key_type(pgsql, handle);
+    std::lock_guard<std::mutex> guard{mutex};
+    active.erase(key);
+    expired.erase(key);
+    any_expired.store(!expired.empty());
+}
+
+void transaction_reaper::untrack_connection(bool pgsql, int64_t conn_handle) {
+    std::lock_guard<std::mutex> guard{mutex};
+    for (auto it = active.begin(); it != active.end();) {
+        if (pgsql == it->first.first && conn_handle == it->second.conn_handle) {
+            it = active.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = expired.begin(); it != expired.end();) {
+        if (pgsql == it->first.first && conn_handle == it->second) {
+            it = expired.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    any_expired.store(!expired.empty());
+}
+
+bool transaction_reaper::take_expired(bool pgsql, int64_t handle) {
+    std::lock_guard<std::mutex> guard{mutex};
+    bool erased = expired.erase(key_type(pgsql, handle)) > 0;
+    any_expired.store(!expired.empty());
+    return erased;
+}
+
+bool transaction_reaper::has_expired_on(bool pgsql, int64_t conn_handle) {
+    if (!any_expired.load()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard{mutex};
+    for (auto& pa : expired) {
+        if (pgsql == pa.first.first && conn_handle == pa.second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void transaction_reaper::mark_expired(bool pgsql, int64_t handle) {
+    auto key = key_type(pgsql, handle);
+    std::lock_guard<std::mutex> guard{mutex};
+    auto it = active.find(key);
+    // commit may have finished concurrently
+    if (active.end() == it) {
+        return;
+    }
+    expired[key] = it->second.conn_handle;
+    active.erase(it);
+    reaped_count += 1;
+    any_expired.store(true);
+}
+
+bool transaction_reaper::is_overdue(bool pgsql, int64_t handle) {
+    std::lock_guard<std::mutex> guard{mutex};
+    auto it = active.find(key_type(pgsql, handle));
+    if (active.end() == it || 0 == max_age_millis) {
+        return false;
+    }
+    return it->second.started + std::chrono::milliseconds(max_age_millis) < std::chrono::steady_clock::now();
+}
+
+sl::json::value transaction_reaper::get_stats() {
+    std::lock_guard<std::mutex> guard{mutex};
+    auto now = std::chrono::steady_clock::now();
+    int64_t oldest = 0;
+    for (auto& pa : active) {
+        auto age = std::chrono::duration_cast<std::chrono::milliseconds>(now - pa.second.started).count();
+        oldest = std::max(oldest, static_cast<int64_t>(age));
+    }
+    return sl::json::value({
+        { "maxAgeMillis", static_cast<int64_t>(max_age_millis) },
+        { "active", static_cast<int64_t>(active.size()) },
+        { "oldestAgeMillis", oldest },
+        { "reaped", static_cast<int64_t>(reaped_count) },
+        { "expiredNotCommitted", static_cast<int64_t>(expired.size()) }
+    });
+}
+
+void transaction_reaper::run() {
+    for (;;) {
+        auto candidates = std::vector<entry>();
+        {
+            std::unique_lock<std::mutex> guard{mutex};
+            // expired transactions are found at most max age / 2 late
+            auto interval = std::max(10u, std::min(1000u, max_age_millis / 2));
+            cv.wait_for(guard, std::chrono::milliseconds(interval));
+            if (stopping) {
+                return;
+            }
+            if (0 == max_age_millis) {
+                continue;
+            }
+            auto deadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(max_age_millis);
+            for (auto& pa : active) {
+                if (pa.second.started < deadline) {
+                    candidates.push_back(entry{pa.first.first, pa.first.second, pa.second.conn_handle});
+                }
+            }
+        }
+        reap(candidates);
+    }
+}
+
+void transaction_reaper::reap(const std::vector<entry>& candidates) {
+    for (auto& en : candidates) {
+        // rollback is done without the lock, it may wait for the server,
+        // successful rollback is marked as expired by the rollback function
+        try {
+            if (!rollback(en)) {
+                continue;
+            }
+        } catch (const std::exception& e) {
+            wilton::support::log_warn(logger, "Expired transaction rollback error, handle: [" +
+                    sl::support::to_string(en.handle) + "], error: [" + e.what() + "]");
+            mark_expired(en.pgsql, en.handle);
+            continue;
+        }
+        wilton::support::log_warn(logger, std::string("Expired transaction rolled back,") +
+                " type: [" + (en.pgsql ? "pgsql" : "orm") + "]," +
+                " handle: [" + sl::support::to_string(en.handle) + "]");
+    }
+}
+
+} // namespace
+}
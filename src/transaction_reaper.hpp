@@ -0,0 +1,146 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   transaction_reaper.hpp
+ * Author: alex
+ *
+ * Background rollback of transactions left open by the callers.
+ */
+
+#ifndef WILTON_DB_TRANSACTION_REAPER_HPP
+#define WILTON_DB_TRANSACTION_REAPER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "staticlib/config.hpp"
+#include "staticlib/json.hpp"
+
+namespace wilton {
+namespace db {
+
+/**
+ * Tracks start times of transactions opened with 'db_transaction_start'
+ * and 'db_pgsql_transaction_begin'. With max age set, background thread
+ * rolls back transactions older than it and flags them as expired, so
+ * the following commit fails instead of silently committing nothing,
+ * and other statements on the same connection fail until the caller
+ * commits or rolls back the expired transaction.
+ */
+class transaction_reaper {
+public:
+    struct entry {
+        bool pgsql;
+        int64_t handle;
+        // connection the transaction runs on, the same as 'handle' for pgsql
+        int64_t conn_handle;
+    };
+
+    // returns false if the transaction cannot be rolled back now (connection is used
+    // by the running call), it is retried on next check; must check 'is_overdue'
+    // after taking the connection, as the transaction may be committed and started again,
+    // and must call 'mark_expired' before the connection is released
+    typedef std::function<bool(const entry&)> rollback_fun;
+
+private:
+    typedef std::pair<bool, int64_t> key_type;
+
+    struct tracked {
+        std::chrono::steady_clock::time_point started;
+        int64_t conn_handle;
+    };
+
+    rollback_fun rollback;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<key_type, tracked> active;
+    // values are connection handles
+    std::map<key_type, int64_t> expired;
+    // checked without the lock before every statement
+    std::atomic<bool> any_expired;
+    uint32_t max_age_millis = 0;
+    uint64_t reaped_count = 0;
+    bool stopping = false;
+
+    std::thread worker;
+
+public:
+    explicit transaction_reaper(rollback_fun rollback);
+
+    ~transaction_reaper() STATICLIB_NOEXCEPT;
+
+    transaction_reaper(const transaction_reaper&) = delete;
+
+    transaction_reaper& operator=(const transaction_reaper&) = delete;
+
+    /**
+     * Zero disables reaping, background thread is started on first non-zero value
+     */
+    void set_max_age(uint32_t max_age_millis);
+
+    void track(bool pgsql, int64_t handle, int64_t conn_handle);
+
+    /**
+     * Called after commit, rollback or close, clears the expired flag too
+     */
+    void untrack(bool pgsql, int64_t handle);
+
+    /**
+     * Called after the connection is closed, clears all its transactions,
+     * so the handle can be reused by a new connection
+     */
+    void untrack_connection(bool pgsql, int64_t conn_handle);
+
+    /**
+     * Returns true (and clears the flag) if the transaction was rolled back by the reaper
+     */
+    bool take_expired(bool pgsql, int64_t handle);
+
+    /**
+     * Returns true if the connection has a transaction rolled back by the reaper,
+     * that is not yet committed or rolled back by the caller
+     */
+    bool has_expired_on(bool pgsql, int64_t conn_handle);
+
+    /**
+     * Called from the rollback function after the rollback, while the connection is still taken
+     */
+    void mark_expired(bool pgsql, int64_t handle);
+
+    bool is_overdue(bool pgsql, int64_t handle);
+
+    sl::json::value get_stats();
+
+private:
+    void run();
+
+    void reap(const std::vector<entry>& candidates);
+};
+
+} // namespace
+}
+
+#endif /* WILTON_DB_TRANSACTION_REAPER_HPP */
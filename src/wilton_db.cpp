@@ -23,9 +23,13 @@
 
 #include "wilton/wilton_db.h"
 
+#include <ctime>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "soci/soci.h"
+
 #include "staticlib/config.hpp"
 #include "staticlib/io.hpp"
 #include "staticlib/orm.hpp"
@@ -36,23 +40,121 @@
 #include "wilton/support/logging.hpp"
 #include "wilton/support/misc.hpp"
 
+#include "db_tracing.hpp"
+#include "wilton_db_internal.hpp"
+
 namespace { // anonymous
 
 const std::string logger = std::string("wilton.DBConnection");
 
+// named parameters are bound for objects, positional ones for arrays
+template<typename T>
+void set_cursor_param(soci::values& vals, const std::string* name, const T& value,
+        soci::indicator ind = soci::i_ok) {
+    if (nullptr != name) {
+        vals.set<T>(*name, value, ind);
+    } else {
+        vals.set<T>(value, ind);
+    }
+}
+
+void bind_cursor_param(soci::values& vals, const std::string* name, const sl::json::value& val) {
+    switch (val.json_type()) {
+    case sl::json::type::nullt:
+        set_cursor_param(vals, name, std::string(), soci::i_null);
+        break;
+    case sl::json::type::integer:
+        set_cursor_param(vals, name, static_cast<long long>(val.as_int64()));
+        break;
+    case sl::json::type::real:
+        set_cursor_param(vals, name, val.as_float());
+        break;
+    case sl::json::type::boolean:
+        set_cursor_param(vals, name, val.as_bool() ? 1 : 0);
+        break;
+    case sl::json::type::string:
+        set_cursor_param(vals, name, val.as_string());
+        break;
+    default:
+        set_cursor_param(vals, name, val.dumps());
+    }
+}
+
+// returns false if there are no parameters to bind
+bool bind_cursor_params(soci::values& vals, const sl::json::value& params) {
+    switch (params.json_type()) {
+    case sl::json::type::nullt:
+        return false;
+    case sl::json::type::object:
+        for (const sl::json::field& fi : params.as_object()) {
+            bind_cursor_param(vals, std::addressof(fi.name()), fi.val());
+        }
+        return !params.as_object().empty();
+    case sl::json::type::array:
+        for (const sl::json::value& val : params.as_array()) {
+            bind_cursor_param(vals, nullptr, val);
+        }
+        return !params.as_array().empty();
+    default:
+        throw wilton::support::exception(TRACEMSG("Invalid cursor parameters specified," +
+                " object or array is required: [" + params.dumps() + "]"));
+    }
+}
+
+sl::json::value cursor_cell_to_json(const soci::row& row, size_t idx) {
+    switch (row.get_properties(idx).get_data_type()) {
+    case soci::dt_string:
+        return sl::json::value(row.get<std::string>(idx));
+    case soci::dt_double:
+        return sl::json::value(row.get<double>(idx));
+    case soci::dt_integer:
+        return sl::json::value(static_cast<int64_t>(row.get<int>(idx)));
+    case soci::dt_long_long:
+        return sl::json::value(static_cast<int64_t>(row.get<long long>(idx)));
+    case soci::dt_unsigned_long_long:
+        return sl::json::value(static_cast<int64_t>(row.get<unsigned long long>(idx)));
+    case soci::dt_date: {
+        auto tm = row.get<std::tm>(idx);
+        char buf[32];
+        auto len = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::addressof(tm));
+        return sl::json::value(std::string(buf, len));
+    }
+    default:
+        throw wilton::support::exception(TRACEMSG("Unsupported column type," +
+                " column: [" + row.get_properties(idx).get_name() + "]"));
+    }
+}
+
+sl::json::value cursor_row_to_json(const soci::row& row) {
+    auto fields = std::vector<sl::json::field>();
+    fields.reserve(row.size());
+    for (size_t i = 0; i < row.size(); i++) {
+        auto val = soci::i_null != row.get_indicator(i) ? cursor_cell_to_json(row, i) : sl::json::value();
+        fields.emplace_back(row.get_properties(i).get_name(), std::move(val));
+    }
+    return sl::json::value(std::move(fields));
+}
+
 } // namespace
 
 struct wilton_DBConnection {
 private:
     sl::orm::connection conn;
+    // cursors open their own sessions with it
+    wilton::db::orm_url url;
 
 public:
-    wilton_DBConnection(sl::orm::connection&& conn) :
-    conn(std::move(conn)) { }
+    wilton_DBConnection(sl::orm::connection&& conn, const wilton::db::orm_url& url) :
+    conn(std::move(conn)),
+    url(url) { }
 
     sl::orm::connection& impl() {
         return conn;
     }
+
+    const wilton::db::orm_url& get_url() const {
+        return url;
+    }
 };
 
 struct wilton_DBTransaction {
@@ -68,6 +170,47 @@ public:
     }
 };
 
+// query is executed once on the cursor's own session opened with
+// the connection URL, rows are read from the SOCI rowset one page at a time,
+// so cursor does not use the connection it was opened for after that
+struct wilton_DBCursor {
+private:
+    soci::session session;
+    soci::values params;
+    // destroyed before the session
+    std::unique_ptr<soci::rowset<soci::row>> rows;
+    soci::rowset<soci::row>::const_iterator it;
+    bool finished = false;
+
+public:
+    wilton_DBCursor(const wilton::db::orm_url& url, const std::string& sql, const sl::json::value& params_json) :
+    session(url.url) {
+        // journal mode is persistent and is already set by the connection
+        auto opts = url.sqlite;
+        opts.journal_mode.clear();
+        for (auto& pragma : opts.pragmas()) {
+            session << pragma;
+        }
+        if (bind_cursor_params(params, params_json)) {
+            rows.reset(new soci::rowset<soci::row>((session.prepare << sql, soci::use(params))));
+        } else {
+            rows.reset(new soci::rowset<soci::row>((session.prepare << sql)));
+        }
+        it = rows->begin();
+        finished = rows->end() == it;
+    }
+
+    std::vector<sl::json::value> fetch(uint32_t max_rows) {
+        auto rs = std::vector<sl::json::value>();
+        while (!finished && rs.size() < max_rows) {
+            rs.emplace_back(cursor_row_to_json(*it));
+            ++it;
+            finished = rows->end() == it;
+        }
+        return rs;
+    }
+};
+
 char* wilton_DBConnection_open(
         wilton_DBConnection** conn_out,
         const char* conn_url,
@@ -79,17 +222,170 @@ char* wilton_DBConnection_open(
     try {
         uint16_t conn_url_len_u16 = static_cast<uint16_t> (conn_url_len);
         std::string conn_url_str{conn_url, conn_url_len_u16};
-        sl::orm::connection conn{conn_url_str};
-        wilton::support::log_debug(logger, "Creating connection, URL: [" + conn_url_str + "] ...");
-        wilton_DBConnection* conn_ptr = new wilton_DBConnection{std::move(conn)};
-        *conn_out = conn_ptr;
-        wilton::support::log_debug(logger, "Connection created, handle: [" + wilton::support::strhandle(conn_ptr) + "]");
+        auto url = wilton::db::parse_orm_url(conn_url_str);
+        *conn_out = wilton::db::orm_open(url);
         return nullptr;
     } catch (const std::exception& e) {
         return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
     }
 }
 
+namespace wilton {
+namespace db {
+
+namespace { // anonymous
+
+// orm connection returns rows as JSON values, so MessagePack
+// is encoded from them and does not save the decoding work
+support::buffer rows_buffer(std::vector<sl::json::value>&& rs, result_encoding encoding) {
+    if (result_encoding::msgpack == encoding) {
+        auto out = std::string();
+        {
+            trace_span tspan{"serialize"};
+            msgpack_writer writer{out};
+            writer.write_array_header(static_cast<uint32_t>(rs.size()));
+            for (auto& row : rs) {
+                writer.write_json(row);
+            }
+        }
+        wilton::support::log_debug(logger, "Execution complete, MessagePack result length: [" +
+                sl::support::to_string(out.length()) + "]");
+        trace_span tspan{"buffer_copy"};
+        return wilton::support::make_string_buffer(out);
+    }
+    auto rs_json = sl::json::value(std::move(rs));
+    auto span = [&rs_json] {
+        trace_span tspan{"serialize"};
+        return wilton::support::make_json_buffer(rs_json);
+    }();
+    if (wilton::support::is_debug_enabled(logger)) {
+        wilton::support::log_debug(logger, "Execution complete, result: [" +
+                std::string(span.data(), span.size()) + "]");
+    }
+    return span;
+}
+
+void run_operations_list(wilton_DBConnection* conn, const std::vector<orm_operation>& operations,
+        std::vector<sl::json::value>& results) {
+    for (size_t i = 0; i < operations.size(); i++) {
+        auto& op = operations[i];
+        try {
+            trace_span span{"execute_decode"};
+            if (op.query) {
+                results.emplace_back(conn->impl().query(op.sql, op.params));
+            } else {
+                conn->impl().execute(op.sql, op.params);
+                results.emplace_back(sl::json::value());
+            }
+        } catch (const std::exception& e) {
+            throw support::exception(TRACEMSG(e.what() + "\nBatch operation failed," +
+                    " index: [" + sl::support::to_string(i) + "], SQL: [" + op.sql + "]"));
+        }
+    }
+}
+
+} // namespace
+
+wilton_DBConnection* orm_open(const orm_url& url) {
+    wilton::support::log_debug(logger, "Creating connection, URL: [" + url.url + "] ...");
+    sl::orm::connection conn{url.url};
+    // PRAGMA results (like new journal mode) are not used
+    for (auto& pragma : url.sqlite.pragmas()) {
+        wilton::support::log_debug(logger, "Applying SQLite option: [" + pragma + "]");
+        conn.query(pragma);
+    }
+    wilton_DBConnection* conn_ptr = new wilton_DBConnection{std::move(conn), url};
+    wilton::support::log_debug(logger, "Connection created, handle: [" + wilton::support::strhandle(conn_ptr) + "]");
+    return conn_ptr;
+}
+
+support::buffer orm_query(wilton_DBConnection* conn, const std::string& sql,
+        const sl::json::value& params, result_encoding encoding) {
+    // parameters are serialized only when the message is logged
+    if (wilton::support::is_debug_enabled(logger)) {
+        wilton::support::log_debug(logger, "Executing DQL, SQL: [" + sql + "]," +
+                " parameters: [" + params.dumps() + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
+    }
+    std::vector<sl::json::value> rs;
+    {
+        // sqlite steps and decodes rows together
+        trace_span span{"execute_decode"};
+        rs = conn->impl().query(sql, params);
+    }
+    return rows_buffer(std::move(rs), encoding);
+}
+
+void orm_execute(wilton_DBConnection* conn, const std::string& sql,
+        const sl::json::value& params) {
+    if (wilton::support::is_debug_enabled(logger)) {
+        wilton::support::log_debug(logger, "Executing DML, SQL: [" + sql + "]," +
+                " parameters: [" + params.dumps() + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
+    }
+    conn->impl().execute(sql, params);
+    wilton::support::log_debug(logger, "Execution complete");
+}
+
+uint64_t orm_execute_batch(wilton_DBConnection* conn, const std::string& sql,
+        const std::vector<sl::json::value>& params_list) {
+    wilton::support::log_debug(logger, "Executing DML batch, SQL: [" + sql + "]," +
+            " batch size: [" + sl::support::to_string(params_list.size()) + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "] ...");
+    // single transaction for the whole batch, rolled back
+    // by the transaction destructor if any row fails
+    auto tran = conn->impl().start_transaction();
+    for (auto& params : params_list) {
+        conn->impl().execute(sql, params);
+    }
+    tran.commit();
+    wilton::support::log_debug(logger, "Batch execution complete");
+    return static_cast<uint64_t>(params_list.size());
+}
+
+support::buffer orm_run_operations(wilton_DBConnection* conn, const std::vector<orm_operation>& operations,
+        bool transaction, result_encoding encoding) {
+    wilton::support::log_debug(logger, "Running operations, count: [" + sl::support::to_string(operations.size()) + "]," +
+            " transaction: [" + (transaction ? "true" : "false") + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "] ...");
+    auto results = std::vector<sl::json::value>();
+    results.reserve(operations.size());
+    if (transaction) {
+        // rolled back by the transaction destructor if any operation fails
+        auto tran = conn->impl().start_transaction();
+        run_operations_list(conn, operations, results);
+        tran.commit();
+    } else {
+        run_operations_list(conn, operations, results);
+    }
+    // every element is an array of rows or null, encoded the same way as rows
+    return rows_buffer(std::move(results), encoding);
+}
+
+wilton_DBCursor* orm_cursor_open(wilton_DBConnection* conn, const std::string& sql,
+        sl::json::value&& params) {
+    if (wilton::support::is_debug_enabled(logger)) {
+        wilton::support::log_debug(logger, "Opening cursor, SQL: [" + sql + "]," +
+                " parameters: [" + params.dumps() + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
+    }
+    if (std::string::npos == sql.find_first_not_of(" \t\r\n;")) throw support::exception(TRACEMSG(
+            "Invalid empty cursor query specified"));
+    auto& url = conn->get_url();
+    if (std::string::npos != url.url.find(":memory:")) throw support::exception(TRACEMSG(
+            "Cursor cannot be opened for in-memory SQLite database, URL: [" + url.url + "]"));
+    wilton_DBCursor* cursor = new wilton_DBCursor(url, sql, params);
+    wilton::support::log_debug(logger, "Cursor opened, handle: [" + wilton::support::strhandle(cursor) + "]");
+    return cursor;
+}
+
+support::buffer orm_cursor_fetch(wilton_DBCursor* cursor, uint32_t max_rows, result_encoding encoding) {
+    wilton::support::log_debug(logger, "Fetching rows, max rows: [" + sl::support::to_string(max_rows) + "]," +
+            " cursor handle: [" + wilton::support::strhandle(cursor) + "] ...");
+    std::vector<sl::json::value> rs = cursor->fetch(max_rows);
+    return rows_buffer(std::move(rs), encoding);
+}
+
+} // namespace
+}
+
 char* wilton_DBConnection_query(
         wilton_DBConnection* conn,
         const char* sql_text,
@@ -111,14 +407,9 @@ char* wilton_DBConnection_query(
         uint32_t sql_text_len_u32 = static_cast<uint32_t> (sql_text_len);
         std::string sql_text_str{sql_text, sql_text_len_u32};
         auto json = params_json_len > 0 ? sl::json::load({params_json, params_json_len}) : sl::json::value();
-        wilton::support::log_debug(logger, "Executing DQL, SQL: [" + sql_text_str + "]," +
-                " parameters: [" + json.dumps() + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
-        std::vector<sl::json::value> rs = conn->impl().query(sql_text_str, json);
-        auto rs_json = sl::json::value(std::move(rs));
-        auto span = wilton::support::make_json_buffer(rs_json);
+        auto span = wilton::db::orm_query(conn, sql_text_str, json, wilton::db::result_encoding::json);
         *result_set_out = span.data();
         *result_set_len_out = span.size_int();
-        wilton::support::log_debug(logger, "Execution complete, result: [" + rs_json.dumps() + "]");
         return nullptr;
     } catch (const std::exception& e) {
         return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
@@ -142,16 +433,41 @@ char* wilton_DBConnection_execute(
         uint32_t sql_text_len_u32 = static_cast<uint32_t> (sql_text_len);
         std::string sql_text_str{sql_text, sql_text_len_u32};
         auto json = params_json_len > 0 ? sl::json::load({params_json, params_json_len}) : sl::json::value();
-        wilton::support::log_debug(logger, "Executing DML, SQL: [" + sql_text_str + "]," +
-                " parameters: [" + json.dumps() + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
-        conn->impl().execute(sql_text_str, json);
-        wilton::support::log_debug(logger, "Execution complete");
+        wilton::db::orm_execute(conn, sql_text_str, json);
         return nullptr;
     } catch (const std::exception& e) {
         return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
     }    
 }
 
+char* wilton_DBConnection_execute_batch(
+        wilton_DBConnection* conn,
+        const char* sql_text,
+        int sql_text_len,
+        const char* params_list_json,
+        int params_list_json_len,
+        long long* executed_count_out) {
+    if (nullptr == conn) return wilton::support::alloc_copy(TRACEMSG("Null 'conn' parameter specified"));
+    if (nullptr == sql_text) return wilton::support::alloc_copy(TRACEMSG("Null 'sql_text' parameter specified"));
+    if (!sl::support::is_uint32_positive(sql_text_len)) return wilton::support::alloc_copy(TRACEMSG(
+            "Invalid 'sql_text_len' parameter specified: [" + sl::support::to_string(sql_text_len) + "]"));
+    if (nullptr == params_list_json) return wilton::support::alloc_copy(TRACEMSG("Null 'params_list_json' parameter specified"));
+    if (!sl::support::is_uint32_positive(params_list_json_len)) return wilton::support::alloc_copy(TRACEMSG(
+            "Invalid 'params_list_json_len' parameter specified: [" + sl::support::to_string(params_list_json_len) + "]"));
+    if (nullptr == executed_count_out) return wilton::support::alloc_copy(TRACEMSG("Null 'executed_count_out' parameter specified"));
+    try {
+        uint32_t sql_text_len_u32 = static_cast<uint32_t> (sql_text_len);
+        std::string sql_text_str{sql_text, sql_text_len_u32};
+        auto json = sl::json::load({params_list_json, params_list_json_len});
+        auto& params_list = json.as_array_or_throw("params_list_json");
+        auto count = wilton::db::orm_execute_batch(conn, sql_text_str, params_list);
+        *executed_count_out = static_cast<long long>(count);
+        return nullptr;
+    } catch (const std::exception& e) {
+        return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
+    }
+}
+
 char* wilton_DBConnection_close(
         wilton_DBConnection* conn) {
     if (nullptr == conn) return wilton::support::alloc_copy(TRACEMSG("Null 'conn' parameter specified"));
@@ -209,6 +525,66 @@ char* wilton_DBTransaction_rollback(
     }
 }
 
+char* wilton_DBCursor_open(
+        wilton_DBConnection* conn,
+        const char* sql_text,
+        int sql_text_len,
+        const char* params_json,
+        int params_json_len,
+        wilton_DBCursor** cursor_out) {
+    if (nullptr == conn) return wilton::support::alloc_copy(TRACEMSG("Null 'conn' parameter specified"));
+    if (nullptr == sql_text) return wilton::support::alloc_copy(TRACEMSG("Null 'sql_text' parameter specified"));
+    if (!sl::support::is_uint32_positive(sql_text_len)) return wilton::support::alloc_copy(TRACEMSG(
+            "Invalid 'sql_text_len' parameter specified: [" + sl::support::to_string(sql_text_len) + "]"));
+    if (nullptr == params_json) return wilton::support::alloc_copy(TRACEMSG("Null 'params_json' parameter specified"));
+    if (!sl::support::is_uint32(params_json_len)) return wilton::support::alloc_copy(TRACEMSG(
+            "Invalid 'params_json_len' parameter specified: [" + sl::support::to_string(params_json_len) + "]"));
+    if (nullptr == cursor_out) return wilton::support::alloc_copy(TRACEMSG("Null 'cursor_out' parameter specified"));
+    try {
+        uint32_t sql_text_len_u32 = static_cast<uint32_t> (sql_text_len);
+        std::string sql_text_str{sql_text, sql_text_len_u32};
+        auto json = params_json_len > 0 ? sl::json::load({params_json, params_json_len}) : sl::json::value();
+        *cursor_out = wilton::db::orm_cursor_open(conn, sql_text_str, std::move(json));
+        return nullptr;
+    } catch (const std::exception& e) {
+        return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
+    }
+}
+
+char* wilton_DBCursor_fetch(
+        wilton_DBCursor* cursor,
+        int max_rows,
+        char** result_set_out,
+        int* result_set_len_out) {
+    if (nullptr == cursor) return wilton::support::alloc_copy(TRACEMSG("Null 'cursor' parameter specified"));
+    if (!sl::support::is_uint32_positive(max_rows)) return wilton::support::alloc_copy(TRACEMSG(
+            "Invalid 'max_rows' parameter specified: [" + sl::support::to_string(max_rows) + "]"));
+    if (nullptr == result_set_out) return wilton::support::alloc_copy(TRACEMSG("Null 'result_set_out' parameter specified"));
+    if (nullptr == result_set_len_out) return wilton::support::alloc_copy(TRACEMSG("Null 'result_set_len_out' parameter specified"));
+    try {
+        auto span = wilton::db::orm_cursor_fetch(cursor, static_cast<uint32_t>(max_rows),
+                wilton::db::result_encoding::json);
+        *result_set_out = span.data();
+        *result_set_len_out = span.size_int();
+        return nullptr;
+    } catch (const std::exception& e) {
+        return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
+    }
+}
+
+char* wilton_DBCursor_close(
+        wilton_DBCursor* cursor) {
+    if (nullptr == cursor) return wilton::support::alloc_copy(TRACEMSG("Null 'cursor' parameter specified"));
+    try {
+        wilton::support::log_debug(logger, "Closing cursor, handle: [" + wilton::support::strhandle(cursor) + "] ...");
+        delete cursor;
+        wilton::support::log_debug(logger, "Cursor closed");
+        return nullptr;
+    } catch (const std::exception& e) {
+        return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
+    }
+}
+
 char* wilton_DBConnection_initialize_backends() /* noexcept */ {
     try {
         sl::orm::connection::initialize_backends();
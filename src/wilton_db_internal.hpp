@@ -0,0 +1,117 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   wilton_db_internal.hpp
+ * Author: alex
+ *
+ * Entry points used by wiltoncall_db.cpp, that take already parsed
+ * parameters instead of JSON text passed through C API. Throw on error.
+ */
+
+#ifndef WILTON_DB_INTERNAL_HPP
+#define WILTON_DB_INTERNAL_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "staticlib/json.hpp"
+
+#include "wilton/wilton_db.h"
+#include "wilton/wilton_db_psql.h"
+#include "wilton/support/buffer.hpp"
+
+#include "msgpack_encoding.hpp"
+#include "psql_functions.hpp"
+#include "sqlite_options.hpp"
+
+namespace wilton {
+namespace db {
+
+struct orm_operation {
+    // DQL returns rows, DML returns null
+    bool query = true;
+    std::string sql;
+    sl::json::value params = sl::json::value(std::vector<sl::json::field>()); // empty json by default
+};
+
+wilton_DBConnection* orm_open(const orm_url& url);
+
+support::buffer orm_query(wilton_DBConnection* conn, const std::string& sql,
+        const sl::json::value& params, result_encoding encoding);
+
+void orm_execute(wilton_DBConnection* conn, const std::string& sql,
+        const sl::json::value& params);
+
+wilton_DBCursor* orm_cursor_open(wilton_DBConnection* conn, const std::string& sql,
+        sl::json::value&& params);
+
+support::buffer orm_cursor_fetch(wilton_DBCursor* cursor, uint32_t max_rows, result_encoding encoding);
+
+/**
+ * Returns the number of statement executions, not affected rows
+ */
+uint64_t orm_execute_batch(wilton_DBConnection* conn, const std::string& sql,
+        const std::vector<sl::json::value>& params_list);
+
+/**
+ * Runs operations in order, optionally in a single transaction,
+ * returns an array with results of all operations
+ */
+support::buffer orm_run_operations(wilton_DBConnection* conn, const std::vector<orm_operation>& operations,
+        bool transaction, result_encoding encoding);
+
+support::buffer pgsql_execute_sql(wilton_PGConnection* conn, const std::string& sql,
+        const sl::json::value& params, const pgsql::execution_options& options);
+
+support::buffer pgsql_run_in_transaction(wilton_PGConnection* conn,
+        const std::vector<pgsql::transaction_statement>& statements,
+        const pgsql::transaction_retry_options& retry);
+
+void pgsql_set_result_limits(wilton_PGConnection* conn, const pgsql::result_limits& limits);
+
+support::buffer pgsql_stats(wilton_PGConnection* conn);
+
+std::shared_ptr<PGcancel> pgsql_cancel_handle(wilton_PGConnection* conn);
+
+/**
+ * Connection is lost and could not be reset
+ */
+bool pgsql_is_broken(wilton_PGConnection* conn);
+
+void pgsql_load_catalog(wilton_PGConnection* conn, const sl::json::value& statements);
+
+std::string pgsql_catalog_sql(wilton_PGConnection* conn, const std::string& name);
+
+support::buffer pgsql_lo_import(wilton_PGConnection* conn, const std::string& path);
+
+void pgsql_lo_export(wilton_PGConnection* conn, uint32_t oid, const std::string& path);
+
+support::buffer pgsql_lo_create(wilton_PGConnection* conn);
+
+void pgsql_lo_unlink(wilton_PGConnection* conn, uint32_t oid);
+
+support::buffer pgsql_lo_read(wilton_PGConnection* conn, uint32_t oid, int64_t offset,
+        uint32_t length, result_encoding encoding);
+
+support::buffer pgsql_lo_write(wilton_PGConnection* conn, uint32_t oid, int64_t offset,
+        const std::string& data);
+
+} // namespace
+}
+
+#endif /* WILTON_DB_INTERNAL_HPP */
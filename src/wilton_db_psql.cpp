@@ -30,7 +30,9 @@
 #include "wilton/support/misc.hpp"
 
 #include <libpq-fe.h>
+#include "db_tracing.hpp"
 #include "psql_functions.hpp"
+#include "wilton_db_internal.hpp"
 
 namespace { // anonymous
 
@@ -51,6 +53,146 @@ public:
     }
 };
 
+namespace wilton {
+namespace db {
+
+support::buffer pgsql_execute_sql(wilton_PGConnection* conn, const std::string& sql,
+        const sl::json::value& params, const pgsql::execution_options& options) {
+    // parameters are serialized only when the message is logged
+    if (wilton::support::is_debug_enabled(logger)) {
+        wilton::support::log_debug(logger, "Executing  SQL: [" + sql + "], parameters: [" +
+                params.dumps() + "], timeout: [" + sl::support::to_string(options.timeout_millis) + "]," +
+                " handle: [" + wilton::support::strhandle(conn) + "] ...");
+    }
+    if (options.sink.enabled()) {
+        auto rs = conn->impl().execute_to_file(sql, params, options);
+        wilton::support::log_debug(logger, "Execution complete, result: [" + rs.dumps() + "]");
+        return wilton::support::make_json_buffer(rs);
+    }
+    if (result_encoding::msgpack == options.encoding) {
+        auto rs = conn->impl().execute_with_parameters_as_msgpack(sql, params, options);
+        wilton::support::log_debug(logger, "Execution complete, MessagePack result length: [" +
+                sl::support::to_string(rs.length()) + "]");
+        trace_span tspan{"buffer_copy"};
+        return wilton::support::make_string_buffer(rs);
+    }
+    // rows are written as JSON text directly, without the intermediate JSON tree
+    auto rs = conn->impl().execute_with_parameters_as_json_text(sql, params, options);
+    if (wilton::support::is_debug_enabled(logger)) {
+        wilton::support::log_debug(logger, "Execution complete, result: [" + rs + "]");
+    }
+    trace_span tspan{"buffer_copy"};
+    return wilton::support::make_string_buffer(rs);
+}
+
+support::buffer pgsql_run_in_transaction(wilton_PGConnection* conn,
+        const std::vector<pgsql::transaction_statement>& statements,
+        const pgsql::transaction_retry_options& retry) {
+    wilton::support::log_debug(logger, "Running statements in transaction, count: [" +
+            sl::support::to_string(statements.size()) + "], max retries: [" +
+            sl::support::to_string(retry.max_retries) + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "] ...");
+    sl::json::value rs = conn->impl().run_in_transaction(statements, retry);
+    wilton::support::log_debug(logger, "Transaction complete, retries: [" +
+            sl::support::to_string(rs["retries"].as_int64()) + "]");
+    return wilton::support::make_json_buffer(rs);
+}
+
+void pgsql_set_result_limits(wilton_PGConnection* conn, const pgsql::result_limits& limits) {
+    conn->impl().set_result_limits(limits);
+}
+
+support::buffer pgsql_stats(wilton_PGConnection* conn) {
+    return wilton::support::make_json_buffer(conn->impl().get_stats());
+}
+
+std::shared_ptr<PGcancel> pgsql_cancel_handle(wilton_PGConnection* conn) {
+    return conn->impl().get_cancel_handle();
+}
+
+bool pgsql_is_broken(wilton_PGConnection* conn) {
+    return conn->impl().is_broken();
+}
+
+void pgsql_load_catalog(wilton_PGConnection* conn, const sl::json::value& statements) {
+    wilton::support::log_debug(logger, "Preparing statements catalog, count: [" +
+            sl::support::to_string(statements.as_object_or_throw("catalog").size()) + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "] ...");
+    conn->impl().load_catalog(statements);
+    wilton::support::log_debug(logger, "Statements catalog prepared");
+}
+
+std::string pgsql_catalog_sql(wilton_PGConnection* conn, const std::string& name) {
+    return conn->impl().get_catalog_sql(name);
+}
+
+support::buffer pgsql_lo_import(wilton_PGConnection* conn, const std::string& path) {
+    wilton::support::log_debug(logger, "Importing large object, path: [" + path + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "] ...");
+    uint32_t oid = conn->impl().lo_import_file(path);
+    wilton::support::log_debug(logger, "Large object imported, oid: [" + sl::support::to_string(oid) + "]");
+    return wilton::support::make_json_buffer(sl::json::value({
+        { "oid", oid }
+    }));
+}
+
+void pgsql_lo_export(wilton_PGConnection* conn, uint32_t oid, const std::string& path) {
+    wilton::support::log_debug(logger, "Exporting large object, oid: [" + sl::support::to_string(oid) + "]," +
+            " path: [" + path + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
+    conn->impl().lo_export_file(oid, path);
+    wilton::support::log_debug(logger, "Large object exported");
+}
+
+support::buffer pgsql_lo_create(wilton_PGConnection* conn) {
+    uint32_t oid = conn->impl().lo_create_object();
+    wilton::support::log_debug(logger, "Large object created, oid: [" + sl::support::to_string(oid) + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "]");
+    return wilton::support::make_json_buffer(sl::json::value({
+        { "oid", oid }
+    }));
+}
+
+void pgsql_lo_unlink(wilton_PGConnection* conn, uint32_t oid) {
+    conn->impl().lo_unlink_object(oid);
+    wilton::support::log_debug(logger, "Large object unlinked, oid: [" + sl::support::to_string(oid) + "]," +
+            " handle: [" + wilton::support::strhandle(conn) + "]");
+}
+
+support::buffer pgsql_lo_read(wilton_PGConnection* conn, uint32_t oid, int64_t offset,
+        uint32_t length, result_encoding encoding) {
+    auto chunk = conn->impl().lo_read_chunk(oid, offset, length);
+    wilton::support::log_debug(logger, "Large object chunk read, oid: [" + sl::support::to_string(oid) + "]," +
+            " offset: [" + sl::support::to_string(offset) + "], bytes: [" + sl::support::to_string(chunk.length()) + "]");
+    if (result_encoding::msgpack == encoding) {
+        // raw bytes, without hex encoding
+        auto res = std::string();
+        msgpack_writer writer{res};
+        writer.write_map_header(2);
+        writer.write_str("data");
+        writer.write_bin(chunk.data(), chunk.length());
+        writer.write_str("bytes");
+        writer.write_int(static_cast<int64_t>(chunk.length()));
+        return wilton::support::make_string_buffer(res);
+    }
+    return wilton::support::make_json_buffer(sl::json::value({
+        { "data", pgsql::encode_bytea_hex(chunk.data(), chunk.length()) },
+        { "bytes", static_cast<int64_t>(chunk.length()) }
+    }));
+}
+
+support::buffer pgsql_lo_write(wilton_PGConnection* conn, uint32_t oid, int64_t offset,
+        const std::string& data) {
+    conn->impl().lo_write_chunk(oid, offset, data);
+    wilton::support::log_debug(logger, "Large object chunk written, oid: [" + sl::support::to_string(oid) + "]," +
+            " offset: [" + sl::support::to_string(offset) + "], bytes: [" + sl::support::to_string(data.length()) + "]");
+    return wilton::support::make_json_buffer(sl::json::value({
+        { "bytes", static_cast<int64_t>(data.length()) }
+    }));
+}
+
+} // namespace
+}
+
 char* wilton_PGConnection_open(wilton_PGConnection** conn_out,
         const char* conn_url,
         int conn_url_len) /* noexcept */ {
@@ -84,6 +226,19 @@ char* wilton_PGConnection_execute_sql(wilton_PGConnection* conn,
         int cache_flag,
         char** result_set_out,
         int* result_set_len_out) {
+    return wilton_PGConnection_execute_sql_with_timeout(conn, sql_text, sql_text_len,
+            params_json, params_json_len, cache_flag, 0, result_set_out, result_set_len_out);
+}
+
+char* wilton_PGConnection_execute_sql_with_timeout(wilton_PGConnection* conn,
+        const char* sql_text,
+        int sql_text_len,
+        const char* params_json,
+        int params_json_len,
+        int cache_flag,
+        int timeout_millis,
+        char** result_set_out,
+        int* result_set_len_out) {
     if (nullptr == conn) return wilton::support::alloc_copy(TRACEMSG("Null 'conn' parameter specified"));
     if (nullptr == sql_text) return wilton::support::alloc_copy(TRACEMSG("Null 'sql_text' parameter specified"));
     if (!sl::support::is_uint32_positive(sql_text_len)) return wilton::support::alloc_copy(TRACEMSG(
@@ -91,26 +246,37 @@ char* wilton_PGConnection_execute_sql(wilton_PGConnection* conn,
     if (nullptr == params_json) return wilton::support::alloc_copy(TRACEMSG("Null 'params_json' parameter specified"));
     if (!sl::support::is_uint32(params_json_len)) return wilton::support::alloc_copy(TRACEMSG(
         "Invalid 'params_json_len' parameter specified: [" + sl::support::to_string(params_json_len) + "]"));
+    if (!sl::support::is_uint32(timeout_millis)) return wilton::support::alloc_copy(TRACEMSG(
+        "Invalid 'timeout_millis' parameter specified: [" + sl::support::to_string(timeout_millis) + "]"));
     if (nullptr == result_set_out) return wilton::support::alloc_copy(TRACEMSG("Null 'result_set_out' parameter specified"));
     if (nullptr == result_set_len_out) return wilton::support::alloc_copy(TRACEMSG("Null 'result_set_len_out' parameter specified"));
     try {
         uint32_t sql_text_len_u32 = static_cast<uint32_t> (sql_text_len);
         std::string sql_text_str{sql_text, sql_text_len_u32};
-        uint32_t json_text_len_u32 = static_cast<uint32_t> (params_json_len);
-        std::string json_text_str{params_json, json_text_len_u32};
-        wilton::support::log_debug(logger, "Executing  SQL: [" + sql_text_str + "], parameters:" +
-                json_text_str + "], handle: [" + wilton::support::strhandle(conn) + "] ...");
-        sl::json::value rs = conn->impl().execute_with_parameters(sql_text_str, sl::json::loads(json_text_str), cache_flag);
-        auto span = wilton::support::make_json_buffer(rs);
+        auto json = params_json_len > 0 ? sl::json::load({params_json, params_json_len}) : sl::json::value();
+        uint32_t timeout_millis_u32 = static_cast<uint32_t> (timeout_millis);
+        auto options = wilton::db::pgsql::execution_options(cache_flag, timeout_millis_u32);
+        auto span = wilton::db::pgsql_execute_sql(conn, sql_text_str, json, options);
         *result_set_out = span.data();
         *result_set_len_out = span.size_int();
-        wilton::support::log_debug(logger, "Execution complete, result: [" + rs.dumps() + "]");
         return nullptr;
     } catch (const std::exception& e) {
         return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
     }
 }
 
+char* wilton_PGConnection_cancel(
+        wilton_PGConnection* conn) {
+    if (nullptr == conn) return wilton::support::alloc_copy(TRACEMSG("Null 'conn' parameter specified"));
+    try {
+        wilton::support::log_debug(logger, "Cancelling statement, handle: [" + wilton::support::strhandle(conn) + "] ...");
+        conn->impl().cancel();
+        wilton::support::log_debug(logger, "Cancel request sent");
+        return nullptr;
+    } catch (const std::exception& e) {
+        return wilton::support::alloc_copy(TRACEMSG(e.what() + "\nException raised"));
+    }
+}
 
 char* wilton_PGConnection_close(
         wilton_PGConnection* conn) {
@@ -22,9 +22,15 @@
  */
 
 #include <cstdint>
+#include <fstream>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "staticlib/config.hpp"
 #include "staticlib/io.hpp"
@@ -41,17 +47,166 @@
 #include "wilton/support/buffer.hpp"
 #include "wilton/support/registrar.hpp"
 
+#include "db_tracing.hpp"
+#include "pgsql_bulk_upsert.hpp"
+#include "pgsql_multiplexer.hpp"
+#include "pgsql_write_coalescer.hpp"
+#include "sqlite_pool.hpp"
+#include "transaction_reaper.hpp"
+#include "wilton_db_internal.hpp"
+#include "wiltoncall_db_requests.hpp"
+
 namespace wilton {
 namespace db {
 
 namespace { //anonymous
 
+// thread_local with non-trivial destructor is not available in VS2013 and GCC 4.7,
+// thread connections are kept in plain thread storage there and are not closed on thread exit
+#if defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1900) || \
+        (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)))
+#define WILTON_DB_THREAD_EXIT_HOOK
+#elif defined(_MSC_VER)
+#define WILTON_DB_THREAD_POINTER __declspec(thread)
+#else
+#define WILTON_DB_THREAD_POINTER __thread
+#endif
+
+// connections opened with 'affinity: "thread"', reused by all open calls
+// with the same parameters on the same thread; they are not put into
+// shared registries, so handles are resolved without locking and
+// are not valid on other threads
+class thread_connections {
+public:
+    struct entry {
+        std::string key;
+        bool pgsql;
+        int64_t handle;
+        void* conn;
+        // health check is done on next open
+        bool failed;
+    };
+
+private:
+    std::vector<entry> entries;
+
+public:
+    thread_connections() { }
+
+    ~thread_connections() STATICLIB_NOEXCEPT {
+        close_all();
+    }
+
+    thread_connections(const thread_connections&) = delete;
+
+    thread_connections& operator=(const thread_connections&) = delete;
+
+    static thread_connections& current() {
+#ifdef WILTON_DB_THREAD_EXIT_HOOK
+        static thread_local thread_connections connections;
+        return connections;
+#else
+        static WILTON_DB_THREAD_POINTER thread_connections* connections = nullptr;
+        if (nullptr == connections) {
+            connections = new thread_connections();
+        }
+        return *connections;
+#endif // WILTON_DB_THREAD_EXIT_HOOK
+    }
+
+    entry* find_by_key(const std::string& key) {
+        for (auto& en : entries) {
+            if (key == en.key) {
+                return std::addressof(en);
+            }
+        }
+        return nullptr;
+    }
+
+    entry* find(bool pgsql, int64_t handle) {
+        for (auto& en : entries) {
+            if (pgsql == en.pgsql && handle == en.handle) {
+                return std::addressof(en);
+            }
+        }
+        return nullptr;
+    }
+
+    int64_t find_handle(bool pgsql, void* conn) {
+        for (auto& en : entries) {
+            if (pgsql == en.pgsql && conn == en.conn) {
+                return en.handle;
+            }
+        }
+        return -1;
+    }
+
+    // connection address is used as a handle, the same way as in shared registries
+    int64_t put(const std::string& key, bool pgsql, void* conn) {
+        auto en = entry();
+        en.key = key;
+        en.pgsql = pgsql;
+        en.handle = reinterpret_cast<int64_t>(conn);
+        en.conn = conn;
+        en.failed = false;
+        entries.push_back(std::move(en));
+        return entries.back().handle;
+    }
+
+    void erase(bool pgsql, int64_t handle) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (pgsql == it->pgsql && handle == it->handle) {
+                entries.erase(it);
+                return;
+            }
+        }
+    }
+
+    void mark_failed(bool pgsql, int64_t handle) {
+        auto en = find(pgsql, handle);
+        if (nullptr != en) {
+            en->failed = true;
+        }
+    }
+
+    void close_all() STATICLIB_NOEXCEPT;
+};
+
+// connections of the calling thread are taken from its thread storage,
+// other ones are leased from the shared registry
+template<typename T>
+class connection_registry {
+    support::unique_handle_registry<T> shared;
+    bool pgsql;
+
+public:
+    connection_registry(std::function<void(T*)> close_fun, bool pgsql) :
+    shared(std::move(close_fun)),
+    pgsql(pgsql) { }
+
+    int64_t put(T* conn) {
+        int64_t handle = thread_connections::current().find_handle(pgsql, conn);
+        if (-1 != handle) {
+            return handle;
+        }
+        return shared.put(conn);
+    }
+
+    T* remove(int64_t handle) {
+        auto en = thread_connections::current().find(pgsql, handle);
+        if (nullptr != en) {
+            return static_cast<T*>(en->conn);
+        }
+        return shared.remove(handle);
+    }
+};
+
 // initialized from wilton_module_init
-std::shared_ptr<support::unique_handle_registry<wilton_DBConnection>> conn_registry() {
-    static auto registry = std::make_shared<support::unique_handle_registry<wilton_DBConnection>>(
+std::shared_ptr<connection_registry<wilton_DBConnection>> conn_registry() {
+    static auto registry = std::make_shared<connection_registry<wilton_DBConnection>>(
             [](wilton_DBConnection* conn) STATICLIB_NOEXCEPT {
                 wilton_DBConnection_close(conn);
-            });
+            }, false);
     return registry;
 }
 
@@ -65,107 +220,619 @@ std::shared_ptr<support::unique_handle_registry<wilton_DBTransaction>> tran_regi
 }
 
 // initialized from wilton_module_init
-std::shared_ptr<support::unique_handle_registry<wilton_PGConnection>> psql_conn_registry() {
-    static auto registry = std::make_shared<support::unique_handle_registry<wilton_PGConnection>>(
+std::shared_ptr<support::unique_handle_registry<wilton_DBCursor>> cursor_registry() {
+    static auto registry = std::make_shared<support::unique_handle_registry<wilton_DBCursor>>(
+            [](wilton_DBCursor* cursor) STATICLIB_NOEXCEPT {
+                wilton_DBCursor_close(cursor);
+            });
+    return registry;
+}
+
+// initialized from wilton_module_init
+std::shared_ptr<connection_registry<wilton_PGConnection>> psql_conn_registry() {
+    static auto registry = std::make_shared<connection_registry<wilton_PGConnection>>(
             [](wilton_PGConnection* conn) STATICLIB_NOEXCEPT {
                 wilton_PGConnection_close(conn);
-            });
+            }, true);
+    return registry;
+}
+
+// initialized from wilton_module_init
+std::shared_ptr<transaction_reaper> tran_reaper() {
+    static auto reaper = std::make_shared<transaction_reaper>([](const transaction_reaper::entry& en) -> bool {
+        if (en.pgsql) {
+            auto reg = psql_conn_registry();
+            wilton_PGConnection* conn = reg->remove(en.handle);
+            if (nullptr == conn) {
+                return false;
+            }
+            // connection is ours now, transaction cannot be committed and started again concurrently
+            bool overdue = tran_reaper()->is_overdue(true, en.handle);
+            char* err = overdue ? wilton_PGConnection_transaction_rollback(conn) : nullptr;
+            if (overdue && nullptr == err) {
+                tran_reaper()->mark_expired(true, en.handle);
+            }
+            reg->put(conn);
+            if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
+            return overdue;
+        }
+        // transaction uses the connection session, so the connection is taken
+        // to not roll back concurrently with a running call
+        auto creg = conn_registry();
+        wilton_DBConnection* conn = creg->remove(en.conn_handle);
+        if (nullptr == conn) {
+            return false;
+        }
+        auto treg = tran_registry();
+        wilton_DBTransaction* tran = treg->remove(en.handle);
+        if (nullptr == tran) {
+            creg->put(conn);
+            return false;
+        }
+        if (!tran_reaper()->is_overdue(false, en.handle)) {
+            treg->put(tran);
+            creg->put(conn);
+            return false;
+        }
+        char* err = wilton_DBTransaction_rollback(tran);
+        if (nullptr != err) {
+            treg->put(tran);
+            creg->put(conn);
+            support::throw_wilton_error(err, TRACEMSG(err));
+        }
+        tran_reaper()->mark_expired(false, en.handle);
+        creg->put(conn);
+        return true;
+    });
+    return reaper;
+}
+
+void throw_expired_transaction(int64_t handle) {
+    throw support::exception(TRACEMSG("Transaction was rolled back after exceeding max age," +
+            " handle: [" + sl::support::to_string(handle) + "]"));
+}
+
+// statements must not run in autocommit mode silently after the transaction
+// is rolled back by the reaper, called after the connection is taken
+void check_reaped_transaction(bool pgsql, int64_t conn_handle) {
+    if (tran_reaper()->has_expired_on(pgsql, conn_handle)) throw support::exception(TRACEMSG(
+            "Transaction on this connection was rolled back after exceeding max age," +
+            " commit or rollback it before running other statements," +
+            " connectionHandle: [" + sl::support::to_string(conn_handle) + "]"));
+}
+
+// pools and coalescers are used from multiple threads at once,
+// so they are not taken out of the registry during the calls
+template<typename T>
+class shared_registry {
+    std::mutex mutex;
+    std::unordered_map<int64_t, std::shared_ptr<T>> objects;
+    int64_t next_handle = 1;
+    std::string handle_name;
+
+public:
+    shared_registry(const std::string& handle_name) :
+    handle_name(handle_name) { }
+
+    int64_t put(std::shared_ptr<T> obj) {
+        std::lock_guard<std::mutex> guard{mutex};
+        int64_t handle = next_handle++;
+        objects.emplace(handle, std::move(obj));
+        return handle;
+    }
+
+    std::shared_ptr<T> peek(int64_t handle) {
+        std::lock_guard<std::mutex> guard{mutex};
+        auto it = objects.find(handle);
+        if (objects.end() == it) throw support::exception(TRACEMSG(
+                "Invalid '" + handle_name + "' parameter specified"));
+        return it->second;
+    }
+
+    // object is destroyed when the last running call finishes
+    void remove(int64_t handle) {
+        std::lock_guard<std::mutex> guard{mutex};
+        auto erased = objects.erase(handle);
+        if (0 == erased) throw support::exception(TRACEMSG(
+                "Invalid '" + handle_name + "' parameter specified"));
+    }
+};
+
+// initialized from wilton_module_init
+std::shared_ptr<shared_registry<sqlite_pool>> pool_reg() {
+    static auto registry = std::make_shared<shared_registry<sqlite_pool>>("poolHandle");
+    return registry;
+}
+
+// initialized from wilton_module_init
+std::shared_ptr<shared_registry<pgsql_write_coalescer>> coalescer_reg() {
+    static auto registry = std::make_shared<shared_registry<pgsql_write_coalescer>>("coalescerHandle");
+    return registry;
+}
+
+// initialized from wilton_module_init
+std::shared_ptr<shared_registry<pgsql_multiplexer>> multiplexer_reg() {
+    static auto registry = std::make_shared<shared_registry<pgsql_multiplexer>>("multiplexerHandle");
+    return registry;
+}
+
+// connections that can be cancelled from other threads,
+// handles are taken out of psql_conn_registry while statements are running
+class psql_cancel_registry {
+    std::mutex mutex;
+    std::unordered_map<int64_t, wilton_PGConnection*> connections;
+
+public:
+    void put(int64_t handle, wilton_PGConnection* conn) {
+        std::lock_guard<std::mutex> guard{mutex};
+        connections[handle] = conn;
+    }
+
+    void remove(int64_t handle) {
+        std::lock_guard<std::mutex> guard{mutex};
+        connections.erase(handle);
+    }
+
+    // cancel handle is copied under the lock, so connection cannot be closed concurrently,
+    // blocking cancel request is sent after the lock is released
+    bool cancel(int64_t handle) {
+        auto cancel_handle = std::shared_ptr<PGcancel>();
+        {
+            std::lock_guard<std::mutex> guard{mutex};
+            auto it = connections.find(handle);
+            if (connections.end() == it) {
+                return false;
+            }
+            cancel_handle = pgsql_cancel_handle(it->second);
+        }
+        pgsql::send_cancel_request(cancel_handle);
+        return true;
+    }
+};
+
+// initialized from wilton_module_init
+std::shared_ptr<psql_cancel_registry> psql_cancel_reg() {
+    static auto registry = std::make_shared<psql_cancel_registry>();
     return registry;
 }
 
+void close_thread_connection(const thread_connections::entry& en) STATICLIB_NOEXCEPT {
+    char* err = nullptr;
+    if (en.pgsql) {
+        try {
+            psql_cancel_reg()->remove(en.handle);
+            tran_reaper()->untrack(true, en.handle);
+        } catch (const std::exception&) {
+            // connection is closed anyway
+        }
+        err = wilton_PGConnection_close(static_cast<wilton_PGConnection*>(en.conn));
+    } else {
+        err = wilton_DBConnection_close(static_cast<wilton_DBConnection*>(en.conn));
+    }
+    if (nullptr != err) {
+        wilton_free(err);
+    }
+}
+
+void thread_connections::close_all() STATICLIB_NOEXCEPT {
+    auto closing = std::move(entries);
+    entries.clear();
+    for (auto& en : closing) {
+        close_thread_connection(en);
+    }
+}
+
+// returns existing connection of this thread, -1 if it is absent or broken
+int64_t reuse_affine_connection(const std::string& key) {
+    auto& tc = thread_connections::current();
+    auto en = tc.find_by_key(key);
+    if (nullptr == en) {
+        return -1;
+    }
+    if (!en->failed) {
+        return en->handle;
+    }
+    // health check after connection failure
+    bool healthy = false;
+    if (en->pgsql) {
+        // libpq connection is reset on the next statement,
+        // it is reopened only if the reset has failed
+        healthy = !pgsql_is_broken(static_cast<wilton_PGConnection*>(en->conn));
+    } else {
+        try {
+            auto empty_params = sl::json::value(std::vector<sl::json::field>());
+            orm_query(static_cast<wilton_DBConnection*>(en->conn), "SELECT 1", empty_params, result_encoding::json);
+            healthy = true;
+        } catch (const std::exception&) {
+            // reopened below
+        }
+    }
+    if (healthy) {
+        en->failed = false;
+        return en->handle;
+    }
+    auto broken = *en;
+    tc.erase(broken.pgsql, broken.handle);
+    close_thread_connection(broken);
+    return -1;
+}
+
+// called before the connection is returned to the registry,
+// statement errors leave the connection usable
+void check_pgsql_failure(wilton_PGConnection* conn, int64_t handle) {
+    auto& tc = thread_connections::current();
+    if (nullptr != tc.find(true, handle) && pgsql_is_broken(conn)) {
+        tc.mark_failed(true, handle);
+    }
+}
+
+// SOCI errors are passed through sl::orm as messages only, so lost connections
+// are recognized by libpq and SQLite messages
+bool is_orm_connection_error(const std::string& msg) {
+    static const char* markers[] = {
+        "server closed the connection unexpectedly",
+        "no connection to the server",
+        "could not receive data from server",
+        "could not send data to server",
+        "terminating connection",
+        "unable to open database file",
+        "disk I/O error",
+        "database disk image is malformed"
+    };
+    for (auto marker : markers) {
+        if (std::string::npos != msg.find(marker)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// called from catch block
+void check_orm_failure(int64_t handle) {
+    auto& tc = thread_connections::current();
+    if (nullptr == tc.find(false, handle)) {
+        return;
+    }
+    try {
+        throw;
+    } catch (const std::exception& e) {
+        if (is_orm_connection_error(e.what())) {
+            tc.mark_failed(false, handle);
+        }
+    } catch (...) {
+        // not a statement error
+    }
+}
+
+bool parse_affinity(const sl::json::field& fi) {
+    auto& val = fi.as_string_nonempty_or_throw(fi.name());
+    if ("thread" == val) {
+        return true;
+    } else if ("none" == val) {
+        return false;
+    }
+    throw support::exception(TRACEMSG("Invalid 'affinity' parameter specified: [" + val + "]," +
+            " supported values: [thread, none]"));
+}
+
+template<typename Func>
+support::buffer with_pgsql_connection(int64_t handle, Func fun) {
+    auto reg = psql_conn_registry();
+    wilton_PGConnection* conn = reg->remove(handle);
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    try {
+        check_reaped_transaction(true, handle);
+        auto res = fun(conn);
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        check_pgsql_failure(conn, handle);
+        reg->put(conn);
+        throw;
+    }
+}
+
+void require_lo_fields(const pgsql_lo_request& req, bool oid, bool path) {
+    if (oid && !req.oid_specified) throw support::exception(TRACEMSG(
+            "Required parameter 'oid' not specified"));
+    if (path && req.path.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'path' not specified"));
+}
+
+// JSON options can be preceded by whitespace, URL cannot start with '{'
+bool is_json_object(sl::io::span<const char> data) {
+    for (size_t i = 0; i < data.size(); i++) {
+        char ch = data.data()[i];
+        if (' ' != ch && '\t' != ch && '\r' != ch && '\n' != ch) {
+            return '{' == ch;
+        }
+    }
+    return false;
+}
+
 } // namespace
 
 // calls
 
 support::buffer connection_open(sl::io::span<const char> data) {
     wilton_DBConnection* conn;
-    char* err = wilton_DBConnection_open(std::addressof(conn), data.data(), data.size_int());
-    if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
-    auto reg = conn_registry();
-    int64_t handle = reg->put(conn);
+    auto affine_key = std::string();
+    if (is_json_object(data)) {
+        // JSON options
+        auto json = sl::json::load(data);
+        auto url_fields = std::vector<sl::json::field>();
+        bool affine = false;
+        for (sl::json::field& fi : json.as_object()) {
+            if ("affinity" == fi.name()) {
+                affine = parse_affinity(fi);
+            } else {
+                url_fields.emplace_back(fi.name(), std::move(fi.val()));
+            }
+        }
+        auto url_json = sl::json::value(std::move(url_fields));
+        if (affine) {
+            affine_key = url_json.dumps();
+            int64_t existing = reuse_affine_connection(affine_key);
+            if (-1 != existing) {
+                return support::make_json_buffer({
+                    { "connectionHandle", existing}
+                });
+            }
+        }
+        auto url = parse_orm_url_json(url_json);
+        conn = orm_open(url);
+    } else {
+        char* err = wilton_DBConnection_open(std::addressof(conn), data.data(), data.size_int());
+        if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
+    }
+    int64_t handle = affine_key.empty() ? conn_registry()->put(conn) :
+            thread_connections::current().put(affine_key, false, conn);
     return support::make_json_buffer({
         { "connectionHandle", handle}
     });
 }
 
 support::buffer connection_query(sl::io::span<const char> data) {
+    trace_span call_span{"db_connection_query"};
+    // json parse
+    auto req = orm_statement_request();
+    {
+        trace_span span{"parse_request"};
+        req = parse_orm_statement_request(data);
+    }
+    // get handle
+    auto reg = conn_registry();
+    wilton_DBConnection* conn = nullptr;
+    {
+        trace_span span{"registry"};
+        conn = reg->remove(req.handle);
+    }
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton, params are passed without serializing them back
+    try {
+        check_reaped_transaction(false, req.handle);
+        auto res = orm_query(conn, req.sql, req.params, req.encoding);
+        trace_span span{"registry"};
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        reg->put(conn);
+        check_orm_failure(req.handle);
+        throw;
+    }
+}
+
+support::buffer connection_execute(sl::io::span<const char> data) {
+    // json parse
+    auto req = parse_orm_statement_request(data);
+    // get handle
+    auto reg = conn_registry();
+    wilton_DBConnection* conn = reg->remove(req.handle);
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton, params are passed without serializing them back
+    try {
+        check_reaped_transaction(false, req.handle);
+        orm_execute(conn, req.sql, req.params);
+        reg->put(conn);
+        return support::make_null_buffer();
+    } catch (...) {
+        reg->put(conn);
+        check_orm_failure(req.handle);
+        throw;
+    }
+}
+
+support::buffer cursor_open(sl::io::span<const char> data) {
+    // json parse
+    auto req = parse_orm_statement_request(data);
+    if (result_encoding::json != req.encoding) throw support::exception(TRACEMSG(
+            "Parameter 'resultEncoding' is not supported for cursors, specify it for 'db_cursor_fetch'"));
+    // get handle
+    auto creg = conn_registry();
+    wilton_DBConnection* conn = creg->remove(req.handle);
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton
+    wilton_DBCursor* cursor = nullptr;
+    try {
+        check_reaped_transaction(false, req.handle);
+        cursor = orm_cursor_open(conn, req.sql, std::move(req.params));
+        creg->put(conn);
+    } catch (...) {
+        check_orm_failure(req.handle);
+        creg->put(conn);
+        throw;
+    }
+    auto rreg = cursor_registry();
+    int64_t rhandle = rreg->put(cursor);
+    return support::make_json_buffer({
+        { "cursorHandle", rhandle}
+    });
+}
+
+support::buffer cursor_fetch(sl::io::span<const char> data) {
+    // json parse
+    auto req = parse_orm_cursor_fetch_request(data);
+    // get handle
+    auto reg = cursor_registry();
+    wilton_DBCursor* cursor = reg->remove(req.handle);
+    if (nullptr == cursor) throw support::exception(TRACEMSG(
+            "Invalid 'cursorHandle' parameter specified"));
+    // call wilton
+    try {
+        auto res = orm_cursor_fetch(cursor, req.max_rows, req.encoding);
+        reg->put(cursor);
+        return res;
+    } catch (...) {
+        reg->put(cursor);
+        throw;
+    }
+}
+
+support::buffer cursor_close(sl::io::span<const char> data) {
     // json parse
     auto json = sl::json::load(data);
     int64_t handle = -1;
-    auto rsql = std::ref(sl::utils::empty_string());
-    auto params = std::string();
     for (const sl::json::field& fi : json.as_object()) {
         auto& name = fi.name();
-        if ("connectionHandle" == name) {
+        if ("cursorHandle" == name) {
             handle = fi.as_int64_or_throw(name);
-        } else if ("sql" == name) {
-            rsql = fi.as_string_nonempty_or_throw(name);
-        } else if ("params" == name) {
-            params = fi.val().dumps();
         } else {
             throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
         }
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
-            "Required parameter 'connectionHandle' not specified"));
-    if (rsql.get().empty()) throw support::exception(TRACEMSG(
-            "Required parameter 'sql' not specified"));
-    const std::string& sql = rsql.get();
-    if (params.empty()) {
-        params = "{}";
+            "Required parameter 'cursorHandle' not specified"));
+    // get handle
+    auto reg = cursor_registry();
+    wilton_DBCursor* cursor = reg->remove(handle);
+    if (nullptr == cursor) throw support::exception(TRACEMSG(
+            "Invalid 'cursorHandle' parameter specified"));
+    // call wilton
+    char* err = wilton_DBCursor_close(cursor);
+    if (nullptr != err) {
+        reg->put(cursor);
+        support::throw_wilton_error(err, TRACEMSG(err));
     }
+    return support::make_null_buffer();
+}
+
+support::buffer connection_execute_batch(sl::io::span<const char> data) {
+    // json parse
+    auto req = parse_orm_batch_request(data);
     // get handle
     auto reg = conn_registry();
-    wilton_DBConnection* conn = reg->remove(handle);
+    wilton_DBConnection* conn = reg->remove(req.handle);
     if (nullptr == conn) throw support::exception(TRACEMSG(
             "Invalid 'connectionHandle' parameter specified"));
     // call wilton
-    char* out = nullptr;
-    int out_len = 0;
-    char* err = wilton_DBConnection_query(conn, sql.c_str(), static_cast<int>(sql.length()),
-            params.c_str(), static_cast<int>(params.length()),
-            std::addressof(out), std::addressof(out_len));
-    reg->put(conn);
-    if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
-    return support::wrap_wilton_buffer(out, out_len);
+    try {
+        check_reaped_transaction(false, req.handle);
+        auto count = orm_execute_batch(conn, req.sql, req.params_list);
+        reg->put(conn);
+        return support::make_json_buffer({
+            { "executedCount", static_cast<int64_t>(count) }
+        });
+    } catch (...) {
+        check_orm_failure(req.handle);
+        reg->put(conn);
+        throw;
+    }
 }
 
-support::buffer connection_execute(sl::io::span<const char> data) {
+support::buffer connection_batch(sl::io::span<const char> data) {
+    trace_span call_span{"db_connection_batch"};
+    // json parse
+    auto req = orm_operations_request();
+    {
+        trace_span span{"parse_request"};
+        req = parse_orm_operations_request(data);
+    }
+    // get handle, single lease for all operations
+    auto reg = conn_registry();
+    wilton_DBConnection* conn = nullptr;
+    {
+        trace_span span{"registry"};
+        conn = reg->remove(req.handle);
+    }
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton
+    try {
+        check_reaped_transaction(false, req.handle);
+        auto res = orm_run_operations(conn, req.operations, req.transaction, req.encoding);
+        trace_span span{"registry"};
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        reg->put(conn);
+        check_orm_failure(req.handle);
+        throw;
+    }
+}
+
+support::buffer pool_open(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    auto url_fields = std::vector<sl::json::field>();
+    uint32_t readers = 4;
+    for (sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("readers" == name) {
+            readers = fi.as_uint32_positive_or_throw(name);
+        } else {
+            url_fields.emplace_back(name, std::move(fi.val()));
+        }
+    }
+    auto url = parse_orm_url_json(sl::json::value(std::move(url_fields)));
+    // open
+    auto pool = std::make_shared<sqlite_pool>(url, readers);
+    int64_t handle = pool_reg()->put(std::move(pool));
+    return support::make_json_buffer({
+        { "poolHandle", handle}
+    });
+}
+
+support::buffer pool_query(sl::io::span<const char> data) {
+    auto req = parse_orm_statement_request(data, "poolHandle");
+    auto pool = pool_reg()->peek(req.handle);
+    return pool->query(req.sql, req.params, req.encoding);
+}
+
+support::buffer pool_execute(sl::io::span<const char> data) {
+    auto req = parse_orm_statement_request(data, "poolHandle");
+    auto pool = pool_reg()->peek(req.handle);
+    pool->execute(req.sql, req.params);
+    return support::make_null_buffer();
+}
+
+support::buffer pool_execute_batch(sl::io::span<const char> data) {
+    auto req = parse_orm_batch_request(data, "poolHandle");
+    auto pool = pool_reg()->peek(req.handle);
+    auto count = pool->execute_batch(req.sql, req.params_list);
+    return support::make_json_buffer({
+        { "executedCount", static_cast<int64_t>(count) }
+    });
+}
+
+support::buffer pool_close(sl::io::span<const char> data) {
     // json parse
     auto json = sl::json::load(data);
     int64_t handle = -1;
-    auto rsql = std::ref(sl::utils::empty_string());
-    auto params = std::string();
     for (const sl::json::field& fi : json.as_object()) {
         auto& name = fi.name();
-        if ("connectionHandle" == name) {
+        if ("poolHandle" == name) {
             handle = fi.as_int64_or_throw(name);
-        } else if ("sql" == name) {
-            rsql = fi.as_string_nonempty_or_throw(name);
-        } else if ("params" == name) {
-            params = fi.val().dumps();
         } else {
             throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
         }
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
-            "Required parameter 'connectionHandle' not specified"));
-    if (rsql.get().empty()) throw support::exception(TRACEMSG(
-            "Required parameter 'sql' not specified"));
-    const std::string& sql = rsql.get();
-    if (params.empty()) {
-        params = "{}";
-    }
-    // get handle
-    auto reg = conn_registry();
-    wilton_DBConnection* conn = reg->remove(handle);
-    if (nullptr == conn) throw support::exception(TRACEMSG(
-            "Invalid 'connectionHandle' parameter specified"));
-    // call wilton
-    char* err = wilton_DBConnection_execute(conn, sql.c_str(), static_cast<int>(sql.length()),
-            params.c_str(), static_cast<int>(params.length()));
-    reg->put(conn);
-    if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
+            "Required parameter 'poolHandle' not specified"));
+    pool_reg()->remove(handle);
     return support::make_null_buffer();
 }
 
@@ -183,7 +850,7 @@ support::buffer connection_close(sl::io::span<const char> data) {
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
             "Required parameter 'connectionHandle' not specified"));
-    // get handle
+    // get handle, thread connections can only be closed on their own thread
     auto reg = conn_registry();
     wilton_DBConnection* conn = reg->remove(handle);
     if (nullptr == conn) throw support::exception(TRACEMSG(
@@ -194,6 +861,8 @@ support::buffer connection_close(sl::io::span<const char> data) {
         reg->put(conn);
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    thread_connections::current().erase(false, handle);
+    tran_reaper()->untrack_connection(false, handle);
     return support::make_null_buffer();
 }
 
@@ -216,6 +885,12 @@ support::buffer transaction_start(sl::io::span<const char> data) {
     wilton_DBConnection* conn = creg->remove(handle);
     if (nullptr == conn) throw support::exception(TRACEMSG(
             "Invalid 'connectionHandle' parameter specified"));
+    try {
+        check_reaped_transaction(false, handle);
+    } catch (...) {
+        creg->put(conn);
+        throw;
+    }
     wilton_DBTransaction* tran;
     char* err = wilton_DBTransaction_start(conn, std::addressof(tran));
     creg->put(conn);
@@ -223,6 +898,10 @@ support::buffer transaction_start(sl::io::span<const char> data) {
             "\ndb_transaction_start error for input data"));
     auto treg = tran_registry();
     int64_t thandle = treg->put(tran);
+    // thread connections cannot be taken by the reaper thread
+    if (nullptr == thread_connections::current().find(false, handle)) {
+        tran_reaper()->track(false, thandle, handle);
+    }
     return support::make_json_buffer({
         { "transactionHandle", thandle}
     });
@@ -242,16 +921,26 @@ support::buffer transaction_commit(sl::io::span<const char> data) {
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
             "Required parameter 'transactionHandle' not specified"));
+    auto reaper = tran_reaper();
+    if (reaper->take_expired(false, handle)) {
+        throw_expired_transaction(handle);
+    }
     // get handle
     auto treg = tran_registry();
     wilton_DBTransaction* tran = treg->remove(handle);
-    if (nullptr == tran) throw support::exception(TRACEMSG(
-            "Invalid 'transactionHandle' parameter specified"));
+    if (nullptr == tran) {
+        // rolled back concurrently
+        if (reaper->take_expired(false, handle)) {
+            throw_expired_transaction(handle);
+        }
+        throw support::exception(TRACEMSG("Invalid 'transactionHandle' parameter specified"));
+    }
     char* err = wilton_DBTransaction_commit(tran);
     if (nullptr != err) {
         treg->put(tran);
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    reaper->untrack(false, handle);
     return support::make_null_buffer();
 }
 
@@ -269,40 +958,102 @@ support::buffer transaction_rollback(sl::io::span<const char> data) {
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
             "Required parameter 'transactionHandle' not specified"));
+    auto reaper = tran_reaper();
+    // already rolled back
+    if (reaper->take_expired(false, handle)) {
+        return support::make_null_buffer();
+    }
     // get handle
     auto treg = tran_registry();
     wilton_DBTransaction* tran = treg->remove(handle);
-    if (nullptr == tran) throw support::exception(TRACEMSG(
-            "Invalid 'transactionHandle' parameter specified"));
+    if (nullptr == tran) {
+        if (reaper->take_expired(false, handle)) {
+            return support::make_null_buffer();
+        }
+        throw support::exception(TRACEMSG("Invalid 'transactionHandle' parameter specified"));
+    }
     char* err = wilton_DBTransaction_rollback(tran);
     if (nullptr != err) {
         treg->put(tran);
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    reaper->untrack(false, handle);
     return support::make_null_buffer();
 }
 
 
+sl::json::value load_catalog_file(const std::string& path) {
+    std::ifstream stream{path, std::ios::binary};
+    if (!stream.is_open()) throw support::exception(TRACEMSG(
+            "Cannot open statements catalog file, path: [" + path + "]"));
+    auto contents = std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    auto json = sl::json::loads(contents);
+    json.as_object_or_throw(path);
+    return json;
+}
+
 support::buffer db_pgsql_connection_open(sl::io::span<const char> data) {
     // json parse
     auto json = sl::json::load(data);
     auto parameters = std::string{};
-    for (const sl::json::field& fi : json.as_object()) {
+    bool affine = false;
+    auto catalog = sl::json::value();
+    auto limits = pgsql::result_limits();
+    for (sl::json::field& fi : json.as_object()) {
         auto& name = fi.name();
         if ("parameters" == name) {
             parameters = fi.as_string_nonempty_or_throw(name);
+        } else if ("maxRows" == name) {
+            limits.max_rows = fi.as_uint32_positive_or_throw(name);
+        } else if ("maxResultBytes" == name) {
+            limits.max_bytes = parse_max_result_bytes(fi);
+        } else if ("affinity" == name) {
+            affine = parse_affinity(fi);
+        } else if ("catalog" == name) {
+            fi.as_object_or_throw(name);
+            catalog = std::move(fi.val());
+        } else if ("catalogFile" == name) {
+            catalog = load_catalog_file(fi.as_string_nonempty_or_throw(name));
         } else  {
             throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
         }
     }
     if (parameters.empty()) throw support::exception(TRACEMSG(
             "Required parameter 'parameters' not specified"));
+    auto affine_key = parameters;
+    if (sl::json::type::object == catalog.json_type()) {
+        affine_key += catalog.dumps();
+    }
+    if (limits.enabled()) {
+        affine_key += "|" + sl::support::to_string(limits.max_rows) + "|" + sl::support::to_string(limits.max_bytes);
+    }
+    if (affine) {
+        int64_t existing = reuse_affine_connection(affine_key);
+        if (-1 != existing) {
+            return support::make_json_buffer({
+                { "connectionHandle", existing}
+            });
+        }
+    }
 
     wilton_PGConnection* conn;
     char* err = wilton_PGConnection_open(std::addressof(conn), parameters.c_str(), static_cast<int>(parameters.size()));
     if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
-    auto reg = psql_conn_registry();
-    int64_t handle = reg->put(conn);
+    pgsql_set_result_limits(conn, limits);
+    if (sl::json::type::object == catalog.json_type()) {
+        try {
+            pgsql_load_catalog(conn, catalog);
+        } catch (...) {
+            char* cerr = wilton_PGConnection_close(conn);
+            if (nullptr != cerr) {
+                wilton_free(cerr);
+            }
+            throw;
+        }
+    }
+    int64_t handle = affine ? thread_connections::current().put(affine_key, true, conn) :
+            psql_conn_registry()->put(conn);
+    psql_cancel_reg()->put(handle, conn);
     return support::make_json_buffer({
         { "connectionHandle", handle}
     });
@@ -322,60 +1073,419 @@ support::buffer db_pgsql_connection_close(sl::io::span<const char> data) {
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
             "Required parameter 'connectionHandle' not specified"));
-    // get handle
+    // get handle, thread connections can only be closed on their own thread
     auto reg = psql_conn_registry();
     wilton_PGConnection* conn = reg->remove(handle);
     if (nullptr == conn) throw support::exception(TRACEMSG(
             "Invalid 'connectionHandle' parameter specified"));
+    auto creg = psql_cancel_reg();
+    creg->remove(handle);
     // call wilton
     char* err = wilton_PGConnection_close(conn);
     if (nullptr != err) {
         reg->put(conn);
+        creg->put(handle, conn);
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    thread_connections::current().erase(true, handle);
+    tran_reaper()->untrack(true, handle);
+    return support::make_null_buffer();
+}
+
+support::buffer thread_connections_close(sl::io::span<const char>) {
+    thread_connections::current().close_all();
     return support::make_null_buffer();
 }
 
-support::buffer db_pgsql_connection_execute_sql (sl::io::span<const char> data) {
+support::buffer tracing_start(sl::io::span<const char> data) {
     // json parse
+    auto json = sl::json::load(data);
+    uint32_t max_events = 100000;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("maxEvents" == name) {
+            max_events = fi.as_uint32_positive_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    trace_recorder::instance().start(max_events);
+    return support::make_null_buffer();
+}
+
+support::buffer tracing_stop(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    auto path = std::string();
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("path" == name) {
+            path = fi.as_string_nonempty_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (path.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'path' not specified"));
+    uint64_t count = trace_recorder::instance().stop(path);
+    return support::make_json_buffer({
+        { "events", static_cast<int64_t>(count) }
+    });
+}
+
+support::buffer db_pgsql_bulk_upsert(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    int64_t handle = -1;
+    uint32_t timeout_millis = 0;
+    auto input_fields = std::vector<sl::json::field>();
+    for (sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("connectionHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
+        } else if ("timeoutMillis" == name) {
+            timeout_millis = fi.as_uint32_or_throw(name);
+        } else {
+            input_fields.emplace_back(name, std::move(fi.val()));
+        }
+    }
+    if (-1 == handle) throw support::exception(TRACEMSG(
+            "Required parameter 'connectionHandle' not specified"));
+    auto input = sl::json::value(std::move(input_fields));
+    auto st = pgsql::build_bulk_upsert(input);
+    // get handle
+    auto reg = psql_conn_registry();
+    wilton_PGConnection* conn = reg->remove(handle);
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton, statement shape depends only on columns, so it is prepared
+    try {
+        check_reaped_transaction(true, handle);
+        auto options = pgsql::execution_options(true, timeout_millis);
+        auto res = pgsql_execute_sql(conn, st.sql, st.params, options);
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        check_pgsql_failure(conn, handle);
+        reg->put(conn);
+        throw;
+    }
+}
+
+support::buffer db_pgsql_coalescer_open(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    auto parameters = std::string{};
+    uint32_t window_millis = 5;
+    uint32_t max_batch = 100;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("parameters" == name) {
+            parameters = fi.as_string_nonempty_or_throw(name);
+        } else if ("windowMillis" == name) {
+            window_millis = fi.as_uint32_or_throw(name);
+        } else if ("maxBatch" == name) {
+            max_batch = fi.as_uint32_positive_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (parameters.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'parameters' not specified"));
+    // open
+    auto coalescer = std::make_shared<pgsql_write_coalescer>(parameters, window_millis, max_batch);
+    int64_t handle = coalescer_reg()->put(std::move(coalescer));
+    return support::make_json_buffer({
+        { "coalescerHandle", handle}
+    });
+}
+
+support::buffer db_pgsql_coalescer_submit(sl::io::span<const char> data) {
+    auto req = parse_orm_statement_request(data, "coalescerHandle");
+    if (result_encoding::json != req.encoding) throw support::exception(TRACEMSG(
+            "Parameter 'resultEncoding' is not supported for coalesced writes"));
+    auto coalescer = coalescer_reg()->peek(req.handle);
+    auto res = coalescer->submit(req.sql, req.params);
+    return support::make_json_buffer(res);
+}
+
+support::buffer db_pgsql_coalescer_stats(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    int64_t handle = -1;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("coalescerHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == handle) throw support::exception(TRACEMSG(
+            "Required parameter 'coalescerHandle' not specified"));
+    auto coalescer = coalescer_reg()->peek(handle);
+    return support::make_json_buffer(coalescer->get_stats());
+}
+
+support::buffer db_pgsql_coalescer_close(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    int64_t handle = -1;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("coalescerHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == handle) throw support::exception(TRACEMSG(
+            "Required parameter 'coalescerHandle' not specified"));
+    coalescer_reg()->remove(handle);
+    return support::make_null_buffer();
+}
+
+support::buffer db_pgsql_multiplexer_open(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    auto parameters = std::string{};
+    uint32_t backends = 2;
+    uint32_t max_pipeline = 64;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("parameters" == name) {
+            parameters = fi.as_string_nonempty_or_throw(name);
+        } else if ("backends" == name) {
+            backends = fi.as_uint32_positive_or_throw(name);
+        } else if ("maxPipeline" == name) {
+            max_pipeline = fi.as_uint32_positive_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (parameters.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'parameters' not specified"));
+    // open
+    auto multiplexer = std::make_shared<pgsql_multiplexer>(parameters, backends, max_pipeline);
+    int64_t handle = multiplexer_reg()->put(std::move(multiplexer));
+    return support::make_json_buffer({
+        { "multiplexerHandle", handle}
+    });
+}
+
+support::buffer db_pgsql_multiplexer_execute(sl::io::span<const char> data) {
+    auto req = parse_orm_statement_request(data, "multiplexerHandle");
+    if (result_encoding::json != req.encoding) throw support::exception(TRACEMSG(
+            "Parameter 'resultEncoding' is not supported for multiplexed statements"));
+    auto multiplexer = multiplexer_reg()->peek(req.handle);
+    auto res = multiplexer->execute(req.sql, req.params);
+    return support::make_json_buffer(res);
+}
+
+support::buffer db_pgsql_multiplexer_run_in_transaction(sl::io::span<const char> data) {
+    auto req = parse_pgsql_transaction_request(data, "multiplexerHandle");
+    auto multiplexer = multiplexer_reg()->peek(req.handle);
+    auto retry = pgsql::transaction_retry_options(req.max_retries,
+            req.base_delay_millis, req.max_delay_millis);
+    auto res = multiplexer->run_in_transaction(req.statements, retry);
+    return support::make_json_buffer(res);
+}
+
+support::buffer db_pgsql_multiplexer_stats(sl::io::span<const char> data) {
     auto json = sl::json::load(data);
     int64_t handle = -1;
-    auto sql_text = std::string{};
-    auto params = std::string{"{}"}; // empty json by default
-    bool cache_flag = true; // ON by default
     for (const sl::json::field& fi : json.as_object()) {
-        auto& field_name = fi.name();
-        if ("connectionHandle" == field_name) {
-            handle = fi.as_int64_or_throw(field_name);
-        } else if ("sql" == field_name) {
-            sql_text = fi.as_string_nonempty_or_throw(field_name);
-        } else if ("params" == field_name) {
-            params = fi.val().dumps();
-        } else if ("cache" == field_name) {
-            cache_flag = fi.as_bool_or_throw(field_name);
+        auto& name = fi.name();
+        if ("multiplexerHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
         } else {
-            throw support::exception(TRACEMSG("Unknown data field: [" + field_name + "]"));
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
         }
     }
+    if (-1 == handle) throw support::exception(TRACEMSG(
+            "Required parameter 'multiplexerHandle' not specified"));
+    auto multiplexer = multiplexer_reg()->peek(handle);
+    return support::make_json_buffer(multiplexer->get_stats());
+}
 
+support::buffer db_pgsql_multiplexer_close(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    int64_t handle = -1;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("multiplexerHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == handle) throw support::exception(TRACEMSG(
+            "Required parameter 'multiplexerHandle' not specified"));
+    multiplexer_reg()->remove(handle);
+    return support::make_null_buffer();
+}
+
+support::buffer db_pgsql_connection_cancel(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    int64_t handle = -1;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("connectionHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
     if (-1 == handle) throw support::exception(TRACEMSG(
             "Required parameter 'connectionHandle' not specified"));
+    // registry lookup is not used here, handle is busy during execution
+    bool found = psql_cancel_reg()->cancel(handle);
+    if (!found) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    return support::make_null_buffer();
+}
 
+support::buffer db_pgsql_connection_execute_sql(sl::io::span<const char> data) {
+    trace_span call_span{"db_pgsql_connection_execute_sql"};
+    // json parse
+    auto req = pgsql_execute_request();
+    {
+        trace_span span{"parse_request"};
+        req = parse_pgsql_execute_request(data);
+    }
+    // get handle
+    auto reg = psql_conn_registry();
+    wilton_PGConnection* conn = nullptr;
+    {
+        trace_span span{"registry"};
+        conn = reg->remove(req.handle);
+    }
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton, params are passed without serializing them back
+    try {
+        check_reaped_transaction(true, req.handle);
+        if (!req.statement.empty()) {
+            // catalog statements are always prepared
+            req.sql = pgsql_catalog_sql(conn, req.statement);
+            req.cache_flag = true;
+        }
+        auto options = pgsql::execution_options(req.cache_flag, req.timeout_millis, req.encoding);
+        options.limits = req.limits;
+        options.sink = req.sink;
+        auto res = pgsql_execute_sql(conn, req.sql, req.params, options);
+        trace_span span{"registry"};
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        check_pgsql_failure(conn, req.handle);
+        reg->put(conn);
+        throw;
+    }
+}
+
+support::buffer db_pgsql_run_in_transaction(sl::io::span<const char> data) {
+    // json parse
+    auto req = parse_pgsql_transaction_request(data);
+    // get handle
+    auto reg = psql_conn_registry();
+    wilton_PGConnection* conn = reg->remove(req.handle);
+    if (nullptr == conn) throw support::exception(TRACEMSG(
+            "Invalid 'connectionHandle' parameter specified"));
+    // call wilton
+    try {
+        check_reaped_transaction(true, req.handle);
+        auto retry = pgsql::transaction_retry_options(req.max_retries,
+                req.base_delay_millis, req.max_delay_millis);
+        auto res = pgsql_run_in_transaction(conn, req.statements, retry);
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        reg->put(conn);
+        throw;
+    }
+}
+
+support::buffer db_pgsql_connection_stats(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    int64_t handle = -1;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("connectionHandle" == name) {
+            handle = fi.as_int64_or_throw(name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == handle) throw support::exception(TRACEMSG(
+            "Required parameter 'connectionHandle' not specified"));
     // get handle
     auto reg = psql_conn_registry();
     wilton_PGConnection* conn = reg->remove(handle);
     if (nullptr == conn) throw support::exception(TRACEMSG(
             "Invalid 'connectionHandle' parameter specified"));
     // call wilton
-    char* out = nullptr;
-    int out_len = 0;
-    char* err = wilton_PGConnection_execute_sql(conn,
-            sql_text.c_str(), static_cast<int>(sql_text.length()),
-            params.c_str(), static_cast<int>(params.length()), cache_flag,
-            std::addressof(out), std::addressof(out_len));
-    reg->put(conn);
-    if (nullptr != err) support::throw_wilton_error(err, TRACEMSG(err));
-    return support::wrap_wilton_buffer(out, out_len);
+    try {
+        auto res = pgsql_stats(conn);
+        reg->put(conn);
+        return res;
+    } catch (...) {
+        reg->put(conn);
+        throw;
+    }
+}
+
+support::buffer db_pgsql_lo_import(sl::io::span<const char> data) {
+    auto req = parse_pgsql_lo_request(data);
+    require_lo_fields(req, false, true);
+    return with_pgsql_connection(req.handle, [&req](wilton_PGConnection* conn) {
+        return pgsql_lo_import(conn, req.path);
+    });
+}
+
+support::buffer db_pgsql_lo_export(sl::io::span<const char> data) {
+    auto req = parse_pgsql_lo_request(data);
+    require_lo_fields(req, true, true);
+    return with_pgsql_connection(req.handle, [&req](wilton_PGConnection* conn) {
+        pgsql_lo_export(conn, req.oid, req.path);
+        return support::make_null_buffer();
+    });
+}
+
+support::buffer db_pgsql_lo_create(sl::io::span<const char> data) {
+    auto req = parse_pgsql_lo_request(data);
+    return with_pgsql_connection(req.handle, [](wilton_PGConnection* conn) {
+        return pgsql_lo_create(conn);
+    });
+}
+
+support::buffer db_pgsql_lo_unlink(sl::io::span<const char> data) {
+    auto req = parse_pgsql_lo_request(data);
+    require_lo_fields(req, true, false);
+    return with_pgsql_connection(req.handle, [&req](wilton_PGConnection* conn) {
+        pgsql_lo_unlink(conn, req.oid);
+        return support::make_null_buffer();
+    });
+}
+
+support::buffer db_pgsql_lo_read(sl::io::span<const char> data) {
+    auto req = parse_pgsql_lo_request(data);
+    require_lo_fields(req, true, false);
+    if (!req.length_specified) throw support::exception(TRACEMSG(
+            "Required parameter 'length' not specified"));
+    return with_pgsql_connection(req.handle, [&req](wilton_PGConnection* conn) {
+        return pgsql_lo_read(conn, req.oid, req.offset, req.length, req.encoding);
+    });
+}
+
+support::buffer db_pgsql_lo_write(sl::io::span<const char> data) {
+    auto req = parse_pgsql_lo_request(data);
+    require_lo_fields(req, true, false);
+    if (!req.data_specified) throw support::exception(TRACEMSG(
+            "Required parameter 'data' not specified"));
+    return with_pgsql_connection(req.handle, [&req](wilton_PGConnection* conn) {
+        return pgsql_lo_write(conn, req.oid, req.offset, req.data);
+    });
 }
 
 support::buffer db_pgsql_transaction_begin(sl::io::span<const char> data) {
@@ -397,12 +1507,22 @@ support::buffer db_pgsql_transaction_begin(sl::io::span<const char> data) {
     wilton_PGConnection* conn = reg->remove(handle);
     if (nullptr == conn) throw support::exception(TRACEMSG(
             "Invalid 'connectionHandle' parameter specified"));
+    try {
+        check_reaped_transaction(true, handle);
+    } catch (...) {
+        reg->put(conn);
+        throw;
+    }
     // call wilton
     char* err = wilton_PGConnection_transaction_begin(conn);
     reg->put(conn);
     if (nullptr != err) {
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    // thread connections cannot be taken by the reaper thread
+    if (nullptr == thread_connections::current().find(true, handle)) {
+        tran_reaper()->track(true, handle, handle);
+    }
     return support::make_null_buffer();
 }
 
@@ -420,17 +1540,27 @@ support::buffer db_pgsql_transaction_commit(sl::io::span<const char> data) {
     }
     if (-1 == handle) throw support::exception(TRACEMSG(
             "Required parameter 'connectionHandle' not specified"));
+    // commit without transaction only warns on server
+    auto reaper = tran_reaper();
+    if (reaper->take_expired(true, handle)) {
+        throw_expired_transaction(handle);
+    }
     // get handle
     auto reg = psql_conn_registry();
     wilton_PGConnection* conn = reg->remove(handle);
-    if (nullptr == conn) throw support::exception(TRACEMSG(
-            "Invalid 'connectionHandle' parameter specified"));
+    if (nullptr == conn) {
+        if (reaper->take_expired(true, handle)) {
+            throw_expired_transaction(handle);
+        }
+        throw support::exception(TRACEMSG("Invalid 'connectionHandle' parameter specified"));
+    }
     // call wilton
     char* err = wilton_PGConnection_transaction_commit(conn);
     reg->put(conn);
     if (nullptr != err) {
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    reaper->untrack(true, handle);
     return support::make_null_buffer();
 }
 
@@ -459,9 +1589,33 @@ support::buffer db_pgsql_transaction_rollback(sl::io::span<const char> data) {
     if (nullptr != err) {
         support::throw_wilton_error(err, TRACEMSG(err));
     }
+    tran_reaper()->untrack(true, handle);
     return support::make_null_buffer();
 }
 
+support::buffer transaction_reaper_configure(sl::io::span<const char> data) {
+    // json parse
+    auto json = sl::json::load(data);
+    uint32_t max_age_millis = 0;
+    bool max_age_specified = false;
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("maxAgeMillis" == name) {
+            max_age_millis = fi.as_uint32_or_throw(name);
+            max_age_specified = true;
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (!max_age_specified) throw support::exception(TRACEMSG(
+            "Required parameter 'maxAgeMillis' not specified"));
+    tran_reaper()->set_max_age(max_age_millis);
+    return support::make_null_buffer();
+}
+
+support::buffer transaction_reaper_stats(sl::io::span<const char>) {
+    return support::make_json_buffer(tran_reaper()->get_stats());
+}
 
 } // namespace
 }
@@ -470,22 +1624,62 @@ extern "C" char* wilton_module_init() {
     try {
         wilton::db::conn_registry();
         wilton::db::tran_registry();
+        wilton::db::cursor_registry();
+        wilton::db::pool_reg();
+        wilton::db::coalescer_reg();
+        wilton::db::multiplexer_reg();
         wilton::db::psql_conn_registry();
+        wilton::db::psql_cancel_reg();
+        wilton::db::tran_reaper();
         auto err = wilton_DBConnection_initialize_backends();
         if (nullptr != err) wilton::support::throw_wilton_error(err, TRACEMSG(err));
 
         wilton::support::register_wiltoncall("db_connection_open", wilton::db::connection_open);
         wilton::support::register_wiltoncall("db_connection_query", wilton::db::connection_query);
         wilton::support::register_wiltoncall("db_connection_execute", wilton::db::connection_execute);
+        wilton::support::register_wiltoncall("db_connection_execute_batch", wilton::db::connection_execute_batch);
+        wilton::support::register_wiltoncall("db_connection_batch", wilton::db::connection_batch);
+        wilton::support::register_wiltoncall("db_thread_connections_close", wilton::db::thread_connections_close);
+        wilton::support::register_wiltoncall("db_tracing_start", wilton::db::tracing_start);
+        wilton::support::register_wiltoncall("db_tracing_stop", wilton::db::tracing_stop);
+        wilton::support::register_wiltoncall("db_pool_open", wilton::db::pool_open);
+        wilton::support::register_wiltoncall("db_pool_query", wilton::db::pool_query);
+        wilton::support::register_wiltoncall("db_pool_execute", wilton::db::pool_execute);
+        wilton::support::register_wiltoncall("db_pool_execute_batch", wilton::db::pool_execute_batch);
+        wilton::support::register_wiltoncall("db_pool_close", wilton::db::pool_close);
+        wilton::support::register_wiltoncall("db_cursor_open", wilton::db::cursor_open);
+        wilton::support::register_wiltoncall("db_cursor_fetch", wilton::db::cursor_fetch);
+        wilton::support::register_wiltoncall("db_cursor_close", wilton::db::cursor_close);
         wilton::support::register_wiltoncall("db_connection_close", wilton::db::connection_close);
         wilton::support::register_wiltoncall("db_transaction_start", wilton::db::transaction_start);
         wilton::support::register_wiltoncall("db_transaction_commit", wilton::db::transaction_commit);
         wilton::support::register_wiltoncall("db_transaction_rollback", wilton::db::transaction_rollback);
+        wilton::support::register_wiltoncall("db_transaction_reaper_configure", wilton::db::transaction_reaper_configure);
+        wilton::support::register_wiltoncall("db_transaction_reaper_stats", wilton::db::transaction_reaper_stats);
 
         // postgresql
         wilton::support::register_wiltoncall("db_pgsql_connection_open", wilton::db::db_pgsql_connection_open);
         wilton::support::register_wiltoncall("db_pgsql_connection_close", wilton::db::db_pgsql_connection_close);
         wilton::support::register_wiltoncall("db_pgsql_connection_execute_sql", wilton::db::db_pgsql_connection_execute_sql);
+        wilton::support::register_wiltoncall("db_pgsql_connection_cancel", wilton::db::db_pgsql_connection_cancel);
+        wilton::support::register_wiltoncall("db_pgsql_run_in_transaction", wilton::db::db_pgsql_run_in_transaction);
+        wilton::support::register_wiltoncall("db_pgsql_connection_stats", wilton::db::db_pgsql_connection_stats);
+        wilton::support::register_wiltoncall("db_pgsql_bulk_upsert", wilton::db::db_pgsql_bulk_upsert);
+        wilton::support::register_wiltoncall("db_pgsql_lo_import", wilton::db::db_pgsql_lo_import);
+        wilton::support::register_wiltoncall("db_pgsql_lo_export", wilton::db::db_pgsql_lo_export);
+        wilton::support::register_wiltoncall("db_pgsql_lo_create", wilton::db::db_pgsql_lo_create);
+        wilton::support::register_wiltoncall("db_pgsql_lo_unlink", wilton::db::db_pgsql_lo_unlink);
+        wilton::support::register_wiltoncall("db_pgsql_lo_read", wilton::db::db_pgsql_lo_read);
+        wilton::support::register_wiltoncall("db_pgsql_lo_write", wilton::db::db_pgsql_lo_write);
+        wilton::support::register_wiltoncall("db_pgsql_coalescer_open", wilton::db::db_pgsql_coalescer_open);
+        wilton::support::register_wiltoncall("db_pgsql_coalescer_submit", wilton::db::db_pgsql_coalescer_submit);
+        wilton::support::register_wiltoncall("db_pgsql_coalescer_stats", wilton::db::db_pgsql_coalescer_stats);
+        wilton::support::register_wiltoncall("db_pgsql_coalescer_close", wilton::db::db_pgsql_coalescer_close);
+        wilton::support::register_wiltoncall("db_pgsql_multiplexer_open", wilton::db::db_pgsql_multiplexer_open);
+        wilton::support::register_wiltoncall("db_pgsql_multiplexer_execute", wilton::db::db_pgsql_multiplexer_execute);
+        wilton::support::register_wiltoncall("db_pgsql_multiplexer_run_in_transaction", wilton::db::db_pgsql_multiplexer_run_in_transaction);
+        wilton::support::register_wiltoncall("db_pgsql_multiplexer_stats", wilton::db::db_pgsql_multiplexer_stats);
+        wilton::support::register_wiltoncall("db_pgsql_multiplexer_close", wilton::db::db_pgsql_multiplexer_close);
 
         wilton::support::register_wiltoncall("db_pgsql_transaction_begin", wilton::db::db_pgsql_transaction_begin);
         wilton::support::register_wiltoncall("db_pgsql_transaction_commit", wilton::db::db_pgsql_transaction_commit);
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   wiltoncall_db_requests.hpp
+ * Author: alex
+ *
+ * Input parsing for statement calls, kept apart from wiltoncall_db.cpp
+ * so it can be benchmarked without the module.
+ */
+
+#ifndef WILTON_DB_WILTONCALL_DB_REQUESTS_HPP
+#define WILTON_DB_WILTONCALL_DB_REQUESTS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "staticlib/io.hpp"
+#include "staticlib/json.hpp"
+
+#include "wilton/support/exception.hpp"
+
+#include "msgpack_encoding.hpp"
+#include "psql_functions.hpp"
+#include "wilton_db_internal.hpp"
+
+namespace wilton {
+namespace db {
+
+// parsed params are passed to the handlers as is, without
+// serializing them back to string
+struct orm_statement_request {
+    int64_t handle = -1;
+    std::string sql;
+    sl::json::value params = sl::json::value(std::vector<sl::json::field>()); // empty json by default
+    result_encoding encoding = result_encoding::json;
+};
+
+struct orm_cursor_fetch_request {
+    int64_t handle = -1;
+    uint32_t max_rows = 1000;
+    result_encoding encoding = result_encoding::json;
+};
+
+struct orm_batch_request {
+    int64_t handle = -1;
+    std::string sql;
+    std::vector<sl::json::value> params_list;
+};
+
+struct orm_operations_request {
+    int64_t handle = -1;
+    std::vector<orm_operation> operations;
+    bool transaction = false;
+    result_encoding encoding = result_encoding::json;
+};
+
+struct pgsql_execute_request {
+    int64_t handle = -1;
+    std::string sql;
+    // name of the statement from connection catalog, instead of sql
+    std::string statement;
+    sl::json::value params = sl::json::value(std::vector<sl::json::field>()); // empty json by default
+    bool cache_flag = true; // ON by default
+    uint32_t timeout_millis = 0; // no timeout by default
+    result_encoding encoding = result_encoding::json;
+    // connection limits by default
+    pgsql::result_limits limits;
+    pgsql::result_sink sink;
+};
+
+struct pgsql_transaction_request {
+    int64_t handle = -1;
+    std::vector<pgsql::transaction_statement> statements;
+    uint32_t max_retries = 5;
+    uint32_t base_delay_millis = 10;
+    uint32_t max_delay_millis = 1000;
+};
+
+// required fields depend on the call
+struct pgsql_lo_request {
+    int64_t handle = -1;
+    uint32_t oid = 0;
+    bool oid_specified = false;
+    int64_t offset = 0;
+    uint32_t length = 0;
+    bool length_specified = false;
+    std::string path;
+    // decoded from hex
+    std::string data;
+    bool data_specified = false;
+    result_encoding encoding = result_encoding::json;
+};
+
+// limits over 4GB are allowed
+inline uint64_t parse_max_result_bytes(const sl::json::field& fi) {
+    int64_t val = fi.as_int64_or_throw(fi.name());
+    if (val <= 0) throw support::exception(TRACEMSG(
+            "Invalid '" + fi.name() + "' parameter specified: [" + sl::support::to_string(val) + "]"));
+    return static_cast<uint64_t>(val);
+}
+
+// db_connection_query and db_connection_execute, 'handleName' is different for pools
+inline orm_statement_request parse_orm_statement_request(sl::io::span<const char> data,
+        const std::string& handle_name = "connectionHandle") {
+    auto json = sl::json::load(data);
+    auto req = orm_statement_request();
+    for (sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if (handle_name == name) {
+            req.handle = fi.as_int64_or_throw(name);
+        } else if ("sql" == name) {
+            req.sql = fi.as_string_nonempty_or_throw(name);
+        } else if ("params" == name) {
+            req.params = std::move(fi.val());
+        } else if ("resultEncoding" == name) {
+            req.encoding = parse_result_encoding(fi.as_string_nonempty_or_throw(name));
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter '" + handle_name + "' not specified"));
+    if (req.sql.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'sql' not specified"));
+    return req;
+}
+
+// db_cursor_fetch
+inline orm_cursor_fetch_request parse_orm_cursor_fetch_request(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    auto req = orm_cursor_fetch_request();
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("cursorHandle" == name) {
+            req.handle = fi.as_int64_or_throw(name);
+        } else if ("maxRows" == name) {
+            req.max_rows = fi.as_uint32_positive_or_throw(name);
+        } else if ("resultEncoding" == name) {
+            req.encoding = parse_result_encoding(fi.as_string_nonempty_or_throw(name));
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter 'cursorHandle' not specified"));
+    return req;
+}
+
+// db_connection_execute_batch
+inline orm_batch_request parse_orm_batch_request(sl::io::span<const char> data,
+        const std::string& handle_name = "connectionHandle") {
+    auto json = sl::json::load(data);
+    auto req = orm_batch_request();
+    bool params_specified = false;
+    for (sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if (handle_name == name) {
+            req.handle = fi.as_int64_or_throw(name);
+        } else if ("sql" == name) {
+            req.sql = fi.as_string_nonempty_or_throw(name);
+        } else if ("params" == name) {
+            fi.as_array_or_throw(name);
+            req.params_list = std::move(fi.val().as_array());
+            params_specified = true;
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter '" + handle_name + "' not specified"));
+    if (req.sql.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'sql' not specified"));
+    if (!params_specified) throw support::exception(TRACEMSG(
+            "Required parameter 'params' not specified"));
+    return req;
+}
+
+// db_connection_batch
+inline orm_operations_request parse_orm_operations_request(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    auto req = orm_operations_request();
+    for (sl::json::field& fi : json.as_object()) {
+        auto& field_name = fi.name();
+        if ("connectionHandle" == field_name) {
+            req.handle = fi.as_int64_or_throw(field_name);
+        } else if ("operations" == field_name) {
+            fi.as_array_or_throw(field_name);
+            for (sl::json::value& op_json : fi.val().as_array()) {
+                auto op = orm_operation();
+                bool type_specified = false;
+                op_json.as_object_or_throw(field_name);
+                for (sl::json::field& of : op_json.as_object()) {
+                    auto& name = of.name();
+                    if ("type" == name) {
+                        auto& type = of.as_string_nonempty_or_throw(name);
+                        if ("query" == type) {
+                            op.query = true;
+                        } else if ("execute" == type) {
+                            op.query = false;
+                        } else {
+                            throw support::exception(TRACEMSG("Invalid operation type specified: [" + type + "]," +
+                                    " supported types: [query, execute]"));
+                        }
+                        type_specified = true;
+                    } else if ("sql" == name) {
+                        op.sql = of.as_string_nonempty_or_throw(name);
+                    } else if ("params" == name) {
+                        op.params = std::move(of.val());
+                    } else {
+                        throw support::exception(TRACEMSG("Unknown operation field: [" + name + "]"));
+                    }
+                }
+                if (!type_specified) throw support::exception(TRACEMSG(
+                        "Required operation parameter 'type' not specified"));
+                if (op.sql.empty()) throw support::exception(TRACEMSG(
+                        "Required operation parameter 'sql' not specified"));
+                req.operations.emplace_back(std::move(op));
+            }
+        } else if ("transaction" == field_name) {
+            req.transaction = fi.as_bool_or_throw(field_name);
+        } else if ("resultEncoding" == field_name) {
+            req.encoding = parse_result_encoding(fi.as_string_nonempty_or_throw(field_name));
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + field_name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter 'connectionHandle' not specified"));
+    if (req.operations.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'operations' not specified"));
+    return req;
+}
+
+// db_pgsql_connection_execute_sql
+inline pgsql_execute_request parse_pgsql_execute_request(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    auto req = pgsql_execute_request();
+    for (sl::json::field& fi : json.as_object()) {
+        auto& field_name = fi.name();
+        if ("connectionHandle" == field_name) {
+            req.handle = fi.as_int64_or_throw(field_name);
+        } else if ("sql" == field_name) {
+            req.sql = fi.as_string_nonempty_or_throw(field_name);
+        } else if ("statement" == field_name) {
+            req.statement = fi.as_string_nonempty_or_throw(field_name);
+        } else if ("params" == field_name) {
+            req.params = std::move(fi.val());
+        } else if ("cache" == field_name) {
+            req.cache_flag = fi.as_bool_or_throw(field_name);
+        } else if ("timeoutMillis" == field_name) {
+            req.timeout_millis = fi.as_uint32_or_throw(field_name);
+        } else if ("resultEncoding" == field_name) {
+            req.encoding = parse_result_encoding(fi.as_string_nonempty_or_throw(field_name));
+        } else if ("maxRows" == field_name) {
+            req.limits.max_rows = fi.as_uint32_positive_or_throw(field_name);
+        } else if ("maxResultBytes" == field_name) {
+            req.limits.max_bytes = parse_max_result_bytes(fi);
+        } else if ("resultSink" == field_name) {
+            fi.as_object_or_throw(field_name);
+            for (const sl::json::field& sf : fi.val().as_object()) {
+                auto& name = sf.name();
+                if ("file" == name) {
+                    req.sink.file = sf.as_string_nonempty_or_throw(name);
+                } else if ("blockRows" == name) {
+                    req.sink.block_rows = sf.as_uint32_positive_or_throw(name);
+                } else {
+                    throw support::exception(TRACEMSG("Unknown result sink field: [" + name + "]"));
+                }
+            }
+            if (!req.sink.enabled()) throw support::exception(TRACEMSG(
+                    "Required result sink parameter 'file' not specified"));
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + field_name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter 'connectionHandle' not specified"));
+    if (!req.sql.empty() && !req.statement.empty()) throw support::exception(TRACEMSG(
+            "Parameters 'sql' and 'statement' cannot be specified together"));
+    if (req.sql.empty() && req.statement.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'sql' not specified"));
+    return req;
+}
+
+// db_pgsql_run_in_transaction
+inline pgsql_transaction_request parse_pgsql_transaction_request(sl::io::span<const char> data,
+        const std::string& handle_name = "connectionHandle") {
+    auto json = sl::json::load(data);
+    auto req = pgsql_transaction_request();
+    for (sl::json::field& fi : json.as_object()) {
+        auto& field_name = fi.name();
+        if (handle_name == field_name) {
+            req.handle = fi.as_int64_or_throw(field_name);
+        } else if ("statements" == field_name) {
+            fi.as_array_or_throw(field_name);
+            for (sl::json::value& st : fi.val().as_array()) {
+                auto sql = std::string();
+                auto params = sl::json::value(std::vector<sl::json::field>());
+                bool cache_flag = true;
+                st.as_object_or_throw(field_name);
+                for (sl::json::field& sf : st.as_object()) {
+                    auto& name = sf.name();
+                    if ("sql" == name) {
+                        sql = sf.as_string_nonempty_or_throw(name);
+                    } else if ("params" == name) {
+                        params = std::move(sf.val());
+                    } else if ("cache" == name) {
+                        cache_flag = sf.as_bool_or_throw(name);
+                    } else {
+                        throw support::exception(TRACEMSG("Unknown statement field: [" + name + "]"));
+                    }
+                }
+                if (sql.empty()) throw support::exception(TRACEMSG(
+                        "Required statement parameter 'sql' not specified"));
+                req.statements.emplace_back(std::move(sql), std::move(params), cache_flag);
+            }
+        } else if ("maxRetries" == field_name) {
+            req.max_retries = fi.as_uint32_or_throw(field_name);
+        } else if ("baseDelayMillis" == field_name) {
+            req.base_delay_millis = fi.as_uint32_or_throw(field_name);
+        } else if ("maxDelayMillis" == field_name) {
+            req.max_delay_millis = fi.as_uint32_or_throw(field_name);
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + field_name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter '" + handle_name + "' not specified"));
+    if (req.statements.empty()) throw support::exception(TRACEMSG(
+            "Required parameter 'statements' not specified"));
+    return req;
+}
+
+// db_pgsql_lo_*
+inline pgsql_lo_request parse_pgsql_lo_request(sl::io::span<const char> data) {
+    auto json = sl::json::load(data);
+    auto req = pgsql_lo_request();
+    for (const sl::json::field& fi : json.as_object()) {
+        auto& name = fi.name();
+        if ("connectionHandle" == name) {
+            req.handle = fi.as_int64_or_throw(name);
+        } else if ("oid" == name) {
+            req.oid = fi.as_uint32_or_throw(name);
+            req.oid_specified = true;
+        } else if ("offset" == name) {
+            req.offset = fi.as_int64_or_throw(name);
+            if (req.offset < 0) throw support::exception(TRACEMSG(
+                    "Invalid negative 'offset' specified: [" + sl::support::to_string(req.offset) + "]"));
+        } else if ("length" == name) {
+            req.length = fi.as_uint32_positive_or_throw(name);
+            if (req.length > pgsql::lo_max_read_length) throw support::exception(TRACEMSG(
+                    "Invalid 'length' specified: [" + sl::support::to_string(req.length) + "]," +
+                    " max length: [" + sl::support::to_string(pgsql::lo_max_read_length) + "]"));
+            req.length_specified = true;
+        } else if ("path" == name) {
+            req.path = fi.as_string_nonempty_or_throw(name);
+        } else if ("data" == name) {
+            req.data = pgsql::decode_bytea_hex(fi.as_string_or_throw(name));
+            req.data_specified = true;
+        } else if ("resultEncoding" == name) {
+            req.encoding = parse_result_encoding(fi.as_string_nonempty_or_throw(name));
+        } else {
+            throw support::exception(TRACEMSG("Unknown data field: [" + name + "]"));
+        }
+    }
+    if (-1 == req.handle) throw support::exception(TRACEMSG(
+            "Required parameter 'connectionHandle' not specified"));
+    return req;
+}
+
+} // namespace
+}
+
+#endif /* WILTON_DB_WILTONCALL_DB_REQUESTS_HPP */
@@ -0,0 +1,516 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   wilton_db_bench.cpp
+ * Author: alex
+ *
+ * Microbenchmarks for parameters binding and results decoding,
+ * results are built with libpq result-construction functions,
+ * so no database server is required. JSON text encoding is checked
+ * against the reference implementations before measuring.
+ *
+ * Usage: wilton_db_bench [output.json]
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <libpq-fe.h>
+
+#include "staticlib/json.hpp"
+#include "staticlib/support.hpp"
+
+#include "json_text_encoding.hpp"
+#include "psql_functions.hpp"
+#include "wiltoncall_db_requests.hpp"
+
+namespace { // anonymous
+
+namespace pg = wilton::db::pgsql;
+
+const Oid bench_int4oid = 23;
+const Oid bench_int8oid = 20;
+const Oid bench_float8oid = 701;
+const Oid bench_booloid = 16;
+const Oid bench_textoid = 25;
+const Oid bench_jsonoid = 114;
+const Oid bench_int4arrayoid = 1007;
+const Oid bench_textarrayoid = 1009;
+const Oid bench_boolarrayoid = 1000;
+const Oid bench_float8arrayoid = 1022;
+
+const std::chrono::milliseconds min_duration{200};
+const uint64_t min_iterations = 10;
+
+// keeps results observable, so the measured calls are not optimized away
+volatile size_t sink = 0;
+
+struct column_sample {
+    Oid type;
+    std::string value;
+};
+
+std::vector<column_sample> samples() {
+    std::vector<column_sample> res;
+    res.push_back({bench_int4oid, "12345"});
+    res.push_back({bench_int8oid, "1234567890123"});
+    res.push_back({bench_float8oid, "3.141592653589793"});
+    res.push_back({bench_booloid, "t"});
+    res.push_back({bench_textoid, "some text value with \"quotes\""});
+    res.push_back({bench_jsonoid, "{\"foo\": 42, \"bar\": [1, 2, 3]}"});
+    res.push_back({bench_int4arrayoid, "{1,2,3,NULL,5}"});
+    res.push_back({bench_textarrayoid, "{foo,\"bar baz\",NULL,\"qu\\\"x\"}"});
+    return res;
+}
+
+std::vector<column_sample> numeric_samples() {
+    std::vector<column_sample> res;
+    res.push_back({bench_int4oid, "12345"});
+    res.push_back({bench_int8oid, "-1234567890123"});
+    res.push_back({bench_float8oid, "3.141592653589793"});
+    res.push_back({bench_float8oid, "-0.000123456789"});
+    return res;
+}
+
+// values that are decoded the same way by JSON tree and JSON text encoders
+std::vector<column_sample> check_samples() {
+    auto res = samples();
+    res.push_back({bench_textoid, "line\nbreak\ttab \\ back\x01slash \x1f\x7f \xc3\xa9"});
+    res.push_back({bench_textoid, ""});
+    res.push_back({bench_float8oid, "-1.5e-300"});
+    res.push_back({bench_booloid, "f"});
+    res.push_back({bench_int4arrayoid, "{}"});
+    res.push_back({bench_boolarrayoid, "{t,f,NULL}"});
+    res.push_back({bench_float8arrayoid, "{1.5,-2,NULL,3e+100}"});
+    res.push_back({bench_textarrayoid, "{}"});
+    return res;
+}
+
+class result_holder {
+    PGresult* res;
+
+public:
+    result_holder(size_t columns_count, size_t rows_count,
+            std::vector<column_sample> smp = samples()) :
+    res(PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK)) {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < columns_count; i++) {
+            names.push_back("column_" + sl::support::to_string(i));
+        }
+        std::vector<PGresAttDesc> attrs;
+        for (size_t i = 0; i < columns_count; i++) {
+            PGresAttDesc ad;
+            ad.name = const_cast<char*>(names[i].c_str());
+            ad.tableid = 0;
+            ad.columnid = 0;
+            ad.format = 0;
+            ad.typid = smp[i % smp.size()].type;
+            ad.typlen = -1;
+            ad.atttypmod = -1;
+            attrs.push_back(ad);
+        }
+        PQsetResultAttrs(res, static_cast<int>(attrs.size()), attrs.data());
+        for (size_t r = 0; r < rows_count; r++) {
+            for (size_t c = 0; c < columns_count; c++) {
+                auto& val = smp[c % smp.size()].value;
+                PQsetvalue(res, static_cast<int>(r), static_cast<int>(c),
+                        const_cast<char*>(val.c_str()), static_cast<int>(val.length()));
+            }
+        }
+    }
+
+    ~result_holder() {
+        PQclear(res);
+    }
+
+    result_holder(const result_holder&) = delete;
+
+    result_holder& operator=(const result_holder&) = delete;
+
+    PGresult* get() {
+        return res;
+    }
+};
+
+sl::json::value measure(const std::string& name, sl::json::value params, std::function<void()> fun) {
+    // warm up
+    fun();
+    uint64_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::nanoseconds(0);
+    while (elapsed < min_duration || iterations < min_iterations) {
+        fun();
+        iterations += 1;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    auto per_op = static_cast<double>(nanos) / static_cast<double>(iterations);
+    std::cerr << name << " " << params.dumps() << ": " << per_op << " ns/op" << std::endl;
+    return {
+        { "name", name },
+        { "params", std::move(params) },
+        { "iterations", static_cast<int64_t>(iterations) },
+        { "totalNanos", static_cast<int64_t>(nanos) },
+        { "nanosPerOp", per_op }
+    };
+}
+
+std::string make_array_literal(size_t size) {
+    std::string res = "{";
+    for (size_t i = 0; i < size; i++) {
+        if (i > 0) {
+            res.push_back(',');
+        }
+        if (0 == i % 7) {
+            res.append("NULL");
+        } else if (0 == i % 3) {
+            res.append("\"elem ").append(sl::support::to_string(i)).append("\"");
+        } else {
+            res.append("elem_").append(sl::support::to_string(i));
+        }
+    }
+    res.push_back('}');
+    return res;
+}
+
+std::string make_named_sql(size_t params_count) {
+    std::string res = "select * from bench_table where col_0 = :param_0";
+    for (size_t i = 1; i < params_count; i++) {
+        auto num = sl::support::to_string(i);
+        res.append(" and col_").append(num).append(" = :param_").append(num).append("::int8");
+    }
+    res.append(" and note = 'literal: with colon'");
+    return res;
+}
+
+sl::json::value make_named_params(size_t params_count) {
+    std::vector<sl::json::field> fields;
+    for (size_t i = 0; i < params_count; i++) {
+        auto fname = "param_" + sl::support::to_string(i);
+        switch (i % 4) {
+        case 0: fields.emplace_back(fname, sl::json::value(static_cast<int64_t>(i))); break;
+        case 1: fields.emplace_back(fname, sl::json::value("value " + sl::support::to_string(i))); break;
+        case 2: fields.emplace_back(fname, sl::json::value(static_cast<double>(i) / 3)); break;
+        default: fields.emplace_back(fname, sl::json::value(true)); break;
+        }
+    }
+    return sl::json::value(std::move(fields));
+}
+
+void bench_result_as_json(std::vector<sl::json::value>& out) {
+    for (size_t cols : {4, 32, 128}) {
+        for (size_t rows : {1, 100, 10000}) {
+            auto holder = std::make_shared<result_holder>(cols, rows);
+            out.emplace_back(measure("get_result_as_json", {
+                { "columns", static_cast<int64_t>(cols) },
+                { "rows", static_cast<int64_t>(rows) }
+            }, [holder] {
+                auto json = pg::get_result_as_json(holder->get());
+                sink += json.as_array().size();
+            }));
+        }
+    }
+    // decoded in parallel
+    for (size_t rows : {100000, 400000}) {
+        size_t cols = 8;
+        auto holder = std::make_shared<result_holder>(cols, rows);
+        out.emplace_back(measure("get_result_as_json", {
+            { "columns", static_cast<int64_t>(cols) },
+            { "rows", static_cast<int64_t>(rows) }
+        }, [holder] {
+            auto json = pg::get_result_as_json(holder->get());
+            sink += json.as_array().size();
+        }));
+    }
+}
+
+void bench_encoding(std::vector<sl::json::value>& out) {
+    for (size_t cols : {8, 64, 256}) {
+        size_t rows = 1000;
+        auto holder = std::make_shared<result_holder>(cols, rows, numeric_samples());
+        auto json_len = pg::get_result_as_json(holder->get()).dumps().length();
+        auto msgpack = std::string();
+        pg::write_result_as_msgpack(holder->get(), msgpack);
+        out.emplace_back(measure("encode_result_json", {
+            { "columns", static_cast<int64_t>(cols) },
+            { "rows", static_cast<int64_t>(rows) },
+            { "payloadBytes", static_cast<int64_t>(json_len) }
+        }, [holder] {
+            auto str = pg::get_result_as_json(holder->get()).dumps();
+            sink += str.length();
+        }));
+        out.emplace_back(measure("encode_result_json_text", {
+            { "columns", static_cast<int64_t>(cols) },
+            { "rows", static_cast<int64_t>(rows) }
+        }, [holder] {
+            auto str = std::string();
+            pg::write_result_as_json_text(holder->get(), str);
+            sink += str.length();
+        }));
+        out.emplace_back(measure("encode_result_msgpack", {
+            { "columns", static_cast<int64_t>(cols) },
+            { "rows", static_cast<int64_t>(rows) },
+            { "payloadBytes", static_cast<int64_t>(msgpack.length()) }
+        }, [holder] {
+            auto str = std::string();
+            pg::write_result_as_msgpack(holder->get(), str);
+            sink += str.length();
+        }));
+        out.emplace_back(measure("decode_result_msgpack", {
+            { "columns", static_cast<int64_t>(cols) },
+            { "rows", static_cast<int64_t>(rows) }
+        }, [msgpack] {
+            auto json = wilton::db::msgpack_decode({msgpack.data(), msgpack.length()});
+            sink += json.as_array().size();
+        }));
+    }
+}
+
+void bench_json_strings(std::vector<sl::json::value>& out) {
+    for (size_t len : {16, 256, 65536}) {
+        // one quote every 1024 bytes
+        auto str = std::string(len, 'x');
+        for (size_t i = 1000; i < len; i += 1024) {
+            str[i] = '"';
+        }
+        out.emplace_back(measure("write_json_string", {
+            { "length", static_cast<int64_t>(len) }
+        }, [str] {
+            auto res = std::string();
+            res.reserve(str.length() + 2);
+            wilton::db::write_json_string(str, res);
+            sink += res.length();
+        }));
+    }
+}
+
+void bench_arrays(std::vector<sl::json::value>& out) {
+    for (size_t size : {4, 64, 1024}) {
+        auto literal = make_array_literal(size);
+        out.emplace_back(measure("prepare_text_array", {
+            { "arraySize", static_cast<int64_t>(size) }
+        }, [literal] {
+            auto val = literal;
+            pg::prepare_text_array(val);
+            sink += val.length();
+        }));
+        out.emplace_back(measure("prepare_json_array", {
+            { "arraySize", static_cast<int64_t>(size) }
+        }, [literal] {
+            auto val = literal;
+            auto json = pg::prepare_json_array(val);
+            sink += json.as_array().size();
+        }));
+    }
+}
+
+void bench_parse_query(std::vector<sl::json::value>& out) {
+    for (size_t count : {2, 16, 64}) {
+        auto sql = make_named_sql(count);
+        out.emplace_back(measure("parse_query", {
+            { "paramsCount", static_cast<int64_t>(count) }
+        }, [sql] {
+            std::vector<std::string> names;
+            auto query = pg::parse_query(sql, names);
+            sink += query.length() + names.size();
+        }));
+    }
+}
+
+void bench_params(std::vector<sl::json::value>& out) {
+    auto scalars = std::make_shared<std::vector<sl::json::value>>();
+    scalars->emplace_back(static_cast<int64_t>(42));
+    scalars->emplace_back(2.718281828);
+    scalars->emplace_back("some string parameter");
+    scalars->emplace_back(true);
+    out.emplace_back(measure("get_json_params_values", {
+        { "kind", "scalars" }
+    }, [scalars] {
+        for (auto& val : *scalars) {
+            auto pv = pg::get_json_params_values(val);
+            sink += pv.value.length();
+        }
+    }));
+    for (size_t size : {4, 64, 1024}) {
+        std::vector<sl::json::value> vec;
+        for (size_t i = 0; i < size; i++) {
+            vec.emplace_back(static_cast<int64_t>(i));
+        }
+        auto arr = std::make_shared<sl::json::value>(std::move(vec));
+        out.emplace_back(measure("get_json_params_values", {
+            { "kind", "array" },
+            { "arraySize", static_cast<int64_t>(size) }
+        }, [arr] {
+            auto pv = pg::get_json_params_values(*arr);
+            sink += pv.value.length();
+        }));
+        auto obj = std::make_shared<sl::json::value>(make_named_params(size));
+        out.emplace_back(measure("get_json_params_values", {
+            { "kind", "object" },
+            { "fieldsCount", static_cast<int64_t>(size) }
+        }, [obj] {
+            auto pv = pg::get_json_params_values(*obj);
+            sink += pv.value.length();
+        }));
+    }
+    for (size_t count : {2, 16, 64}) {
+        auto names = std::make_shared<std::vector<std::string>>();
+        pg::parse_query(make_named_sql(count), *names);
+        auto params = std::make_shared<sl::json::value>(make_named_params(count));
+        out.emplace_back(measure("prepare_params", {
+            { "paramsCount", static_cast<int64_t>(count) }
+        }, [names, params] {
+            pg::bind_buffers binds;
+            pg::setup_params_from_json(binds, *params, *names);
+            pg::prepare_params(binds, *names);
+            sink += binds.types.size();
+        }));
+        // buffers are reused by the connection between statements
+        auto binds = std::make_shared<pg::bind_buffers>();
+        out.emplace_back(measure("prepare_params_reused", {
+            { "paramsCount", static_cast<int64_t>(count) }
+        }, [names, params, binds] {
+            binds->reset();
+            pg::setup_params_from_json(*binds, *params, *names);
+            pg::prepare_params(*binds, *names);
+            sink += binds->types.size();
+        }));
+    }
+}
+
+void bench_requests(std::vector<sl::json::value>& out) {
+    for (size_t count : {0, 16, 256}) {
+        auto pgsql = sl::json::value({
+            { "connectionHandle", static_cast<int64_t>(140234567) },
+            { "sql", make_named_sql(count > 0 ? count : 1) },
+            { "params", make_named_params(count) },
+            { "cache", true },
+            { "timeoutMillis", static_cast<int64_t>(1000) }
+        }).dumps();
+        out.emplace_back(measure("parse_pgsql_execute_request", {
+            { "paramsCount", static_cast<int64_t>(count) }
+        }, [pgsql] {
+            auto req = wilton::db::parse_pgsql_execute_request({pgsql.data(), pgsql.length()});
+            sink += req.sql.length();
+        }));
+        auto orm = sl::json::value({
+            { "connectionHandle", static_cast<int64_t>(140234567) },
+            { "sql", make_named_sql(count > 0 ? count : 1) },
+            { "params", make_named_params(count) }
+        }).dumps();
+        out.emplace_back(measure("parse_orm_statement_request", {
+            { "paramsCount", static_cast<int64_t>(count) }
+        }, [orm] {
+            auto req = wilton::db::parse_orm_statement_request({orm.data(), orm.length()});
+            sink += req.sql.length();
+        }));
+    }
+}
+
+size_t reference_escape(const std::string& str) {
+    for (size_t i = 0; i < str.length(); i++) {
+        unsigned char uch = static_cast<unsigned char>(str[i]);
+        if ('"' == uch || '\\' == uch || uch < 0x20) {
+            return i;
+        }
+    }
+    return str.length();
+}
+
+// all lengths around 16- and 32-byte blocks, with escape byte at every position,
+// at different alignments, fillers are bytes close to the escaped ranges
+void check_json_escape() {
+    const std::string escapes = std::string("\"\\\x1f\n", 4) + std::string(1, '\0');
+    const std::string fillers = std::string("x \x7f\x80\xff\x21\x5b\x5d");
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t len = 0; len <= 64; len++) {
+            for (char filler : fillers) {
+                auto buf = std::string(offset, '"') + std::string(len, filler);
+                auto expected = len;
+                auto actual = wilton::db::find_json_escape(buf.data() + offset, len);
+                if (expected != actual) throw std::runtime_error("find_json_escape mismatch," +
+                        std::string(" length: ") + sl::support::to_string(len) + ", no escapes");
+                for (size_t pos = 0; pos < len; pos++) {
+                    for (char esc : escapes) {
+                        auto str = std::string(len, filler);
+                        str[pos] = esc;
+                        buf = std::string(offset, 'x') + str;
+                        expected = reference_escape(str);
+                        actual = wilton::db::find_json_escape(buf.data() + offset, len);
+                        if (expected != actual) throw std::runtime_error("find_json_escape mismatch," +
+                                std::string(" length: ") + sl::support::to_string(len) +
+                                ", position: " + sl::support::to_string(pos) +
+                                ", byte: " + sl::support::to_string(static_cast<int>(static_cast<unsigned char>(esc))));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void check_json_text() {
+    auto smp = check_samples();
+    for (size_t rows : {0, 1, 3}) {
+        result_holder holder{smp.size(), rows, smp};
+        auto text = std::string();
+        pg::write_result_as_json_text(holder.get(), text);
+        if (std::string::npos != text.find('\n')) throw std::runtime_error(
+                "write_result_as_json_text output is not compact: " + text);
+        auto expected = pg::get_result_as_json(holder.get()).dumps();
+        auto actual = sl::json::loads(text).dumps();
+        if (expected != actual) throw std::runtime_error("write_result_as_json_text mismatch," +
+                std::string(" expected: ") + expected + ", actual: " + actual);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        check_json_escape();
+        check_json_text();
+        std::vector<sl::json::value> results;
+        bench_result_as_json(results);
+        bench_encoding(results);
+        bench_json_strings(results);
+        bench_arrays(results);
+        bench_parse_query(results);
+        bench_params(results);
+        bench_requests(results);
+        auto json = sl::json::value({
+            { "benchmark", "wilton_db" },
+            { "results", std::move(results) }
+        }).dumps();
+        if (argc > 1) {
+            std::ofstream file{argv[1]};
+            file << json << std::endl;
+        } else {
+            std::cout << json << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
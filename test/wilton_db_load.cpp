@@ -0,0 +1,395 @@
+/*
+ * Copyright 2018, alex at staticlibs.net
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * File:   wilton_db_load.cpp
+ * Author: alex
+ *
+ * Multi-threaded load driver, runs workloads through wiltoncall
+ * against local PostgreSQL and SQLite, reports throughput and latency percentiles.
+ *
+ * Usage: wilton_db_load config.json [output.json]
+ *
+ * Config example:
+ * {
+ *     "threads": [1, 4, 16],
+ *     "durationMillis": 5000,
+ *     "tableRows": 10000,
+ *     "workloads": ["point_select", "range_scan", "insert", "mixed"],
+ *     "pgsqlParameters": "host=127.0.0.1 port=5432 dbname=test user=test password=test",
+ *     "ormUrls": ["postgresql://host=127.0.0.1 port=5432 dbname=test user=test password=test", "sqlite://load_test.db"],
+ *     "tracePath": "load_trace.json" // optional, phase spans in Chrome trace format
+ * }
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wilton/wilton.h"
+#include "wilton/wiltoncall.h"
+
+#include "staticlib/json.hpp"
+#include "staticlib/support.hpp"
+
+#include "wilton/support/exception.hpp"
+
+namespace { // anonymous
+
+const int range_width = 100;
+
+class errcheck {
+public:
+    void operator=(char* err) {
+        if (nullptr != err) {
+            auto msg = std::string(err);
+            wilton_free(err);
+            throw wilton::support::exception(msg);
+        }
+    }
+};
+
+std::string call(const std::string& name, const std::string& data) {
+    errcheck err;
+    char* out = nullptr;
+    int out_len = 0;
+    err = wiltoncall(name.c_str(), static_cast<int>(name.length()), data.c_str(), static_cast<int>(data.length()),
+            std::addressof(out), std::addressof(out_len));
+    if (nullptr == out) {
+        return std::string();
+    }
+    auto res = std::string(out, static_cast<size_t>(out_len));
+    wilton_free(out);
+    return res;
+}
+
+// db_connection_* or db_pgsql_* calls over a single connection
+class driver {
+    bool pgsql;
+    bool cache;
+    int64_t handle;
+
+public:
+    driver(bool pgsql, bool cache, const std::string& conn) :
+    pgsql(pgsql),
+    cache(cache) {
+        std::string out;
+        if (pgsql) {
+            out = call("db_pgsql_connection_open", sl::json::value({
+                { "parameters", conn }
+            }).dumps());
+        } else {
+            out = call("db_connection_open", conn);
+        }
+        handle = sl::json::loads(out)["connectionHandle"].as_int64_or_throw("connectionHandle");
+    }
+
+    ~driver() STATICLIB_NOEXCEPT {
+        try {
+            auto name = pgsql ? "db_pgsql_connection_close" : "db_connection_close";
+            call(name, sl::json::value({
+                { "connectionHandle", handle }
+            }).dumps());
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    driver(const driver&) = delete;
+
+    driver& operator=(const driver&) = delete;
+
+    void query(const std::string& sql, sl::json::value params) {
+        if (pgsql) {
+            call("db_pgsql_connection_execute_sql", sl::json::value({
+                { "connectionHandle", handle },
+                { "sql", sql },
+                { "params", std::move(params) },
+                { "cache", cache }
+            }).dumps());
+        } else {
+            call("db_connection_query", sl::json::value({
+                { "connectionHandle", handle },
+                { "sql", sql },
+                { "params", std::move(params) }
+            }).dumps());
+        }
+    }
+
+    void execute(const std::string& sql, sl::json::value params) {
+        if (pgsql) {
+            query(sql, std::move(params));
+        } else {
+            call("db_connection_execute", sl::json::value({
+                { "connectionHandle", handle },
+                { "sql", sql },
+                { "params", std::move(params) }
+            }).dumps());
+        }
+    }
+};
+
+struct backend {
+    std::string label;
+    bool pgsql;
+    bool cache;
+    std::string conn;
+};
+
+struct thread_result {
+    std::vector<uint64_t> latencies;
+    uint64_t errors = 0;
+};
+
+void run_operation(driver& dr, const std::string& workload, int table_rows, int thread_id, std::mt19937& rng) {
+    std::uniform_int_distribution<int> id_dist(0, table_rows - 1);
+    auto op = workload;
+    if ("mixed" == workload) {
+        // 80% point selects, 10% range scans, 10% inserts
+        auto dice = std::uniform_int_distribution<int>(0, 9)(rng);
+        op = dice < 8 ? "point_select" : (dice < 9 ? "range_scan" : "insert");
+    }
+    if ("point_select" == op) {
+        dr.query("select id, val, num from wilton_load where id = :id", {
+            { "id", id_dist(rng) }
+        });
+    } else if ("range_scan" == op) {
+        int lo = id_dist(rng);
+        dr.query("select id, val, num from wilton_load where id >= :lo and id < :hi order by id", {
+            { "lo", lo },
+            { "hi", lo + range_width }
+        });
+    } else if ("insert" == op) {
+        dr.execute("insert into wilton_load_log (tid, val) values (:tid, :val)", {
+            { "tid", thread_id },
+            { "val", "value " + sl::support::to_string(id_dist(rng)) }
+        });
+    } else {
+        throw wilton::support::exception("Unknown workload: [" + workload + "]");
+    }
+}
+
+void setup_tables(const backend& be, int table_rows) {
+    driver dr(be.pgsql, false, be.conn);
+    for (auto& table : {"wilton_load", "wilton_load_log"}) {
+        try {
+            dr.execute(std::string("drop table ") + table, {});
+        } catch (const std::exception&) {
+            // table does not exist
+        }
+    }
+    dr.execute("create table wilton_load (id int primary key, val varchar(64), num int)", {});
+    dr.execute("create table wilton_load_log (tid int, val varchar(64))", {});
+    dr.execute("begin", {});
+    for (int i = 0; i < table_rows; i++) {
+        dr.execute("insert into wilton_load (id, val, num) values (:id, :val, :num)", {
+            { "id", i },
+            { "val", "value " + sl::support::to_string(i) },
+            { "num", i % 1000 }
+        });
+    }
+    dr.execute("commit", {});
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, double pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto idx = static_cast<size_t>(pct * static_cast<double>(sorted.size() - 1));
+    return sorted[idx];
+}
+
+sl::json::value run_case(const backend& be, const std::string& workload, size_t threads_count,
+        std::chrono::milliseconds duration, int table_rows) {
+    std::vector<thread_result> results(threads_count);
+    std::vector<std::thread> threads;
+    std::atomic<bool> start{false};
+    auto deadline = std::make_shared<std::chrono::steady_clock::time_point>();
+    for (size_t t = 0; t < threads_count; t++) {
+        threads.emplace_back([&, t] {
+            thread_result& tr = results[t];
+            try {
+                driver dr(be.pgsql, be.cache, be.conn);
+                std::mt19937 rng(static_cast<uint32_t>(t + 1));
+                while (!start.load()) {
+                    std::this_thread::yield();
+                }
+                while (std::chrono::steady_clock::now() < *deadline) {
+                    auto op_start = std::chrono::steady_clock::now();
+                    try {
+                        run_operation(dr, workload, table_rows, static_cast<int>(t), rng);
+                    } catch (const std::exception&) {
+                        tr.errors += 1;
+                        continue;
+                    }
+                    auto op_time = std::chrono::steady_clock::now() - op_start;
+                    tr.latencies.push_back(static_cast<uint64_t>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(op_time).count()));
+                }
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                tr.errors += 1;
+            }
+        });
+    }
+    // connections are opened before the clock starts
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    auto begin = std::chrono::steady_clock::now();
+    *deadline = begin + duration;
+    start.store(true);
+    for (auto& th : threads) {
+        th.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    std::vector<uint64_t> all;
+    uint64_t errors = 0;
+    for (auto& tr : results) {
+        all.insert(all.end(), tr.latencies.begin(), tr.latencies.end());
+        errors += tr.errors;
+    }
+    std::sort(all.begin(), all.end());
+    auto secs = std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+    auto throughput = static_cast<double>(all.size()) / secs;
+    auto p50 = percentile(all, 0.5);
+    auto p99 = percentile(all, 0.99);
+    auto p999 = percentile(all, 0.999);
+    std::cout << be.label << "\t" << workload << "\t" << threads_count << "\t"
+            << static_cast<int64_t>(throughput) << "\t" << p50 / 1000 << "\t" << p99 / 1000 << "\t"
+            << p999 / 1000 << "\t" << errors << std::endl;
+    return {
+        { "backend", be.label },
+        { "workload", workload },
+        { "threads", static_cast<int64_t>(threads_count) },
+        { "operations", static_cast<int64_t>(all.size()) },
+        { "errors", static_cast<int64_t>(errors) },
+        { "throughputPerSecond", throughput },
+        { "p50Micros", static_cast<int64_t>(p50 / 1000) },
+        { "p99Micros", static_cast<int64_t>(p99 / 1000) },
+        { "p999Micros", static_cast<int64_t>(p999 / 1000) }
+    };
+}
+
+void init_wilton() {
+    errcheck err;
+    char* out = nullptr;
+    int out_len = 0;
+    std::string lconf = R"({
+          "appenders": [{
+            "appenderType" : "CONSOLE",
+            "thresholdLevel" : "WARN"
+          }],
+          "loggers": [{
+            "name": "staticlib",
+            "level": "WARN"
+          }]
+        })";
+    err = wilton_logger_initialize(lconf.c_str(), static_cast<int>(lconf.length()));
+    std::string conf = R"({
+          "defaultScriptEngine": "duktape",
+          "requireJsDirPath": "../../wilton-requirejs",
+          "requireJsConfig": {
+            "waitSeconds": 0,
+            "enforceDefine": true,
+            "nodeIdCompat": true,
+            "baseUrl": "../../modules"
+          }
+        })";
+    err = wiltoncall_init(conf.c_str(), static_cast<int>(conf.length()));
+    std::string name = "dyload_shared_library";
+    std::string dconf = R"({
+          "path": "libwilton_db.so"
+        })";
+    err = wiltoncall(name.c_str(), static_cast<int>(name.length()), dconf.c_str(), static_cast<int>(dconf.length()),
+            std::addressof(out), std::addressof(out_len));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: wilton_db_load config.json [output.json]" << std::endl;
+        return 1;
+    }
+    try {
+        std::ifstream cfile{argv[1]};
+        std::string ctext{std::istreambuf_iterator<char>(cfile), std::istreambuf_iterator<char>()};
+        auto conf = sl::json::loads(ctext);
+        std::vector<size_t> threads;
+        for (auto& th : conf["threads"].as_array_or_throw("threads")) {
+            threads.push_back(static_cast<size_t>(th.as_uint32_or_throw("threads")));
+        }
+        auto duration = std::chrono::milliseconds(conf["durationMillis"].as_uint32_or_throw("durationMillis"));
+        auto table_rows = static_cast<int>(conf["tableRows"].as_uint32_or_throw("tableRows"));
+        std::vector<std::string> workloads;
+        for (auto& wl : conf["workloads"].as_array_or_throw("workloads")) {
+            workloads.push_back(wl.as_string_nonempty_or_throw("workloads"));
+        }
+        std::vector<backend> backends;
+        if (sl::json::type::string == conf["pgsqlParameters"].json_type()) {
+            auto& params = conf["pgsqlParameters"].as_string();
+            backends.push_back({"pgsql_cache_on", true, true, params});
+            backends.push_back({"pgsql_cache_off", true, false, params});
+        }
+        if (sl::json::type::array == conf["ormUrls"].json_type()) {
+            for (auto& url : conf["ormUrls"].as_array()) {
+                auto& str = url.as_string_nonempty_or_throw("ormUrls");
+                backends.push_back({"orm_" + str.substr(0, str.find(':')), false, false, str});
+            }
+        }
+
+        init_wilton();
+        auto trace_path = std::string();
+        if (sl::json::type::string == conf["tracePath"].json_type()) {
+            trace_path = conf["tracePath"].as_string_nonempty_or_throw("tracePath");
+            call("db_tracing_start", sl::json::value({
+                { "maxEvents", 1000000 }
+            }).dumps());
+        }
+        std::cout << "backend\tworkload\tthreads\tops/s\tp50us\tp99us\tp999us\terrors" << std::endl;
+        std::vector<sl::json::value> results;
+        for (auto& be : backends) {
+            for (auto& wl : workloads) {
+                // fresh tables for every workload, so inserts do not affect following cases
+                setup_tables(be, table_rows);
+                for (size_t th : threads) {
+                    results.emplace_back(run_case(be, wl, th, duration, table_rows));
+                }
+            }
+        }
+        if (!trace_path.empty()) {
+            call("db_tracing_stop", sl::json::value({
+                { "path", trace_path }
+            }).dumps());
+        }
+        if (argc > 2) {
+            std::ofstream file{argv[2]};
+            file << sl::json::value(std::move(results)).dumps() << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}